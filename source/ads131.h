@@ -0,0 +1,166 @@
+/*
+=====================================================================
+ads131.h
+Driver of an external simultaneous-sampling ADC (ADS131M04, 4 channels
+of 24 bits over SPI), as an alternative to the ADC of the Arduino for
+the grid voltage and both currents of a single-phase supply
+=====================================================================
+*/
+
+/*
+NOTES:
+
+The ADC of the Mega converts one input at a time (Ig, Vx and Ic are some tens of microseconds apart, see measure.h) with 10 bits.
+The ADS131M04 samples its 4 differential inputs at the same instant, with 24 bits, and signals every new sample on its DRDY output.
+Its channels are: 0 Vx, 1 Ig, 2 Ic (3 unused). It is clocked at ADS_CLKIN_HZ, so that with OSR = 2048 the data rate is exactly
+SAMPLES_PER_CYCLE samples per grid cycle (8.192 MHz gives 2000 samples/s, 40 per cycle at 50Hz; 9.8304 MHz is needed at 60Hz).
+
+Wiring: SCLK, DIN, DOUT to the SPI pins of the Mega (52, 51, 50), CS to ADS_CS_PIN, DRDY to ADS_DRDY_PIN (an external interrupt pin),
+CLKIN to an oscillator of ADS_CLKIN_HZ. The inputs are differential around 0V, with a range of +-ADS_VREF_V:
+the conditioning circuits are designed so that the nominal RMS values give an amplitude of ADS_NOM_AMPL_V (80% of the range).
+
+On every DRDY, the interrupt reads a frame of 6 words of 24 bits (status, 4 channels, CRC) and, while a capture is running,
+stores the channels into the wide buffers (long). A capture waits for a positive zero crossing of Vx (as measure.h does with the Mega ADC),
+then stores the samples of one cycle. The frames are read also when not capturing, since the ADC expects it, but nothing else is done then.
+The interrupt runs 2000 times per second: CS is driven through its port register instead of digitalWrite(), and the SPI library is told
+about it (usingInterrupt), so that an SPI transaction of the main code is never interrupted by a frame.
+
+The driver is a backend of measure.h (class ExternalAdc), which then copies the samples of the cycle into its usual buffers (V0, Vx, Ig, Ic)
+as 12 bits counts equivalent to those of the Mega ADC (an input at ADS_NOM_AMPL_V is handled as one at MAX_AMPL_V, and V0 is the middle of the range), so that the health checks, the headroom
+statistics and the recorder are not changed, while values.h computes the RMS values and powers from the wide buffers,
+with 64 bits sums (the squares of 24 bits samples overflow 32 bits), scaled by wideScale to those equivalent counts.
+
+Only a single phase without sub-circuits is measured with the external ADC.
+*/
+
+const long ADS_SPI_HZ = 8000000L;       // SPI clock (the ADS131M04 accepts up to 25 MHz, the Mega gives at most 8 MHz)
+const long ADS_CLKIN_HZ = 8192000L;     // clock of the ADS131M04, for 40 samples per cycle at 50Hz with OSR = 2048
+const float ADS_VREF_V = 1.2;           // full scale of the inputs, at gain 1
+const float ADS_NOM_AMPL_V = 0.96;      // amplitude at the inputs at the nominal RMS values (80% of the full scale)
+const float ADS_FULL_SCALE = 8388608.0; // counts at the full scale, 2^23
+const long ADS_ZC_HYSTERESIS = 20000L;  // counts that Vx must be below 0 before a positive zero crossing is accepted (about 0.3% of the nominal amplitude)
+const uint16_t ADS_CMD_RESET = 0x0011;  // commands, in the first word of a frame
+const uint16_t ADS_CMD_WREG = 0x6000;   // write register: 0x6000 | address << 7 | (registers - 1)
+const uint8_t ADS_REG_CLOCK = 0x03;     // address of the CLOCK register
+const uint16_t ADS_CLOCK_OSR2048 = 0x0F12;   // CLOCK: 4 channels enabled, OSR = 2048, high-resolution power mode
+
+class Ads131 : public ExternalAdc
+{
+  public:
+    enum Capture : uint8_t { CAPTURE_IDLE, CAPTURE_WAIT_NEG, CAPTURE_WAIT_POS, CAPTURE_RUN, CAPTURE_DONE };   // states of a capture
+    Ads131(void) {};
+    void begin(int, int, float, float);       // CS and DRDY pins, and the equivalent amplitude and range of the Mega inputs (MAX_AMPL_V, 2 * V0_REF_V)
+    int capture(int, unsigned long);          // captures a cycle of samples from a zero crossing, 0 aligned, 1 no zero crossing, 2 no samples
+    static void onDrdy(void);                 // interrupt of DRDY, reads a frame
+    volatile unsigned long nFrames = 0UL;     // frames read while capturing, since start
+  private:
+    void transfer(uint16_t, uint16_t, long *);   // exchanges a frame: sends a command and its data, receives the status and the 4 channels
+    volatile uint8_t *csPort;                 // output register of the chip select pin
+    uint8_t csMask;                           // bit of the chip select pin in its register
+    volatile uint8_t state = CAPTURE_IDLE;    // state of the capture
+    volatile int index = 0;                   // next sample of the capture
+    int count = 0;                            // samples of the capture
+    static Ads131 *active;                    // object served by the interrupt
+};
+
+Ads131 *Ads131::active = NULL;
+
+void Ads131::begin(int csPin_arg, int drdyPin, float equivAmplV, float equivRangeV)
+{
+  long status[5];
+
+  csPort = portOutputRegister( digitalPinToPort(csPin_arg) );
+  csMask = digitalPinToBitMask(csPin_arg);
+  wideScale = ( ADS_VREF_V / ADS_FULL_SCALE ) * ( equivAmplV / ADS_NOM_AMPL_V ) * ( ( ADC_RESOLUTION_STEPS << 2 ) / equivRangeV );
+  pinMode(csPin_arg, OUTPUT);
+  digitalWrite(csPin_arg, HIGH);
+  pinMode(drdyPin, INPUT);
+  SPI.begin();
+  SPI.usingInterrupt( digitalPinToInterrupt(drdyPin) );   // the transactions of the main code mask DRDY
+
+  transfer(ADS_CMD_RESET, 0, status);
+  delay(1);
+  transfer(ADS_CMD_WREG | ( ADS_REG_CLOCK << 7 ), ADS_CLOCK_OSR2048, status);   // sets the data rate
+
+  active = this;
+  attachInterrupt(digitalPinToInterrupt(drdyPin), onDrdy, FALLING);
+}
+
+void Ads131::transfer(uint16_t command, uint16_t data, long *ch)
+{
+  SPI.beginTransaction(SPISettings(ADS_SPI_HZ, MSBFIRST, SPI_MODE1));
+  *csPort &= ~csMask;                   // CS low, without the overhead of digitalWrite() in the interrupt
+  for( int w = 0; w < 6; w++ )          // words of 24 bits: command (status), data (channel 0) .. , CRC
+  {
+    uint16_t out = ( w == 0 ) ? command : ( ( w == 1 ) ? data : 0 );
+    long value = SPI.transfer( out >> 8 );
+    value = ( value << 8 ) | SPI.transfer( out & 0xFF );
+    value = ( value << 8 ) | SPI.transfer( 0 );
+    if( w < 5 ) ch[w] = ( value & 0x800000L ) ? value - 0x1000000L : value;   // sign extension of the 24 bits
+  }
+  *csPort |= csMask;
+  SPI.endTransaction();
+}
+
+void Ads131::onDrdy(void)
+{
+  Ads131 *p = active;
+  unsigned long startUs;
+  long ch[5];                           // status and the 4 channels
+
+  if( ( p->state == CAPTURE_IDLE ) || ( p->state == CAPTURE_DONE ) )
+  {
+    p->transfer(0, 0, ch);              // the frame is read only because the ADC expects it
+    return;
+  }
+  startUs = micros();
+  p->transfer(0, 0, ch);                // NULL command
+  p->nFrames++;
+  switch( p->state )
+  {
+    case CAPTURE_WAIT_NEG:
+      if( ch[1] < - ADS_ZC_HYSTERESIS ) p->state = CAPTURE_WAIT_POS;
+      break;
+    case CAPTURE_WAIT_POS:
+      if( ch[1] < 0L ) break;
+      p->state = CAPTURE_RUN;           // positive zero crossing: this is the first sample
+    case CAPTURE_RUN:
+      for( int c = 0; c < WIDE_CHANNELS; c++ )
+        p->wide[c][p->index] = ch[c + 1];
+      if( ++p->index >= p->count ) p->state = CAPTURE_DONE;
+      break;
+    default:
+      break;
+  }
+  p->frameUs = micros() - startUs;
+}
+
+int Ads131::capture(int count_arg, unsigned long timeoutUs)
+{
+  unsigned long startUs = micros();
+  unsigned long nFramesStart = nFrames;
+  int result = 0;
+
+  count = count_arg;
+  index = 0;
+  state = CAPTURE_WAIT_NEG;
+  while( state != CAPTURE_DONE )
+  {
+    if( micros() - startUs < timeoutUs ) continue;
+    if( nFrames == nFramesStart )       // the ADC does not deliver samples (any more)
+    {
+      state = CAPTURE_IDLE;
+      memset(wide, 0, sizeof(wide));
+      return(2);
+    }
+    if( ( state == CAPTURE_WAIT_NEG ) || ( state == CAPTURE_WAIT_POS ) )
+    {
+      state = CAPTURE_RUN;              // no zero crossing (no grid voltage), the cycle is captured anyway
+      result = 1;
+    }
+    timeoutUs += 2 * 1000000.0 / MAINS_FREQ_HZ;
+    nFramesStart = nFrames;
+  }
+  state = CAPTURE_IDLE;
+  return(result);
+}
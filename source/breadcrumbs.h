@@ -0,0 +1,174 @@
+/*
+==================================================================
+breadcrumbs.h
+Records what the program is doing into RAM which is not cleared
+on reset (.noinit), and tells at start the cause of the reset and
+what the program was doing before it
+==================================================================
+*/
+
+/*
+NOTES:
+
+Every loop() cycle, the stage being executed (which task), the uptime, the last radio command sent and the status of the loads
+are recorded into a block of the .noinit RAM section, which keeps its contents through watchdog, brown-out and external resets.
+The block is protected by a magic number and a checksum, so that the random contents found after a power-on are discarded.
+
+The reset flags of MCUSR are read (and cleared) by captureResetFlags(), in the .init3 section, before the C runtime initialization,
+and the watchdog is disabled at once (otherwise it keeps running with its shortest timeout after a watchdog reset).
+Some bootloaders clear MCUSR before starting the program: in such a case the cause is reported as "unknown".
+
+After a watchdog reset, the stage tells which task hung, and the loads which were On are set to On again (see setup()),
+provided that the configuration of the loads has not changed (the CRC of the configuration is recorded too).
+Note that the restart after storing or erasing the configuration (commands CSAVE, CERASE) is a watchdog reset in stage "commands".
+*/
+
+const uint16_t BREADCRUMBS_MAGIC = 0xBC5A;    // identifies a valid block of breadcrumbs
+
+uint8_t resetFlags __attribute__ ((section (".noinit")));     // copy of MCUSR at reset
+
+void captureResetFlags(void) __attribute__ ((naked, used, section (".init3")));
+void captureResetFlags(void)
+{
+  resetFlags = MCUSR;
+  MCUSR = 0;
+  wdt_disable();
+}
+
+class Breadcrumbs
+{
+  public:
+    enum Stage : uint8_t { STAGE_SETUP, STAGE_TIME, STAGE_COMMANDS, STAGE_MODBUS, STAGE_SAMPLING, STAGE_COMPUTING, STAGE_DECIDING, STAGE_ACTIVATING, STAGE_RADIO, STAGE_DISPLAY, STAGE_PRINTING };   // stages of the program
+    enum Cause { RESET_POWER_ON, RESET_BROWN_OUT, RESET_WATCHDOG, RESET_EXTERNAL, RESET_UNKNOWN };   // causes of the reset
+    struct Crumbs                               // block of breadcrumbs stored in .noinit RAM
+    {
+      uint16_t magic;                           // BREADCRUMBS_MAGIC if valid
+      uint8_t stage;                            // stage being executed
+      uint16_t hours;                           // uptime
+      uint8_t minutes, seconds;
+      uint8_t radioModel;                       // last radio command sent: radio model,
+      uint8_t radioChannel;                     // channel,
+      uint8_t radioOn;                          // and On (1) or Off (0)
+      uint8_t loadsOn;                          // bit n set if load n is On
+      uint16_t configCrc;                       // CRC of the configuration, to know whether the load table has changed
+      uint8_t check;                            // checksum of all the previous bytes
+    };
+    Breadcrumbs(void) {};
+    void begin(uint16_t);                       // keeps the breadcrumbs of before the reset, and starts recording new ones
+    void mark(Stage);                           // records the stage being executed
+    void time(CountTime *);                     // records the uptime
+    void radio(uint8_t, uint8_t, bool);         // records a radio command
+    void load(int, bool);                       // records the status of a load
+    void print(void);                           // prints the cause of the reset and the previous breadcrumbs
+    const char *stageName(uint8_t);             // name of a stage
+    Cause cause = RESET_UNKNOWN;                // cause of the last reset
+    bool valid = false;                         // true if the previous breadcrumbs are valid
+    Crumbs previous;                            // breadcrumbs of before the reset
+    char lcdText[21];                           // summary of the reset, to be displayed
+  private:
+    uint8_t checksum(void);                     // checksum of the current breadcrumbs
+};
+
+Breadcrumbs::Crumbs crumbs __attribute__ ((section (".noinit")));   // current breadcrumbs
+
+void Breadcrumbs::begin(uint16_t configCrc)
+{
+  if( resetFlags & ( 1 << PORF ) )        cause = RESET_POWER_ON;
+  else if( resetFlags & ( 1 << BORF ) )   cause = RESET_BROWN_OUT;
+  else if( resetFlags & ( 1 << WDRF ) )   cause = RESET_WATCHDOG;
+  else if( resetFlags & ( 1 << EXTRF ) )  cause = RESET_EXTERNAL;
+  else                                    cause = RESET_UNKNOWN;
+
+  previous = crumbs;
+  valid = ( cause != RESET_POWER_ON ) && ( previous.magic == BREADCRUMBS_MAGIC ) && ( previous.check == checksum() );
+
+  memset(&crumbs, 0, sizeof(crumbs));
+  crumbs.magic = BREADCRUMBS_MAGIC;
+  crumbs.stage = STAGE_SETUP;
+  crumbs.configCrc = configCrc;
+  crumbs.check = checksum();
+
+  if( ( cause == RESET_WATCHDOG ) && valid )
+    snprintf_P(lcdText, sizeof(lcdText), PSTR("WDT in %-13s"), stageName(previous.stage));
+  else
+    snprintf_P(lcdText, sizeof(lcdText), PSTR("Reset by %-11S"), cause == RESET_POWER_ON  ? PSTR("power-on") :
+                                                                  cause == RESET_BROWN_OUT ? PSTR("brown-out") :
+                                                                  cause == RESET_WATCHDOG  ? PSTR("watchdog") :
+                                                                  cause == RESET_EXTERNAL  ? PSTR("external") : PSTR("unknown") );
+  print();
+}
+
+void Breadcrumbs::mark(Stage stage)
+{
+  crumbs.stage = stage;
+  crumbs.check = checksum();
+}
+
+void Breadcrumbs::time(CountTime *pCT)
+{
+  crumbs.hours = pCT->hours;
+  crumbs.minutes = pCT->minutes;
+  crumbs.seconds = pCT->seconds;
+  crumbs.check = checksum();
+}
+
+void Breadcrumbs::radio(uint8_t model, uint8_t channel, bool on)
+{
+  crumbs.stage = STAGE_RADIO;
+  crumbs.radioModel = model;
+  crumbs.radioChannel = channel;
+  crumbs.radioOn = on;
+  crumbs.check = checksum();
+}
+
+void Breadcrumbs::load(int iLoad, bool on)
+{
+  if( on ) crumbs.loadsOn |= ( 1 << iLoad );
+  else     crumbs.loadsOn &= ~( 1 << iLoad );
+  crumbs.check = checksum();
+}
+
+uint8_t Breadcrumbs::checksum(void)
+{
+  uint8_t *p = (uint8_t *) &crumbs;
+  uint8_t c = 0x5A;
+
+  for( size_t i = 0; i < offsetof(Crumbs, check); i++ )
+    c = ( ( c << 1 ) | ( c >> 7 ) ) ^ p[i];
+  return(c);
+}
+
+const char *Breadcrumbs::stageName(uint8_t stage)
+{
+  switch( stage )
+  {
+    case STAGE_SETUP:       return("setup");
+    case STAGE_TIME:        return("time");
+    case STAGE_COMMANDS:    return("commands");
+    case STAGE_MODBUS:      return("modbus");
+    case STAGE_SAMPLING:    return("sampling");
+    case STAGE_COMPUTING:   return("computing");
+    case STAGE_DECIDING:    return("deciding");
+    case STAGE_ACTIVATING:  return("activating");
+    case STAGE_RADIO:       return("radio");
+    case STAGE_DISPLAY:     return("display");
+    case STAGE_PRINTING:    return("printing");
+    default:                return("?");
+  }
+}
+
+void Breadcrumbs::print(void)
+{
+  Serial.println(lcdText);
+
+  if( !valid )
+  {
+    Serial.println(F("No breadcrumbs from before the reset\n"));
+    return;
+  }
+
+  snprintf_P(buffer, 199, PSTR("Before the reset: uptime %02d:%02d:%02d \tstage: %s \tlast radio: model %d channel %d %s \tloads On (bits): 0x%02X\n"),
+                            previous.hours, previous.minutes, previous.seconds, stageName(previous.stage),
+                            previous.radioModel, previous.radioChannel, previous.radioOn ? "On" : "Off", previous.loadsOn );
+  Serial.println(buffer);
+}
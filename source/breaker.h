@@ -0,0 +1,185 @@
+/*
+=====================================================================
+breaker.h
+Models the thermal stress of the circuit breakers from the RMS
+current of every cycle, so that the consumption margins come from
+the remaining thermal headroom instead of a flat limit in watts
+=====================================================================
+*/
+
+/*
+NOTES:
+
+A miniature circuit breaker (IEC 60898) trips on current, not on power: through its bimetal (thermal part) on sustained overloads,
+and through its coil (magnetic part) at once above 3 (curve B), 5 (curve C) or 10 (curve D) times its rating In.
+At low voltage or with a poor power factor, a flat limit in watts allows more current than the rating, or sheds loads too early.
+
+The thermal part is modelled as a first-order heating of the bimetal, updated every measured cycle with its RMS current:
+  theta += ( (I/In)^2 - theta ) * dt / BREAKER_TAU_S
+so that theta is the square of the constant current (in multiples of In) which would have heated the bimetal as much: Iequiv = In * sqrt(theta).
+dt is the duration of the measured cycles themselves (one cycle, or the cycles averaged, see measure.h), not the whole loop() between two measures:
+the time which is not measured is integrated with the filtered current, so that a single inrush cycle is not held for the whole loop().
+A peak between two measures is not seen, as by every other measure, but the filtered current accounts for a sustained one.
+A constant current below BREAKER_K * In (conventional non-tripping current) never trips, and above it the modelled trip time is
+  t = BREAKER_TAU_S * ln( (x^2 - theta) / (x^2 - BREAKER_K^2) )    (x = I/In)
+which with BREAKER_TAU_S = 60 s gives about 10 s at 2.55 In and 40 s at 1.45 In, on the fast side of the band of the standard (conservative).
+
+Two margins are computed, converted to watts with the grid voltage, with the limit L = BREAKER_K * sqrt(BREAKER_SHED):
+- the margin for switching On, from the filtered current (steady state): margin = V * ( In * L - I )
+  A load is switched On only if its power fits, so that the current it adds keeps the breaker below L * In for good.
+  The thermal headroom is not used for it: from a cold bimetal it would allow about 2.9 kW more, which would become a sustained overload.
+- the margin for shedding, from the thermal headroom: shed margin = V * ( In * L - Iequiv )
+  where Iequiv is predicted one decide period ahead with the filtered current, so that a load just switched On is counted before the next decision.
+  A short inrush heats the bimetal very little, so that it is tolerated, while a sustained overload raises theta until the shed margin is negative,
+  and the loads are shed before the breaker trips. The magnetic trip cannot be prevented by shedding (it lasts a few cycles):
+the cycles above the magnetic threshold of the curve are only counted and reported.
+
+The model is applied to the main breaker of every phase (setting breaker, its rating; 0 keeps the flat limits phmax1..3 or maxcons),
+and to every sub-circuit (its limit is the rating of its breaker). It replaces the margins of the phases and sub-circuits computed by values.h.
+The total consumption is still limited by the contracted power maxcons, with one phase as with several: the margins are the smallest of both.
+While simulating powers, the currents of the phases are computed from the simulated powers at the nominal voltage.
+*/
+
+const float BREAKER_TAU_S = 60.0;       // thermal time constant of the bimetal (seconds)
+const float BREAKER_K = 1.13;           // conventional non-tripping current, in multiples of the rating
+const float BREAKER_SHED = 0.85;        // fraction of the trip stress at which the margin becomes zero and the loads are shed
+const float BREAKER_FILTER_S = 1.0;     // time constant of the filtered current used for the prediction (seconds)
+const int BREAKERS_MAX = PHASES_MAX + SUBCIRCUITS_MAX;   // main breakers of the phases and breakers of the sub-circuits
+
+class Breaker
+{
+  public:
+    Breaker(void) {};
+    void begin(float, uint8_t, float);                      // rating of the main breakers (0 if not modelled), curve (magnetic threshold), nominal voltage
+    void update(CountTime *, Simul *, Measure *, Values *); // integrates the thermal stress of the last cycle and computes the margins
+    void print(CountTime *);                                // prints the status of every breaker
+    float tripTime(int);                                    // modelled time to trip at the present current (seconds, -1 if it does not trip)
+    bool enabled = false;                                   // true if the main breakers are modelled
+    int nBreakers = 0;                                      // breakers modelled: phases first, then sub-circuits
+    int nPhases = 0;                                        // main breakers, one per phase
+    uint8_t curve = 5;                                      // magnetic threshold, in multiples of the rating (3 B, 5 C, 10 D)
+    float ratingA[BREAKERS_MAX];                            // rating In of every breaker
+    float currentA[BREAKERS_MAX];                           // RMS current of the last cycle
+    float filteredA[BREAKERS_MAX];                          // filtered RMS current
+    float theta[BREAKERS_MAX];                              // thermal state, square of the equivalent current in multiples of In (trips at BREAKER_K^2)
+    float marginW[BREAKERS_MAX];                            // margin for switching On, from the filtered current, in watts
+    float shedW[BREAKERS_MAX];                              // margin for shedding, from the thermal headroom, in watts
+    unsigned long nMagnetic = 0UL;                          // cycles above the magnetic threshold since start
+  private:
+    float mainRatingA;                                      // rating of the main breaker of every phase
+    float vxNom;                                            // nominal voltage, when simulating powers
+    bool inMagnetic = false;                                // true while the cycles are above the magnetic threshold
+    unsigned long lastEndUs = 0UL;                          // when the previous measure ended
+};
+
+void Breaker::begin(float mainRatingA_arg, uint8_t curve_arg, float vxNom_arg)
+{
+  enabled = ( mainRatingA_arg > 0.0 );
+  mainRatingA = mainRatingA_arg;
+  curve = curve_arg;
+  vxNom = vxNom_arg;
+  for( int b = 0; b < BREAKERS_MAX; b++ )
+  {
+    ratingA[b] = mainRatingA;
+    currentA[b] = 0.0;
+    filteredA[b] = 0.0;
+    theta[b] = 0.0;
+    marginW[b] = 0.0;
+    shedW[b] = 0.0;
+  }
+}
+
+void Breaker::update(CountTime *pCT, Simul *pSM, Measure *pCM, Values *pCV)
+{
+  unsigned long dtUs = pCM->cycleStartUs - pCM->prevCycleStartUs;   // time between the starts of the last two measures
+  unsigned long measuredUs = pCM->cycleEndUs - pCM->cycleStartUs;    // duration of the last measure
+  unsigned long gapUs = pCM->cycleStartUs - lastEndUs;                // time not measured, since the previous measure
+  int b, n;
+
+  bool first = ( lastEndUs == 0UL );
+  lastEndUs = pCM->cycleEndUs;
+  if( !enabled || first || ( pCM->prevCycleStartUs == 0UL ) ) return;
+
+  nPhases = pCV->nPhases;
+  nBreakers = nPhases + pCV->nNodes;
+  float step = min( 1.0, measuredUs / ( 1.0e6 * BREAKER_TAU_S ) );
+  float gapStep = min( 1.0, gapUs / ( 1.0e6 * BREAKER_TAU_S ) );
+  float alpha = min( 1.0, dtUs / ( 1.0e6 * BREAKER_FILTER_S ) );
+  float ahead = min( 1.0, pCT->decidePeriod_s / BREAKER_TAU_S );
+  float limit = BREAKER_K * sqrt( BREAKER_SHED );   // equivalent current at which the margin is zero, in multiples of In
+  bool magnetic = false;
+
+  for( b = 0; b < nBreakers; b++ )
+  {
+    float volts;
+    if( b < nPhases )                                 // main breaker of a phase
+    {
+      ratingA[b] = mainRatingA;
+      volts = ( pSM->mode == Simul::SIMUL_POWER ) ? vxNom : pCV->VxEffPh[b];
+      currentA[b] = ( pSM->mode == Simul::SIMUL_POWER ) ? - pCV->PcPh[b] / vxNom : pCV->IcEffPh[b];
+    }
+    else                                              // breaker of a sub-circuit
+    {
+      n = b - nPhases;
+      ratingA[b] = pCV->NodeLimitA[n];
+      volts = pCV->VxEffPh[ pCV->NodePhase[n] ];
+      currentA[b] = pCV->IsEff[n];
+    }
+
+    float x = currentA[b] / ratingA[b];
+    float xf = filteredA[b] / ratingA[b];
+    theta[b] += ( xf * xf - theta[b] ) * gapStep;     // the time not measured, at the filtered current
+    theta[b] += ( x * x - theta[b] ) * step;          // the measured cycles, at their own current
+    filteredA[b] += ( currentA[b] - filteredA[b] ) * alpha;
+    if( x >= curve ) magnetic = true;
+
+    xf = filteredA[b] / ratingA[b];
+    float predicted = max( theta[b], theta[b] + ( xf * xf - theta[b] ) * ahead );   // thermal state at the next decision, if the current is kept
+    marginW[b] = volts * ( ratingA[b] * limit - filteredA[b] );                     // steady state, for switching On
+    shedW[b] = volts * ratingA[b] * ( limit - sqrt( predicted ) );                 // thermal headroom, for shedding
+
+    if( b < nPhases ) { pCV->MarginPh[b] = marginW[b]; pCV->ShedMarginPh[b] = shedW[b]; }
+    else              { pCV->MarginNd[n] = marginW[b]; pCV->ShedMarginNd[n] = shedW[b]; }
+  }
+
+  if( magnetic && !inMagnetic )                       // reported once for every burst of cycles
+  {
+    snprintf_P(buffer, 149, PSTR("%s WARNING: current above the magnetic threshold (%d In) of a breaker, it may trip at once\n"), pCT->hhmmss, curve);
+    Serial.print(buffer);
+  }
+  if( magnetic ) nMagnetic++;
+  inMagnetic = magnetic;
+}
+
+float Breaker::tripTime(int b)
+{
+  float x2 = sq( filteredA[b] / ratingA[b] );
+  float k2 = sq( BREAKER_K );
+
+  if( x2 <= k2 ) return( -1.0 );
+  return( BREAKER_TAU_S * log( max( 1.0, ( x2 - theta[b] ) / ( x2 - k2 ) ) ) );
+}
+
+void Breaker::print(CountTime *pCT)
+{
+  Serial.print(pCT->hhmmss);
+  if( !enabled )
+  {
+    Serial.println(F(" \tbreakers not modelled (setting breaker 0), flat limits in use"));
+    return;
+  }
+
+  for( int b = 0; b < nBreakers; b++ )
+  {
+    int stress = round( 100.0 * theta[b] / sq( BREAKER_K ) );
+    int trip = round( tripTime(b) );
+    snprintf_P(buffer, 199, PSTR(" \t%S%d: In_A:%d I_A:%d.%1d Iequiv_A:%d.%1d stress:%d%% margin_W:%d shed_W:%d trip_s:%d"),
+                              b < nPhases ? PSTR("L") : PSTR("node "), b < nPhases ? b + 1 : b - nPhases + 1,
+                              (int) ratingA[b], (int) filteredA[b], ( (int) ( 10.0 * filteredA[b] ) ) % 10,
+                              (int) ( ratingA[b] * sqrt( theta[b] ) ), ( (int) ( 10.0 * ratingA[b] * sqrt( theta[b] ) ) ) % 10,
+                              stress, (int) round( marginW[b] ), (int) round( shedW[b] ), trip );
+    Serial.print(buffer);
+  }
+  snprintf_P(buffer, 99, PSTR(" \tcurve:%d magnetic_cycles:%lu"), curve, nMagnetic);
+  Serial.println(buffer);
+}
@@ -0,0 +1,286 @@
+/*
+==============================================================
+command.h
+Receives the command lines from serial, splits them in tokens,
+checks their typed arguments against a registry of commands
+and calls the handler of the command
+==============================================================
+*/
+
+/*
+NOTES:
+
+The registry is a table of Command::Entry stored in flash (see commands.ino), each one holding:
+- name:    name of the command, case insensitive
+- args:    types of the arguments, one character per argument:
+             'i' integer
+             'f' fixed-point number with up to 3 decimals, stored as value * 1000
+             's' string (a single token)
+           uppercase if the argument is mandatory, lowercase if optional (optional ones must be at the end)
+- handler: function called when the command and its arguments are correct
+- usage:   text describing the arguments, for the help
+- help:    one line description, for the help
+An entry with an empty name only continues the help text of the previous one.
+
+Tokens are separated by spaces, tabs or commas.
+Lines are ended by CR or LF, empty lines are ignored.
+Lines longer than CMD_LINE_MAX characters, or with non printable characters, are discarded as a whole.
+Every error is replied with a line beginning with "ERR".
+
+The help text is generated from the registry, so every new command appears in it.
+*/
+
+const int CMD_LINE_MAX = 64;        // maximum length of a command line (without terminator)
+const int CMD_ARGS_MAX = 6;         // maximum number of arguments of a command
+const int CMD_FIX_DECIMALS = 3;     // decimals of the fixed-point arguments
+const long CMD_FIX_SCALE = 1000L;   // scale of the fixed-point arguments, 10 ^ CMD_FIX_DECIMALS
+const int CMD_NAME_MAX = 7;         // maximum length of a command name
+const int CMD_USAGE_MAX = 27;       // maximum length of the arguments description of a command
+const int CMD_HELP_MAX = 55;        // maximum length of the one line help of a command
+
+class Command
+{
+  public:
+    typedef void (*Handler)(Command *);
+    struct Entry                          // entry of the registry of commands, stored in flash
+    {
+      char name[CMD_NAME_MAX+1];          // command name
+      char args[CMD_ARGS_MAX+1];          // types of the arguments
+      Handler handler;                    // function executing the command
+      char usage[CMD_USAGE_MAX+1];        // arguments description for the help
+      char help[CMD_HELP_MAX+1];          // one line help
+    };
+
+    Command(void) {};
+    void begin(const Entry *, int);       // sets the registry of commands
+    void receive(void);                   // reads the serial characters and executes the command when a line is complete, non-blocking
+    int execute(char *);                  // executes a command line, returns 0 or a negative error code
+    void printHelp(void);                 // prints the help generated from the registry
+    void error(const char *);             // replies an error message (in flash)
+    long intArg(int, long);               // value of an integer or fixed-point argument, or the default if not entered
+    static bool parseInt(const char *, long *);   // parses a signed integer, false if not valid or overflowing
+    static bool parseFix(const char *, long *);   // parses a signed fixed-point number into value * CMD_FIX_SCALE, false if not valid or overflowing
+
+    char *name;                           // name of the command being executed, as entered
+    int nArgs;                            // number of arguments entered
+    long num[CMD_ARGS_MAX];               // values of the integer and fixed-point arguments
+    char *str[CMD_ARGS_MAX];              // text of every argument
+    long nLines = 0;                      // number of lines received
+    long nErrors = 0;                     // number of lines rejected
+
+  private:
+    const Entry *table;                   // registry of commands (in flash)
+    int nEntries = 0;                     // number of commands in the registry
+    char line[CMD_LINE_MAX+1];            // received characters of the current line
+    int len = 0;                          // number of characters in line
+    bool discard = false;                 // true if the current line is being discarded (too long or invalid character)
+};
+
+void Command::begin(const Entry *table_arg, int nEntries_arg)
+{
+  table = table_arg;
+  nEntries = nEntries_arg;
+  len = 0;
+  discard = false;
+}
+
+void Command::receive(void)
+{
+  int c;
+
+  while( ( c = Serial.read() ) >= 0 )   // reads all the characters available, returns if none
+  {
+    if( ( c == '\n' ) || ( c == '\r' ) )
+    {
+      if( discard )
+      {
+        nLines++;
+        nErrors++;
+        error(PSTR("line too long or invalid character"));
+      }
+      else if( len > 0 )
+      {
+        line[len] = 0;
+        nLines++;
+        if( execute(line) < 0 ) nErrors++;
+      }
+      len = 0;
+      discard = false;
+    }
+    else if( discard )
+      ;                                                 // ignores the rest of a discarded line
+    else if( ( len >= CMD_LINE_MAX ) || ( c < ' ' && c != '\t' ) || ( c > '~' ) )
+      discard = true;
+    else
+      line[len++] = (char) c;
+  }
+}
+
+int Command::execute(char *pLine)
+{
+  char *token[CMD_ARGS_MAX+2];
+  int nTokens = 0;
+  char *p = pLine;
+  Entry e;
+  int i, k;
+
+  // splits the line in tokens
+
+  while( *p )
+  {
+    while( *p == ' ' || *p == '\t' || *p == ',' ) *p++ = 0;
+    if( *p == 0 ) break;
+    if( nTokens == CMD_ARGS_MAX + 2 ) break;
+    token[nTokens++] = p;
+    while( *p && *p != ' ' && *p != '\t' && *p != ',' ) p++;
+  }
+
+  if( nTokens == 0 ) return(0);                         // empty line
+
+  Serial.println("");
+
+  if( nTokens > CMD_ARGS_MAX + 1 )
+  {
+    error(PSTR("too many arguments"));
+    return(-1);
+  }
+
+  // looks for the command in the registry
+
+  for( i = 0; i < nEntries; i++ )
+  {
+    memcpy_P(&e, &table[i], sizeof(Entry));
+    if( strcasecmp(token[0], e.name) == 0 ) break;
+  }
+  if( i == nEntries )
+  {
+    error(PSTR("unknown command, enter ? for help"));
+    return(-2);
+  }
+
+  // checks and parses the arguments
+
+  name = token[0];
+  nArgs = nTokens - 1;
+  int maxArgs = strlen(e.args);
+
+  if( nArgs > maxArgs )
+  {
+    error(PSTR("too many arguments"));
+    return(-1);
+  }
+
+  for( k = 0; k < maxArgs; k++ )
+  {
+    char type = e.args[k];
+
+    if( k >= nArgs )
+    {
+      if( isupper(type) )
+      {
+        snprintf_P(buffer, 99, PSTR("ERR missing argument %d, usage: %s %s"), k+1, e.name, e.usage);
+        Serial.println(buffer);
+        return(-3);
+      }
+      break;
+    }
+
+    str[k] = token[k+1];
+    num[k] = 0L;
+    bool ok = true;
+    switch( tolower(type) )
+    {
+      case 'i': ok = parseInt(str[k], &num[k]); break;
+      case 'f': ok = parseFix(str[k], &num[k]); break;
+      default:  break;
+    }
+    if( !ok )
+    {
+      snprintf_P(buffer, 99, PSTR("ERR argument %d (%s) must be %S"), k+1, str[k], ( tolower(type) == 'i' ) ? PSTR("an integer") : PSTR("a number"));
+      Serial.println(buffer);
+      return(-4);
+    }
+  }
+
+  e.handler(this);
+  return(0);
+}
+
+bool Command::parseInt(const char *s, long *pValue)
+{
+  long v = 0L;
+  bool neg = false;
+
+  if( *s == '-' || *s == '+' ) neg = ( *s++ == '-' );
+  if( !isdigit(*s) ) return(false);
+
+  while( isdigit(*s) )
+  {
+    int d = *s++ - '0';
+    if( v > ( 2147483647L - d ) / 10L ) return(false);  // overflow
+    v = 10L * v + d;
+  }
+  if( *s != 0 ) return(false);
+
+  *pValue = neg ? -v : v;
+  return(true);
+}
+
+bool Command::parseFix(const char *s, long *pValue)
+{
+  long v = 0L;
+  bool neg = false;
+  int decimals = -1;                                      // -1 while no decimal point found
+  bool digits = false;
+
+  if( *s == '-' || *s == '+' ) neg = ( *s++ == '-' );
+
+  for( ; *s; s++ )
+  {
+    if( *s == '.' && decimals < 0 )
+      decimals = 0;
+    else if( isdigit(*s) && decimals < CMD_FIX_DECIMALS )
+    {
+      if( v >= 100000000L ) return(false);                // overflow
+      v = 10L * v + ( *s - '0' );
+      digits = true;
+      if( decimals >= 0 ) decimals++;
+    }
+    else return(false);                                   // invalid character or too many decimals
+  }
+  if( !digits ) return(false);
+
+  for( decimals = max(decimals, 0); decimals < CMD_FIX_DECIMALS; decimals++ )  // scales the missing decimals
+  {
+    if( v > 214748364L ) return(false);                   // overflow once scaled
+    v *= 10L;
+  }
+
+  *pValue = neg ? -v : v;
+  return(true);
+}
+
+long Command::intArg(int k, long defaultValue)
+{
+  return( ( k < nArgs ) ? num[k] : defaultValue );
+}
+
+void Command::error(const char *text)
+{
+  Serial.print(F("ERR "));
+  Serial.println((const __FlashStringHelper *) text);
+}
+
+void Command::printHelp(void)
+{
+  Entry e;
+
+  Serial.println(F("COMMANDS (case insensitive, [ ] optional arguments)\n"));
+  for( int i = 0; i < nEntries; i++ )
+  {
+    memcpy_P(&e, &table[i], sizeof(Entry));
+    snprintf_P(buffer, 149, PSTR("%-7s %-27s %s"), e.name, e.usage, e.help);
+    Serial.println(buffer);
+  }
+  Serial.println("");
+}
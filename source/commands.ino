@@ -0,0 +1,225 @@
+// SERIAL COMMANDS: HANDLERS AND REGISTRY
+
+// simulation commands
+
+void cmdSimAnalog(Command *pCMD)    // A [iii jjj vvv rr ss ooo], omitted trailing values keep their previous value
+{
+  long shiftIg = pCMD->intArg(3, SM.ShiftIg);
+  long shiftIc = pCMD->intArg(4, SM.ShiftIc);
+
+  if( ( shiftIg < 0 ) || ( shiftIg >= CM.numSamples ) || ( shiftIc < 0 ) || ( shiftIc >= CM.numSamples ) )
+  {
+    pCMD->error(PSTR("phases must be 0 to samples per cycle - 1"));
+    return;
+  }
+
+  SM.mode = Simul::SIMUL_ANALOG;
+  SM.AmplIg = pCMD->intArg(0, SM.AmplIg);
+  SM.AmplIc = pCMD->intArg(1, SM.AmplIc);
+  SM.AmplVx = pCMD->intArg(2, SM.AmplVx);
+  SM.ShiftIg = shiftIg;
+  SM.ShiftIc = shiftIc;
+  SM.ValV0  = constrain( pCMD->intArg(5, SM.ValV0), 0L, (long) ADC_RESOLUTION_STEPS - 1 );
+
+  snprintf_P(buffer, 199, PSTR("Simulating Analog Inputs:\tAmplIg: %ld\tAmplIc: %ld\tAmplVx: %ld\tShiftIg: %d\tShiftIc: %d\tValV0: %ld\n"),
+                            SM.AmplIg, SM.AmplIc, SM.AmplVx, SM.ShiftIg, SM.ShiftIc, SM.ValV0 );
+  Serial.println(buffer);
+}
+
+void cmdSimPower(Command *pCMD)     // P [gggg cccc]
+{
+  long pg = pCMD->intArg(0, SM.Pg);
+  long pc = pCMD->intArg(1, SM.Pc);
+
+  if( ( pg < 0 ) || ( pg > 9999 ) || ( pc < 0 ) || ( pc > 9999 ) )
+  {
+    pCMD->error(PSTR("powers must be 0 to 9999 W"));
+    return;
+  }
+
+  SM.mode = Simul::SIMUL_POWER;
+  SM.Pg = pg;
+  SM.Pc = pc;
+
+  snprintf_P(buffer, 99, PSTR("Simulating Powers:\tPg: %d\tPc: %d\n"), SM.Pg, SM.Pc );
+  Serial.println(buffer);
+}
+
+void cmdNoSimul(Command *pCMD)      // X
+{
+  SM.mode = Simul::NO_SIMUL;
+  Serial.println(F("No simulation\n"));
+}
+
+void cmdNoise(Command *pCMD)        // N
+{
+  float awake[CHANNELS_MAX], asleep[CHANNELS_MAX];
+  char name[5];
+
+  if( ( SM.mode == Simul::SIMUL_ANALOG ) || ( CM.pExt != NULL ) )
+  {
+    pCMD->error(PSTR("only with the ADC of the Mega, without simulating analog inputs"));
+    return;
+  }
+  CM.noiseFloor( &SM, false, awake );
+  CM.noiseFloor( &SM, true, asleep );
+
+  Serial.print(F("Noise floor (ADC counts, inputs grounded to V0), awake / asleep:"));
+  for( int c = 0; c < CM.nChannels; c++ )
+  {
+    CM.channelName(c, name);
+    snprintf_P(buffer, 99, PSTR(" \t%s:%d.%02d/%d.%02d "), name,
+                              (int) awake[c], ( (int) ( 100.0 * awake[c] ) ) % 100, (int) asleep[c], ( (int) ( 100.0 * asleep[c] ) ) % 100);
+    Serial.print(buffer);
+    if( ( awake[c] > 0.0 ) && ( asleep[c] > 0.0 ) )
+    {
+      int gain = round( 10.0 * 20.0 * log10( awake[c] / asleep[c] ) );   // improvement in tenths of dB
+      snprintf_P(buffer, 99, PSTR("(%S%d.%d dB)"), ( gain < 0 ) ? PSTR("-") : PSTR(""), abs(gain) / 10, abs(gain) % 10);
+      Serial.print(buffer);
+    }
+    else
+      Serial.print(F("(n/a)"));             // no noise measured awake or asleep, no ratio
+  }
+  Serial.println();
+}
+
+// printing commands
+
+void cmdPrint(Command *pCMD)        // the name of the command is the print code
+{
+  SM.printCode = toupper(pCMD->name[0]);
+  LD.jsonMode = ( SM.printCode == 'J' );       // load changes and measure faults are also printed as JSON lines
+  HM.jsonMode = LD.jsonMode;
+}
+
+void cmdBreadcrumbs(Command *pCMD)  // B
+{
+  BC.print();
+}
+
+void cmdStats(Command *pCMD)        // S
+{
+  LD.printStats(&CT);
+}
+
+#if WAVEFORM_RECORDER
+void cmdRecorder(Command *pCMD)     // W [mask]
+{
+  if( pCMD->nArgs > 0 )
+  {
+    if( ( pCMD->num[0] < 0 ) || ( pCMD->num[0] > Recorder::TRIG_ALL ) )
+    {
+      pCMD->error(PSTR("mask of triggers must be 0 to 31"));
+      return;
+    }
+    WR.arm( pCMD->num[0] );
+  }
+  WR.print(&CT);
+}
+
+void cmdRecorderTrigger(Command *pCMD)  // WT
+{
+  WR.manual = true;
+}
+
+void cmdRecorderDump(Command *pCMD)     // WD
+{
+  WR.dump(&CT);
+}
+#endif
+
+void cmdHelp(Command *pCMD)
+{
+  CMD.printHelp();
+}
+
+// configuration commands
+
+void cmdConfigReply(Command *pCMD, int ret)
+{
+  switch(ret)
+  {
+    case 0:   Serial.println(F("Edited, enter CSAVE to store it")); break;
+    case -1:  pCMD->error(PSTR("unknown key or field")); break;
+    default:  pCMD->error(PSTR("load, node or value out of range")); break;
+  }
+}
+
+int cmdLoadIndex(Command *pCMD)     // load number of the first argument, out of range values are kept out of range when converted to int
+{
+  return( constrain( pCMD->num[0], -1L, (long) N_LOADS_MAX ) );
+}
+
+void cmdConfigList(Command *pCMD)   { CF.list(); }
+void cmdConfigCheck(Command *pCMD)  { CF.validate(); }
+void cmdConfigSave(Command *pCMD)   { CF.commit(); }
+void cmdConfigErase(Command *pCMD)  { CF.erase(); }
+void cmdConfigUndo(Command *pCMD)   { CF.undo(); CF.list(); }
+void cmdConfigSet(Command *pCMD)    { cmdConfigReply( pCMD, CF.set( pCMD->str[0], pCMD->num[1] ) ); }
+void cmdConfigLoad(Command *pCMD)   { cmdConfigReply( pCMD, CF.setLoad( cmdLoadIndex(pCMD), pCMD->str[1], pCMD->num[2] ) ); }
+void cmdConfigName(Command *pCMD)   { cmdConfigReply( pCMD, CF.setName( cmdLoadIndex(pCMD), pCMD->str[1] ) ); }
+void cmdConfigNode(Command *pCMD)   { cmdConfigReply( pCMD, CF.setNode( constrain( pCMD->num[0], -1L, (long) SUBCIRCUITS_MAX + 1 ), pCMD->str[1], pCMD->num[2] ) ); }
+
+// registry of commands, the help is generated from it
+
+const Command::Entry COMMANDS[] PROGMEM =
+{
+  // name     args      handler           usage                         help
+  { "?",      "",       cmdHelp,          "",                           "print this help" },
+  { "A",      "iiiiii", cmdSimAnalog,     "[iii jjj vvv rr ss ooo]",    "simulate analog inputs: amplitudes Ig Ic Vx (counts)," },
+  { "",       "",       NULL,             "",                           "phases Ig Ic (samples), reference V0 (counts)" },
+  { "P",      "ii",     cmdSimPower,      "[gggg cccc]",                "simulate generated and consumed powers (W)" },
+  { "X",      "",       cmdNoSimul,       "",                           "end simulation" },
+  { "N",      "",       cmdNoise,         "",                           "noise floor of the inputs awake and asleep (ADC" },
+  { "",       "",       NULL,             "",                           "noise reduction), with the inputs grounded to V0" },
+  { "0",      "",       cmdPrint,         "",                           "stop printing every second" },
+  { "1",      "",       cmdPrint,         "",                           "print every second: times" },
+  { "2",      "",       cmdPrint,         "",                           "print every second: samples of one cycle" },
+  { "3",      "",       cmdPrint,         "",                           "print every second: computed values" },
+  { "4",      "",       cmdPrint,         "",                           "print every second: filtered values" },
+  { "5",      "",       cmdPrint,         "",                           "print every second: RAM use" },
+  { "6",      "",       cmdPrint,         "",                           "print every second: headroom of the analog inputs," },
+  { "",       "",       NULL,             "",                           "clipped samples, crest factors, recommended nominals" },
+  { "7",      "",       cmdPrint,         "",                           "print every second: values of the last cycle and" },
+  { "",       "",       NULL,             "",                           "aggregated over the last window of cycles" },
+  { "8",      "",       cmdPrint,         "",                           "print every second: values, filtered powers and" },
+  { "",       "",       NULL,             "",                           "margin of every phase" },
+  { "9",      "",       cmdPrint,         "",                           "print every second: current, thermal stress, margin" },
+  { "",       "",       NULL,             "",                           "and time to trip of every breaker" },
+  { "J",      "",       cmdPrint,         "",                           "JSON lines: values every second, load events," },
+  { "",       "",       NULL,             "",                           "and heartbeats" },
+  { "B",      "",       cmdBreadcrumbs,   "",                           "print the cause of the last reset and the breadcrumbs" },
+  { "",       "",       NULL,             "",                           "recorded before it (stage, uptime, radio, loads)" },
+  { "S",      "",       cmdStats,         "",                           "statistics since start: switches and time On of every" },
+  { "",       "",       NULL,             "",                           "load, fairness of the classes, self-consumption" },
+#if WAVEFORM_RECORDER
+  { "W",      "i",      cmdRecorder,      "[mask]",                     "waveform recorder status, or arm it with the triggers:" },
+  { "",       "",       NULL,             "",                           "1 margin 2 sag 4 clip 8 switch 16 manual (0 idle)" },
+  { "WT",     "",       cmdRecorderTrigger, "",                         "trigger the waveform recorder" },
+  { "WD",     "",       cmdRecorderDump,  "",                           "dump the recorded waveforms in binary" },
+#endif
+  { "C",      "",       cmdConfigList,    "",                           "list the configuration (with pending edits)" },
+  { "CSET",   "SF",     cmdConfigSet,     "key value",                  "edit setting: decide decidemax refresh varrefresh" },
+  { "",       "",       NULL,             "",                           "rotate vxnom ignom" },
+  { "",       "",       NULL,             "",                           "icnom vxcal igcal iccal maxcons window nloads" },
+  { "",       "",       NULL,             "",                           "phmax1 phmax2 phmax3 metering breaker (A, 0 flat" },
+  { "",       "",       NULL,             "",                           "limits) curve (3 B, 5 C, 10 D) average (1, 4, 16)" },
+  { "CLOAD",  "ISI",    cmdConfigLoad,    "n field value",              "edit load n: power lockon lockoff out mode radio" },
+  { "",       "",       NULL,             "",                           "channel safe (state on measure fault: 0, 1, -1 hold)" },
+  { "",       "",       NULL,             "",                           "phase (1 to 3) node (sub-circuit, 0 main supply)" },
+  { "",       "",       NULL,             "",                           "onres offres (W) import (% of power before shedding)" },
+  { "",       "",       NULL,             "",                           "group (exclusive, 0 none) parent (load n, -1 none)" },
+  { "",       "",       NULL,             "",                           "class (equal priority, rotated, 0 none) settle (ms)" },
+  { "CNODE",  "ISF",    cmdConfigNode,    "n field value",              "edit sub-circuit n: limit nom (A) parent phase" },
+  { "CNAME",  "IS",     cmdConfigName,    "n name",                     "edit the name of load n" },
+  { "CCHECK", "",       cmdConfigCheck,   "",                           "validate the edited configuration" },
+  { "CSAVE",  "",       cmdConfigSave,    "",                           "validate, store in EEPROM and restart" },
+  { "CUNDO",  "",       cmdConfigUndo,    "",                           "discard the edits" },
+  { "CERASE", "",       cmdConfigErase,   "",                           "erase the stored configuration and restart" },
+};
+
+void beginCommands(void)
+{
+  CMD.begin( COMMANDS, sizeof(COMMANDS) / sizeof(Command::Entry) );
+  Serial.println(F("\nEnter ? to get help about serial commands for simulation, printing and configuration\n\n"));
+}
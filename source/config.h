@@ -0,0 +1,496 @@
+/*
+=====================================================================
+config.h
+Holds the runtime configuration (load table, timing and electrical
+settings), stores it in EEPROM protected by a version and a CRC,
+and lists, edits, validates and commits it through serial commands
+=====================================================================
+*/
+
+/*
+NOTES:
+
+At setup() the compiled defaults (constants in the main file) are set first,
+then the configuration stored in EEPROM replaces them if its magic number, version, size and CRC are right.
+Otherwise the compiled defaults are used, and a message is printed.
+
+Edits made through serial commands are applied to a working copy (edit), which must be validated and committed:
+when committed, it is written to EEPROM and the board is restarted (through the watchdog) to apply it.
+
+If the layout of the Data structure is changed, CONFIG_VERSION must be increased,
+so that an older configuration stored in EEPROM is discarded instead of being misread.
+
+The sub-circuits form a tree of nodes: node 0 is the main supply (its limits are maxcons and phmax1..3, or its breaker),
+nodes 1 to SUBCIRCUITS_MAX are the sub-circuits, each one with its parent node, which must have a lower number (so that there are no loops),
+and each load hangs from a node (0 if it is not behind any measured sub-circuit).
+*/
+
+const int N_LOADS_MAX = 6;            // Maximum number of loads to be managed (size of the load table)
+const int PHASES_MAX = 3;             // Maximum number of phases of the supply (sizes the measure channels and the phase limits)
+const int SUBCIRCUITS_MAX = 4;        // Maximum number of sub-circuits with their own current transformer (nodes of the margin tree, besides the main supply)
+const int CONFIG_NAME_MAX = 5;        // maximum length of the name of a load
+const uint16_t CONFIG_MAGIC = 0x5344; // identifies a configuration block in EEPROM ("SD")
+const uint8_t CONFIG_VERSION = 12;    // version of the layout of the configuration block, increase it when the layout changes
+const int CONFIG_EEPROM_ADDR = 0;     // EEPROM address of the configuration block
+
+class Config
+{
+  public:
+    struct LoadData                     // configuration of one load
+    {
+      char name[CONFIG_NAME_MAX+1];     // name of the load, to be displayed
+      int powerW;                       // nominal power of the load (Watts)
+      int lockOnSec;                    // time in seconds which the activated load is prevented to be switched off
+      int lockOffSec;                   // time in seconds which the deactivated load is prevented to be switched on
+      int8_t gpioOut;                   // digital output gpio of the load (-1 if none)
+      int8_t gpioMode;                  // digital input gpio of the manual/solar switch (-1 if none)
+      uint8_t radioModel;               // radio model of the remote switch, as Radio::RadioHW
+      uint8_t channel;                  // radio channel of the remote switch
+      int8_t safeState;                 // state of the load while the measures are not plausible: 0 Off, 1 On, -1 unchanged
+      uint8_t phase;                    // phase which supplies the load, 1 to PHASES_MAX
+      uint8_t node;                     // sub-circuit which supplies the load, 1 to SUBCIRCUITS_MAX, or 0 if only the main supply
+      int onReserveW;                   // excedent required above the power of the load to switch it On (Watts)
+      int offReserveW;                  // excedent below which the load is switched Off (Watts)
+      uint8_t importPct;                // percentage of the power of the load which may be imported before it is switched Off
+      uint8_t group;                    // group of mutually exclusive loads, which are never On together, or 0 if none
+      int8_t parent;                    // load which must be On for this one to be On (of higher priority), or -1 if none
+      uint8_t prioClass;                // class of loads of equal priority, which share the excedent by rotation, or 0 if none
+      int settleMs;                     // settle window after a switch to On (inrush), in milliseconds
+    };
+
+    struct NodeData                     // configuration of one sub-circuit
+    {
+      uint8_t parent;                   // sub-circuit which supplies this one, lower than its own number, or 0 if the main supply
+      uint8_t phase;                    // phase which supplies the sub-circuit, 1 to PHASES_MAX
+      float limitA;                     // maximum allowed RMS current of the sub-circuit (rating of its breaker)
+      float nomAeff;                    // nominal RMS current of its transformer, for which MAX_AMPL_V is read at the analog input
+    };
+
+    struct Defaults                     // compiled default timing and electrical settings, as the constants of the main file
+    {
+      int decidePeriod_s;               // as in Data
+      int decideMax_s;
+      int rotate_s;
+      int refreshPeriod_s;
+      int varRefreshPeriod_s;
+      float vxNomVeff;
+      float igNomAeff;
+      float icNomAeff;
+      float vxCal;
+      float igCal;
+      float icCal;
+      float maxConsumption;
+      int windowCycles;
+      float phaseMax;                   // maximum allowed power consumption of every phase
+      int meteringPerPhase;
+      float breakerA;
+      int breakerCurve;
+      int averageCycles;
+      float nodeLimitA;                 // maximum allowed RMS current of every sub-circuit
+      float nodeNomAeff;                // nominal RMS current of the transformer of every sub-circuit
+    };
+
+    struct Data                         // configuration block, as stored in EEPROM
+    {
+      uint16_t magic;                   // CONFIG_MAGIC
+      uint8_t version;                  // CONFIG_VERSION
+      uint16_t size;                    // size of the block, sizeof(Data)
+      int decidePeriod_s;               // time in seconds between successive load activation decisions, the shortest one
+      int decideMax_s;                  // longest decide period, with a volatile excedent (see loads.h)
+      int rotate_s;                     // time in seconds between successive rotations of the loads of equal priority (see loads.h)
+      int refreshPeriod_s;              // time in seconds between successive load status refreshes
+      int varRefreshPeriod_s;           // maximum random variation (+ or -) of load refresh period
+      float vxNomVeff;                  // nominal RMS voltage of the grid
+      float igNomAeff;                  // nominal RMS intensity of the solar generated power
+      float icNomAeff;                  // nominal RMS intensity of the consumed power
+      float vxCal;                      // calibration factor of the grid voltage
+      float igCal;                      // calibration factor of the solar generated power
+      float icCal;                      // calibration factor of the consumed power
+      float maxConsumption;             // maximum allowed power consumption in watts
+      uint8_t windowCycles;             // number of cycles of the aggregation window of the measures
+      float phaseMax[PHASES_MAX];       // maximum allowed power consumption of each phase in watts (breaker of the phase), with more than one phase
+      uint8_t meteringPerPhase;         // metering rule of the excedent: 0 vector sum of the phases, 1 each phase on its own
+      float breakerA;                   // rating of the main breaker of every phase in amperes, for its thermal model (0: flat limits maxcons and phmax1..3)
+      uint8_t breakerCurve;             // trip curve of the breakers, as its magnetic threshold in multiples of the rating: 3 B, 5 C, 10 D
+      uint8_t averageCycles;            // cycles averaged synchronously into a measure: 1 (none), 4 or 16
+      NodeData node[SUBCIRCUITS_MAX];   // sub-circuits, node n is node[n-1]
+      uint8_t nLoads;                   // number of loads in the table
+      LoadData load[N_LOADS_MAX];       // load table, from highest to lowest priority
+      uint16_t crc;                     // CRC16 of all the previous bytes
+    };
+
+    Config(void) {};
+    void setDefaults(const Defaults *); // sets the compiled default timing and electrical settings
+    int addDefault(const LoadData *);   // adds a load (in program memory) to the compiled default load table
+    int begin(void);                    // reads the configuration from EEPROM, keeps the defaults if not valid
+    void list(void);                    // prints the working copy of the configuration
+    int set(char *, long);              // edits a timing or electrical setting of the working copy
+    int setLoad(int, char *, long);     // edits a numeric field of a load of the working copy
+    int setName(int, char *);           // edits the name of a load of the working copy
+    int setNode(int, char *, long);     // edits a field of a sub-circuit of the working copy
+    int validate(void);                 // checks the consistency of the working copy, returns the number of errors
+    int commit(void);                   // stores the working copy in EEPROM and restarts
+    void undo(void);                    // discards the edits of the working copy
+    void erase(void);                   // invalidates the configuration in EEPROM and restarts, so that compiled defaults are used
+    uint16_t crc(Data *);               // computes the CRC of a configuration block
+    Data data;                          // configuration in use
+    Data edit;                          // working copy being edited through serial commands
+    bool fromEeprom = false;            // true if the configuration in use was read from EEPROM
+  private:
+    void restart(void);                 // restarts the board through the watchdog
+};
+
+void Config::setDefaults(const Defaults *pD)
+{
+  memset(&data, 0, sizeof(Data));
+  data.magic = CONFIG_MAGIC;
+  data.version = CONFIG_VERSION;
+  data.size = sizeof(Data);
+  data.decidePeriod_s = pD->decidePeriod_s;
+  data.decideMax_s = pD->decideMax_s;
+  data.rotate_s = pD->rotate_s;
+  data.refreshPeriod_s = pD->refreshPeriod_s;
+  data.varRefreshPeriod_s = pD->varRefreshPeriod_s;
+  data.vxNomVeff = pD->vxNomVeff;
+  data.igNomAeff = pD->igNomAeff;
+  data.icNomAeff = pD->icNomAeff;
+  data.vxCal = pD->vxCal;
+  data.igCal = pD->igCal;
+  data.icCal = pD->icCal;
+  data.maxConsumption = pD->maxConsumption;
+  data.windowCycles = pD->windowCycles;
+  for( int p = 0; p < PHASES_MAX; p++ )
+    data.phaseMax[p] = pD->phaseMax;
+  data.meteringPerPhase = pD->meteringPerPhase;
+  data.breakerA = pD->breakerA;
+  data.breakerCurve = pD->breakerCurve;
+  data.averageCycles = pD->averageCycles;
+  for( int n = 0; n < SUBCIRCUITS_MAX; n++ )      // every sub-circuit hangs from the main supply, on the first phase
+  {
+    data.node[n].parent = 0;
+    data.node[n].phase = 1;
+    data.node[n].limitA = pD->nodeLimitA;
+    data.node[n].nomAeff = pD->nodeNomAeff;
+  }
+  data.nLoads = 0;
+}
+
+int Config::addDefault(const LoadData *pL_P)
+{
+  if( data.nLoads >= N_LOADS_MAX ) return(-1);   // ERROR: no space for another load
+
+  memcpy_P(&data.load[data.nLoads], pL_P, sizeof(LoadData));
+  data.nLoads++;
+
+  return(0);
+}
+
+int Config::begin(void)
+{
+  EEPROM.get(CONFIG_EEPROM_ADDR, edit);      // the working copy is used as a temporary buffer
+
+  if( edit.magic != CONFIG_MAGIC )
+    Serial.println(F("Config: no configuration in EEPROM, using compiled defaults"));
+  else if( ( edit.version != CONFIG_VERSION ) || ( edit.size != sizeof(Data) ) )
+  {
+    snprintf_P(buffer, 99, PSTR("Config: EEPROM version %d not supported (expected %d), using compiled defaults"), edit.version, CONFIG_VERSION);
+    Serial.println(buffer);
+  }
+  else if( edit.crc != crc(&edit) )
+    Serial.println(F("Config: wrong CRC in EEPROM, using compiled defaults"));
+  else
+  {
+    data = edit;
+    fromEeprom = true;
+    Serial.println(F("Config: read from EEPROM"));
+  }
+
+  edit = data;
+  return( fromEeprom ? 0 : -1 );
+}
+
+uint16_t Config::crc(Data *pData)
+{
+  uint16_t c = 0xFFFF;
+  uint8_t *p = (uint8_t *) pData;
+
+  for( size_t i = 0; i < offsetof(Data, crc); i++ )
+    c = _crc16_update(c, p[i]);
+  return(c);
+}
+
+void Config::list(void)
+{
+  int i;
+
+  snprintf_P(buffer, 149, PSTR("CONFIGURATION (%s%s)\n  decide:%d decidemax:%d refresh:%d varrefresh:%d rotate:%d nloads:%d"),
+                            fromEeprom ? "EEPROM" : "defaults", memcmp(&edit, &data, sizeof(Data)) ? ", edited" : "",
+                            edit.decidePeriod_s, edit.decideMax_s, edit.refreshPeriod_s, edit.varRefreshPeriod_s, edit.rotate_s, edit.nLoads );
+  Serial.println(buffer);
+  Serial.print(F("  vxnom:"));   Serial.print(edit.vxNomVeff, 1);
+  Serial.print(F(" ignom:"));    Serial.print(edit.igNomAeff, 1);
+  Serial.print(F(" icnom:"));    Serial.print(edit.icNomAeff, 1);
+  Serial.print(F(" maxcons:"));  Serial.print(edit.maxConsumption, 0);
+  Serial.print(F(" window:"));   Serial.print(edit.windowCycles);
+  Serial.print(F(" average:"));  Serial.println(edit.averageCycles);
+  for( i = 0; i < PHASES_MAX; i++ )
+  {
+    snprintf_P(buffer, 29, PSTR("%sphmax%d:"), i ? " " : "  ", i + 1);
+    Serial.print(buffer);
+    Serial.print(edit.phaseMax[i], 0);
+  }
+  Serial.print(F(" metering:"));  Serial.print(edit.meteringPerPhase);
+  Serial.print(F(" breaker:"));   Serial.print(edit.breakerA, 1);
+  Serial.print(F(" curve:"));     Serial.println(edit.breakerCurve);
+  Serial.print(F("  vxcal:"));   Serial.print(edit.vxCal, 3);
+  Serial.print(F(" igcal:"));    Serial.print(edit.igCal, 3);
+  Serial.print(F(" iccal:"));    Serial.println(edit.icCal, 3);
+  for( i = 0; i < SUBCIRCUITS_MAX; i++ )
+  {
+    NodeData *pN = &edit.node[i];
+    snprintf_P(buffer, 99, PSTR("  node %d parent:%d phase:%d limit:"), i + 1, pN->parent, pN->phase);
+    Serial.print(buffer);
+    Serial.print(pN->limitA, 1);
+    Serial.print(F(" nom:"));
+    Serial.println(pN->nomAeff, 1);
+  }
+
+  for( i = 0; i < edit.nLoads; i++ )
+  {
+    LoadData *pL = &edit.load[i];
+    snprintf_P(buffer, 199, PSTR("  %d name:%s power:%d lockon:%d lockoff:%d out:%d mode:%d radio:%d channel:%d safe:%d phase:%d node:%d onres:%d offres:%d import:%d group:%d parent:%d class:%d settle:%d"),
+                              i, pL->name, pL->powerW, pL->lockOnSec, pL->lockOffSec, pL->gpioOut, pL->gpioMode, pL->radioModel, pL->channel, pL->safeState, pL->phase, pL->node,
+                              pL->onReserveW, pL->offReserveW, pL->importPct, pL->group, pL->parent, pL->prioClass, pL->settleMs );
+    Serial.println(buffer);
+  }
+}
+
+int Config::set(char *key, long value)        // edits a timing or electrical setting, value in thousandths, returns -1 if the key is unknown, -2 if out of range (or not whole for an integer setting)
+{
+  float f = value / 1000.0;                     // value of a float setting
+  long n = value / 1000L;                       // value of an integer setting
+  bool whole = ( value % 1000L == 0 );          // an integer setting does not take decimals (they would be truncated)
+
+  if( ( n < -32768L ) || ( n > 32767L ) ) return(-2);
+
+  if(      !strcasecmp_P(key, PSTR("decide")) && whole )      edit.decidePeriod_s = n;
+  else if( !strcasecmp_P(key, PSTR("decidemax")) && whole )   edit.decideMax_s = n;
+  else if( !strcasecmp_P(key, PSTR("refresh")) && whole )     edit.refreshPeriod_s = n;
+  else if( !strcasecmp_P(key, PSTR("varrefresh")) && whole )  edit.varRefreshPeriod_s = n;
+  else if( !strcasecmp_P(key, PSTR("rotate")) && whole )      edit.rotate_s = n;
+  else if( !strcasecmp_P(key, PSTR("vxnom")) )       edit.vxNomVeff = f;
+  else if( !strcasecmp_P(key, PSTR("ignom")) )       edit.igNomAeff = f;
+  else if( !strcasecmp_P(key, PSTR("icnom")) )       edit.icNomAeff = f;
+  else if( !strcasecmp_P(key, PSTR("vxcal")) )       edit.vxCal = f;
+  else if( !strcasecmp_P(key, PSTR("igcal")) )       edit.igCal = f;
+  else if( !strcasecmp_P(key, PSTR("iccal")) )       edit.icCal = f;
+  else if( !strcasecmp_P(key, PSTR("maxcons")) )     edit.maxConsumption = f;
+  else if( !strncasecmp_P(key, PSTR("phmax"), 5) && ( key[5] >= '1' ) && ( key[5] < '1' + PHASES_MAX ) && !key[6] )
+    edit.phaseMax[key[5] - '1'] = f;
+  else if( !strcasecmp_P(key, PSTR("metering")) && whole )
+  {
+    if( ( n < 0 ) || ( n > 1 ) ) return(-2);
+    edit.meteringPerPhase = n;
+  }
+  else if( !strcasecmp_P(key, PSTR("breaker")) )     edit.breakerA = f;
+  else if( !strcasecmp_P(key, PSTR("curve")) && whole )
+  {
+    if( ( n != 3 ) && ( n != 5 ) && ( n != 10 ) ) return(-2);
+    edit.breakerCurve = n;
+  }
+  else if( !strcasecmp_P(key, PSTR("average")) && whole )
+  {
+    if( ( n != 1 ) && ( n != 4 ) && ( n != 16 ) ) return(-2);
+    edit.averageCycles = n;
+  }
+  else if( !strcasecmp_P(key, PSTR("window")) && whole )
+  {
+    if( ( n < 1 ) || ( n > 255 ) ) return(-2);
+    edit.windowCycles = n;
+  }
+  else if( !strcasecmp_P(key, PSTR("nloads")) && whole )
+  {
+    if( ( n < 0 ) || ( n > N_LOADS_MAX ) ) return(-2);
+    while( edit.nLoads < n )                          // new loads are initialized with no outputs, no radio, and Off as safe state
+    {
+      LoadData *pL = &edit.load[edit.nLoads];
+      memset(pL, 0, sizeof(LoadData));
+      snprintf_P(pL->name, CONFIG_NAME_MAX+1, PSTR("L%d"), edit.nLoads);
+      pL->gpioOut = -1;
+      pL->gpioMode = -1;
+      pL->radioModel = Radio::NO_RADIO;
+      pL->phase = 1;
+      pL->parent = -1;
+      edit.nLoads++;
+    }
+    edit.nLoads = n;
+  }
+  else return( whole ? -1 : -2 );
+
+  return(0);
+}
+
+int Config::setLoad(int iLoad, char *field, long value)   // edits a numeric field of a load, returns -1 if the field is unknown, -2 if the load does not exist or value out of range
+{
+  if( ( iLoad < 0 ) || ( iLoad >= edit.nLoads ) ) return(-2);
+  if( ( value < -128L ) || ( value > 32767L ) ) return(-2);
+
+  LoadData *pL = &edit.load[iLoad];
+  bool small = ( value <= 127L );                   // fits into the 8 bit fields
+  bool unsig = small && ( value >= 0L );            // fits into the unsigned 8 bit fields
+
+  if(      !strcasecmp_P(field, PSTR("power")) )              pL->powerW = value;
+  else if( !strcasecmp_P(field, PSTR("lockon")) )             pL->lockOnSec = value;
+  else if( !strcasecmp_P(field, PSTR("lockoff")) )            pL->lockOffSec = value;
+  else if( !strcasecmp_P(field, PSTR("out")) && small )       pL->gpioOut = value;
+  else if( !strcasecmp_P(field, PSTR("mode")) && small )      pL->gpioMode = value;
+  else if( !strcasecmp_P(field, PSTR("radio")) && unsig )     pL->radioModel = value;
+  else if( !strcasecmp_P(field, PSTR("channel")) && unsig )   pL->channel = value;
+  else if( !strcasecmp_P(field, PSTR("safe")) && small )      pL->safeState = value;
+  else if( !strcasecmp_P(field, PSTR("phase")) && unsig )     pL->phase = value;
+  else if( !strcasecmp_P(field, PSTR("node")) && unsig )      pL->node = value;
+  else if( !strcasecmp_P(field, PSTR("onres")) )             pL->onReserveW = value;
+  else if( !strcasecmp_P(field, PSTR("offres")) )            pL->offReserveW = value;
+  else if( !strcasecmp_P(field, PSTR("import")) && unsig )    pL->importPct = value;
+  else if( !strcasecmp_P(field, PSTR("group")) && unsig )     pL->group = value;
+  else if( !strcasecmp_P(field, PSTR("parent")) && small )    pL->parent = value;
+  else if( !strcasecmp_P(field, PSTR("class")) && unsig )     pL->prioClass = value;
+  else if( !strcasecmp_P(field, PSTR("settle")) )            pL->settleMs = value;
+  else return( unsig ? -1 : -2 );
+
+  return(0);
+}
+
+int Config::setName(int iLoad, char *name)      // edits the name of a load, returns -2 if the load does not exist
+{
+  if( ( iLoad < 0 ) || ( iLoad >= edit.nLoads ) ) return(-2);
+
+  strncpy(edit.load[iLoad].name, name, CONFIG_NAME_MAX);
+  edit.load[iLoad].name[CONFIG_NAME_MAX] = 0;
+  return(0);
+}
+
+int Config::setNode(int nNode, char *field, long value)   // edits a field of a sub-circuit, value in thousandths, returns -1 if the field is unknown, -2 if the node does not exist or value out of range
+{
+  if( ( nNode < 1 ) || ( nNode > SUBCIRCUITS_MAX ) ) return(-2);
+
+  NodeData *pN = &edit.node[nNode - 1];
+  float f = value / 1000.0;                     // value of a current
+  long n = value / 1000L;                       // value of a node or phase number
+  bool whole = ( value % 1000L == 0 );          // a node or phase number does not take decimals
+
+  if(      !strcasecmp_P(field, PSTR("limit")) )    pN->limitA = f;
+  else if( !strcasecmp_P(field, PSTR("nom")) )      pN->nomAeff = f;
+  else if( !strcasecmp_P(field, PSTR("parent")) && whole )   { if( ( n < 0 ) || ( n > 255 ) ) return(-2);  pN->parent = n; }
+  else if( !strcasecmp_P(field, PSTR("phase")) && whole )    { if( ( n < 0 ) || ( n > 255 ) ) return(-2);  pN->phase = n; }
+  else return( whole ? -1 : -2 );
+
+  return(0);
+}
+
+int Config::validate(void)      // prints every inconsistency found in the working copy
+{
+  int i, j;
+  int errors = 0;
+
+  #define CONFIG_CHECK(cond, text, n) if( !(cond) ) { snprintf_P(buffer, 99, PSTR("  ERROR: " text), n); Serial.println(buffer); errors++; }
+
+  CONFIG_CHECK( edit.decidePeriod_s >= 1,                               "decide period must be >= 1 s", -1 );
+  CONFIG_CHECK( edit.decideMax_s >= edit.decidePeriod_s,                "decidemax must be >= decide", -1 );
+  CONFIG_CHECK( edit.rotate_s >= edit.decideMax_s,                      "rotate period must be >= decidemax", -1 );
+  CONFIG_CHECK( edit.refreshPeriod_s > edit.varRefreshPeriod_s,         "refresh period must be > its variation", -1 );
+  CONFIG_CHECK( edit.varRefreshPeriod_s >= 0,                           "refresh variation must be >= 0", -1 );
+  CONFIG_CHECK( ( edit.vxNomVeff > 0.0 ) && ( edit.vxNomVeff < 1000.0 ), "vxnom out of range", -1 );
+  CONFIG_CHECK( ( edit.igNomAeff > 0.0 ) && ( edit.igNomAeff < 100.0 ),  "ignom out of range", -1 );
+  CONFIG_CHECK( ( edit.icNomAeff > 0.0 ) && ( edit.icNomAeff < 100.0 ),  "icnom out of range", -1 );
+  CONFIG_CHECK( ( edit.vxCal > 0.5 ) && ( edit.vxCal < 1.5 ),           "vxcal out of range 0.5 to 1.5", -1 );
+  CONFIG_CHECK( ( edit.igCal > 0.5 ) && ( edit.igCal < 1.5 ),           "igcal out of range 0.5 to 1.5", -1 );
+  CONFIG_CHECK( ( edit.icCal > 0.5 ) && ( edit.icCal < 1.5 ),           "iccal out of range 0.5 to 1.5", -1 );
+  CONFIG_CHECK( ( edit.maxConsumption > 0.0 ) && ( edit.maxConsumption < 9999.0 ), "maxcons out of range", -1 );
+  CONFIG_CHECK( ( edit.windowCycles >= 1 ) && ( edit.windowCycles <= 50 ), "window out of range 1 to 50 cycles", -1 );
+  for( i = 0; i < PHASES_MAX; i++ )
+    CONFIG_CHECK( ( edit.phaseMax[i] > 0.0 ) && ( edit.phaseMax[i] < 9999.0 ), "phmax%d out of range", i + 1 );
+  CONFIG_CHECK( ( edit.averageCycles == 1 ) || ( edit.averageCycles == 4 ) || ( edit.averageCycles == 16 ), "average must be 1, 4 or 16 cycles", -1 );
+  CONFIG_CHECK( ( edit.breakerA >= 0.0 ) && ( edit.breakerA < 100.0 ),  "breaker out of range (0 if not modelled)", -1 );
+  CONFIG_CHECK( ( edit.breakerCurve == 3 ) || ( edit.breakerCurve == 5 ) || ( edit.breakerCurve == 10 ), "curve must be 3 (B), 5 (C) or 10 (D)", -1 );
+  for( i = 0; i < SUBCIRCUITS_MAX; i++ )
+  {
+    NodeData *pN = &edit.node[i];
+    CONFIG_CHECK( pN->parent <= i,                                      "node %d parent must be a lower node, or 0", i + 1 );
+    CONFIG_CHECK( ( pN->phase >= 1 ) && ( pN->phase <= PHASES_MAX ),    "node %d phase out of range", i + 1 );
+    CONFIG_CHECK( ( pN->parent == 0 ) || ( pN->parent > i ) || ( pN->phase == edit.node[pN->parent - 1].phase ), "node %d phase differs from its parent", i + 1 );
+    CONFIG_CHECK( ( pN->limitA > 0.0 ) && ( pN->limitA < 100.0 ),       "node %d limit out of range", i + 1 );
+    CONFIG_CHECK( ( pN->nomAeff > 0.0 ) && ( pN->nomAeff < 100.0 ),     "node %d nom out of range", i + 1 );
+  }
+
+  for( i = 0; i < edit.nLoads; i++ )
+  {
+    LoadData *pL = &edit.load[i];
+    CONFIG_CHECK( strlen(pL->name) > 0,                                 "load %d has no name", i );
+    CONFIG_CHECK( ( pL->powerW > 0 ) && ( pL->powerW < 9999 ),          "load %d power out of range", i );
+    CONFIG_CHECK( ( pL->lockOnSec >= 0 ) && ( pL->lockOffSec >= 0 ),    "load %d lock times must be >= 0", i );
+    CONFIG_CHECK( ( pL->gpioOut == -1 ) || ( ( pL->gpioOut >= 2 ) && ( pL->gpioOut <= A15 ) ),   "load %d out gpio out of range", i );
+    CONFIG_CHECK( ( pL->gpioMode == -1 ) || ( ( pL->gpioMode >= 2 ) && ( pL->gpioMode <= A15 ) ), "load %d mode gpio out of range", i );
+    CONFIG_CHECK( pL->radioModel <= Radio::RADIO_GMOMXEN,                "load %d unknown radio model", i );
+    CONFIG_CHECK( ( pL->radioModel == Radio::NO_RADIO ) || ( ( pL->channel >= 1 ) && ( pL->channel <= Radio::N_CHANNELS ) ), "load %d radio channel out of range", i );
+    CONFIG_CHECK( ( pL->safeState >= -1 ) && ( pL->safeState <= 1 ),  "load %d safe state must be 0 Off, 1 On or -1 unchanged", i );
+    CONFIG_CHECK( ( pL->phase >= 1 ) && ( pL->phase <= PHASES_MAX ),    "load %d phase out of range", i );
+    CONFIG_CHECK( pL->node <= SUBCIRCUITS_MAX,                          "load %d node out of range", i );
+    CONFIG_CHECK( ( pL->onReserveW >= 0 ) && ( pL->onReserveW < 9999 ) && ( pL->offReserveW >= 0 ) && ( pL->offReserveW <= pL->powerW + pL->onReserveW ),
+                                                                        "load %d reserves out of range (offres <= power + onres)", i );
+    CONFIG_CHECK( pL->importPct <= 100,                                 "load %d import out of range 0 to 100 %%", i );
+    CONFIG_CHECK( ( pL->node == 0 ) || ( pL->node > SUBCIRCUITS_MAX ) || ( pL->phase == edit.node[pL->node - 1].phase ), "load %d phase differs from its node", i );
+    CONFIG_CHECK( pL->group <= N_LOADS_MAX,                             "load %d group out of range", i );
+    CONFIG_CHECK( pL->prioClass <= N_LOADS_MAX,                         "load %d class out of range", i );
+    CONFIG_CHECK( ( pL->settleMs >= 0 ) && ( pL->settleMs <= 10000 ),   "load %d settle out of range 0 to 10000 ms", i );
+    CONFIG_CHECK( ( pL->parent >= -1 ) && ( pL->parent < i ),           "load %d parent must be a load of higher priority, or -1", i );
+    CONFIG_CHECK( ( pL->parent < 0 ) || ( pL->parent >= i ) || ( pL->safeState != 1 ) || ( edit.load[pL->parent].safeState == 1 ), "load %d safe state On needs its parent On", i );
+    CONFIG_CHECK( ( pL->parent < 0 ) || ( pL->parent >= i ) || ( pL->group == 0 ) || ( pL->group != edit.load[pL->parent].group ), "load %d in the group of its parent", i );
+    for( j = 0; j < i; j++ )
+      CONFIG_CHECK( ( pL->gpioOut == -1 ) || ( pL->gpioOut != edit.load[j].gpioOut ),             "load %d out gpio already used", i );
+  }
+
+  #undef CONFIG_CHECK
+
+  if( errors == 0 ) Serial.println(F("  configuration OK"));
+  return(errors);
+}
+
+int Config::commit(void)
+{
+  if( validate() != 0 )
+  {
+    Serial.println(F("Config: not stored, correct the errors first"));
+    return(-1);
+  }
+
+  edit.magic = CONFIG_MAGIC;
+  edit.version = CONFIG_VERSION;
+  edit.size = sizeof(Data);
+  edit.crc = crc(&edit);
+  EEPROM.put(CONFIG_EEPROM_ADDR, edit);         // only the changed bytes are written
+
+  Serial.println(F("Config: stored in EEPROM, restarting to apply it"));
+  restart();
+  return(0);
+}
+
+void Config::undo(void)
+{
+  edit = data;
+}
+
+void Config::erase(void)
+{
+  EEPROM.put(CONFIG_EEPROM_ADDR, (uint16_t) 0xFFFF);   // invalidates the magic number
+
+  Serial.println(F("Config: erased from EEPROM, restarting with compiled defaults"));
+  restart();
+}
+
+void Config::restart(void)
+{
+  Serial.flush();
+  wdt_enable(WDTO_15MS);      // the watchdog resets the board
+  while(1);
+}
@@ -11,15 +11,17 @@ class CountTime
 {
   public:
     CountTime(void) {};               // contructor
-    void begin( int, int, int, int);  // inicializes counters and starts counting time
-    void update();                    // must be called once every loop() cycle
+    void begin( int, int, int, int, int);  // inicializes counters and starts counting time
+    void update(unsigned long);       // must be called once every loop() cycle, with the time missed by micros() and millis() since the previous call (CPU asleep, see measure.h)
     unsigned long lastTime = 0UL;     // holds the absolute time when the previous second elapsed
     int hours = 0;                  
     int minutes = 0;
     int seconds = 0;                  // hours:minutes:seconds is the absolute time elapsed from start
     char hhmmss[15];                  // string with hours, minutes and seconds
     bool flagOneSec = false;          // flag indicating that one second have elapsed
-    int decidePeriod_s = 5;           // period in seconds between launches of flagDecide
+    int decidePeriod_s = 5;           // period in seconds between launches of flagDecide, adapted between decideMin_s and decideMax_s (see loads.h)
+    int decideMin_s = 5;              // shortest decide period
+    int decideMax_s = 5;              // longest decide period
     int countDecide_s = 5;            // seconds lasting to next flagDecide
     bool flagDecide = false;          // flag indicating that one decide period has elapsed
     int refreshPeriod_s = 30;         // mean period in seconds between launches of flagRefresh
@@ -28,13 +30,17 @@ class CountTime
     bool flagRefresh = false;         // flag indicating that one refresh period has elapsed
     unsigned long prevLoopStart_us = 0UL;   // when the previous loop started
     unsigned long loopTime_us = 0UL;        // duration of the previus loop
+    unsigned long sleptMs = 0UL;            // time missed by millis() since start, whole milliseconds
+    unsigned int sleptRemUs = 0;            // and the remaining microseconds
 };
 
 
-void CountTime::begin( int setDecidePeriod_s, int setRefreshPeriod_s, int setVarRefreshPeriod_s, int seedAnalogIn )
+void CountTime::begin( int setDecidePeriod_s, int setDecideMax_s, int setRefreshPeriod_s, int setVarRefreshPeriod_s, int seedAnalogIn )
 {
 
   decidePeriod_s = setDecidePeriod_s;           // stores the arguments
+  decideMin_s = setDecidePeriod_s;
+  decideMax_s = setDecideMax_s;
   refreshPeriod_s = setRefreshPeriod_s;
   varRefreshPeriod_s = setVarRefreshPeriod_s;  
 
@@ -53,20 +59,25 @@ void CountTime::begin( int setDecidePeriod_s, int setRefreshPeriod_s, int setVar
 // If one second has elapsed since the previous call to update()
 // updates all the time counters
 // and launches flags when the corresponding count periods have elapsed
+// While the ADC conversions are done asleep, Timer0 is stopped: the time missed is added to millis() and micros()
                  
-void CountTime::update(void)
+void CountTime::update(unsigned long sleptUs)
 {
   unsigned long now_us;
   flagOneSec =  false;  // the flags remain true for only one loop() cycle
   flagDecide =  false;
   flagRefresh = false;
 
-  now_us = micros();
+  sleptUs += sleptRemUs;
+  sleptMs += sleptUs / 1000UL;
+  sleptRemUs = sleptUs % 1000UL;
+
+  now_us = micros() + sleptMs * 1000UL + sleptRemUs;
   loopTime_us = now_us - prevLoopStart_us;
   prevLoopStart_us = now_us;
 
     
-  if(millis() - lastTime < 1000UL) return;  // waits for the next second
+  if(millis() + sleptMs - lastTime < 1000UL) return;  // waits for the next second
   
   lastTime += 1000UL;         // one second elapsed                
   flagOneSec  = true;            
@@ -11,22 +11,22 @@ class Credits
 {
   public:
     Credits(void) {};
-    void begin(char *, char *, char *);
-    void getFileName(char *);
-    void getDateTime(char *, char *);
+    void begin(const char *, const char *, const char *);
+    void getFileName(const char *);
+    void getDateTime(const char *, const char *);
     void print(void);
-    char *fileName = "NO NAME";
+    const char *fileName = "NO NAME";
     char fileDateTime[MAX_DATE_TIME_LENGTH+1];
 };
 
-void Credits::begin(char *filePath_arg, char *fileDate_arg, char *fileTime_arg)   // gets and formats the file name and date-time of compilation
+void Credits::begin(const char *filePath_arg, const char *fileDate_arg, const char *fileTime_arg)   // gets and formats the file name and date-time of compilation
 {
   getFileName(filePath_arg);
   getDateTime(fileDate_arg, fileTime_arg);
   print();
 }
 
-void Credits::getFileName(char *filePath_arg)
+void Credits::getFileName(const char *filePath_arg)
 {
   int i;
   int n;
@@ -43,7 +43,7 @@ void Credits::getFileName(char *filePath_arg)
   //Serial.println(fileName);
 }
 
-void Credits::getDateTime(char *fileDate_arg, char *fileTime_arg)
+void Credits::getDateTime(const char *fileDate_arg, const char *fileTime_arg)
 {
 
   int month, day, year;
@@ -19,8 +19,12 @@ so that it takes 4 loop cycles to write one screen
 
 There are three screens:
 - the electric magnitudes and the total time spent from start of the program
-- the powers balance, the status of the loads, and the time to next decision
-- the program credits (source file name and date/hour of compilation) 
+- the powers balance, the status of the loads (S solar, M manual, R remotely overridden), and the time to next decision
+On both screens, the bottom line shows the measure fault instead, while it is tripped (see health.h)
+- the program credits (source file name and date/hour of compilation), and the cause of the last reset 
+
+In the night profile (see lowpower.h) the backlight is off and the screen is refreshed only every DISPLAY_DIMMED_S seconds;
+pressing the button restores the full profile.
 */
 
 
@@ -29,6 +33,7 @@ const int DISPLAY_I2C_ADDRESS = 0x27;   // I2C address of the display
 const int DISPLAY_COLS = 20;            // number of columns
 const int DISPLAY_ROWS = 4;             // number of rows
 const int DISPLAY_SCREENS = 3;          // number of screens to display
+const int DISPLAY_DIMMED_S = 10;        // seconds between refreshes while dimmed
 
 
 class Display
@@ -36,7 +41,8 @@ class Display
   public:
     Display(void) {};                                                     // constructor
     void begin(int);                                                      // inicialization
-    void show(Credits *, CountTime *, Values *, Simul *, Loads *);        // refreshing the display
+    void show(Credits *, CountTime *, Values *, Simul *, Loads *, Breadcrumbs *, Health *);   // refreshing the display
+    void dim(bool);                                                       // switches the backlight off and slows down the refresh, or restores them
     LiquidCrystal_I2C lcd = LiquidCrystal_I2C(DISPLAY_I2C_ADDRESS, DISPLAY_COLS, DISPLAY_ROWS);    // display lcd object
     int buttonGpio;                                                       // input gpio where the button to change screen is connected
     int button;                                                           // status of the button (LOW = pressed)
@@ -44,6 +50,8 @@ class Display
     int line = -1;                                                        // next display line to be refreshed, -1 if waiting the 1 second period
     int screen = 1;                                                       // which screen must be displayed
     unsigned long displayTimeUs;                                          // time spent while executing the show function, it lasts 32 ms approx
+    bool dimmed = false;                                                  // true while the backlight is off and the refresh slowed down
+    bool woken = false;                                                   // true if the button has been pressed while dimmed
 };
 
 void Display::begin( int buttonGpio_arg )
@@ -56,7 +64,14 @@ void Display::begin( int buttonGpio_arg )
   pinMode(buttonGpio, INPUT_PULLUP);          // inicialize button input
 }
 
-void Display::show( Credits *pCR, CountTime *pCT, Values *pCV, Simul *pSM, Loads *pLD )  // show the measures on the display, one line at a time, and manages the change screen button
+void Display::dim( bool dimmed_arg )
+{
+  dimmed = dimmed_arg;
+  if( dimmed ) lcd.noBacklight();
+  else         lcd.backlight();
+}
+
+void Display::show( Credits *pCR, CountTime *pCT, Values *pCV, Simul *pSM, Loads *pLD, Breadcrumbs *pBC, Health *pHM )  // show the measures on the display, one line at a time, and manages the change screen button
 {
   unsigned long startUs;                       // measures the time spent in the function, it lasts 32 ms approx
   int i;
@@ -68,12 +83,14 @@ void Display::show( Credits *pCR, CountTime *pCT, Values *pCV, Simul *pSM, Loads
   { 
     screen = (screen+1) % DISPLAY_SCREENS;      
     line = 0;  
+    if( dimmed ) woken = true;
   }
   prevButton = button;
   
   if(line==-1)                                  // only if the screen have been fully refreshed (no line pending)
   {
     if( !pCT->flagOneSec)   return;             // only after 1 second elapsed
+    if( dimmed && ( pCT->seconds % DISPLAY_DIMMED_S != 0 ) )   return;   // or after DISPLAY_DIMMED_S seconds while dimmed
     line = 0;
   }
   
@@ -99,7 +116,10 @@ void Display::show( Credits *pCR, CountTime *pCT, Values *pCV, Simul *pSM, Loads
           line++;
           break;
         case 3:
-          snprintf_P(buffer,21,PSTR("  %s     %s     "), pCT->hhmmss, ( pSM->mode == Simul::NO_SIMUL ) ? "    " : ( ( pSM->mode == Simul::SIMUL_ANALOG ) ? "SimA" : "SimP" ) );
+          if( pHM->faulty )
+            snprintf_P(buffer,21,PSTR("FLT %-16s"), pHM->text);
+          else
+            snprintf_P(buffer,21,PSTR("  %s     %s     "), pCT->hhmmss, ( pSM->mode == Simul::NO_SIMUL ) ? "    " : ( ( pSM->mode == Simul::SIMUL_ANALOG ) ? "SimA" : "SimP" ) );
           lcd.setCursor(0, 3); lcd.print(buffer);
           line = -1;  //
           break;
@@ -119,20 +139,23 @@ void Display::show( Credits *pCR, CountTime *pCT, Values *pCV, Simul *pSM, Loads
           line++;
           break;
         case 1:
-          snprintf_P(buffer,21,PSTR("%s %dW %s %s%3ds                     "), pLD->name[0], (int) round(pLD->powerW[0]), ( pLD->on[0]?"On ":"Off" ), ( pLD->solarMode[0]?"S":"M" ), pLD->lockSec[0] );
+          snprintf_P(buffer,21,PSTR("%s %dW %s %s%3ds                     "), pLD->name[0], (int) round(pLD->powerW[0]), ( pLD->on[0]?"On ":"Off" ), ( pLD->forced[0] ? "R" : ( pLD->solarMode[0]?"S":"M" ) ), pLD->lockSec[0] );
           lcd.setCursor(0, 1); lcd.print(buffer);
           line++;
           break;
         case 2:
           if(pLD->nLoads>1)
-            snprintf_P(buffer,21,PSTR("%s %dW %s %s%3ds                     "), pLD->name[1], (int) round(pLD->powerW[1]), ( pLD->on[1]?"On ":"Off" ), ( pLD->solarMode[1]?"S":"M" ), pLD->lockSec[1] );
+            snprintf_P(buffer,21,PSTR("%s %dW %s %s%3ds                     "), pLD->name[1], (int) round(pLD->powerW[1]), ( pLD->on[1]?"On ":"Off" ), ( pLD->forced[1] ? "R" : ( pLD->solarMode[1]?"S":"M" ) ), pLD->lockSec[1] );
           else
             snprintf_P(buffer,21,PSTR("                                 "));
           lcd.setCursor(0, 2); lcd.print(buffer);
           line++;
           break;
         case 3:
-          snprintf_P(buffer,21,PSTR("%2ds marg:%4dW %s     "), pCT->countDecide_s, (int) round(pCV->Margin), ( pSM->mode == Simul::NO_SIMUL ) ? "    " : ( ( pSM->mode == Simul::SIMUL_ANALOG ) ? "SimA" : "SimP" ) );
+          if( pHM->faulty )
+            snprintf_P(buffer,21,PSTR("FLT %-16s"), pHM->text);
+          else
+            snprintf_P(buffer,21,PSTR("%2d/%2ds m:%4dW %s     "), pCT->countDecide_s, pCT->decidePeriod_s, (int) round(pCV->Margin), ( pSM->mode == Simul::NO_SIMUL ) ? "    " : ( ( pSM->mode == Simul::SIMUL_ANALOG ) ? "SimA" : "SimP" ) );
           lcd.setCursor(0, 3); lcd.print(buffer);
           line = -1;  //
           break;
@@ -160,7 +183,7 @@ void Display::show( Credits *pCR, CountTime *pCT, Values *pCV, Simul *pSM, Loads
           line++;
           break;
         case 2:
-          snprintf_P(buffer, 21, PSTR("                       "));
+          snprintf_P(buffer, 21, PSTR("%-20s"), pBC->lcdText);
           lcd.setCursor(0, 2); lcd.print(buffer);
           line++;
           break;
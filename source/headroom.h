@@ -0,0 +1,143 @@
+/*
+====================================================================
+headroom.h
+Tracks how close the voltage and currents come to the ends of the
+ADC range (headroom), counts the clipped samples, computes the crest
+factor, and recommends the nominal values which fit the measured peaks
+====================================================================
+*/
+
+/*
+NOTES:
+
+The analog inputs are centred on V0 (2.5V of 5V), so that the swing available to every channel is
+the distance from V0 to the nearest end of the ADC range (about 511 counts, or 1023 / 2047 with the extra bits of oversampling, see measure.h).
+The conditioning circuits are designed so that the nominal RMS value (VX_NOM_VEFF, IG_NOM_AEFF, IC_NOM_AEFF)
+gives an amplitude of MAX_AMPL_V (2V), which leaves a headroom of 20% for the peaks.
+
+Every grid cycle, for each channel:
+- peak: the largest distance of a sample to V0, in counts
+- clipped: number of samples at 0 or at the top of the ADC range, they under-read the RMS values and the powers
+- crest factor: peak divided by RMS (1.41 for a sine wave, higher for the distorted currents of electronic loads)
+The largest peak and the total of clipped samples are kept since start.
+
+A warning is printed when the largest peak exceeds HEADROOM_WARN_FRACTION of the swing, or when a sample is clipped.
+
+The recommended nominal value is the one whose amplitude MAX_AMPL_V would be reached by the largest peak,
+so that the designed headroom of 20% is kept above it:
+  recommended = nominal * ( largest peak volts / MAX_AMPL_V )
+If samples have been clipped, the true peak is unknown, so that at least HEADROOM_CLIP_STEP times the nominal value is recommended.
+The conditioning resistors are then resized for the recommended value, and it is entered into the configuration (vxnom, ignom, icnom, or nom of a node).
+
+With several phases or sub-circuits, every voltage and current channel of the table of measure.h is tracked.
+
+The statistics are not updated while simulating powers, since then the analog inputs are not used.
+*/
+
+const float HEADROOM_WARN_FRACTION = 0.9;   // a warning is printed when the largest peak exceeds this fraction of the swing
+const float HEADROOM_CLIP_STEP = 1.5;       // minimum ratio of the recommended nominal value to the current one, when samples have been clipped
+const int HEADROOM_CHANNELS = CHANNELS_MAX - 1;   // channels checked: Vx, Ig, Ic of every phase (all the channels but V0)
+
+class Headroom
+{
+  public:
+    Headroom(void) {};
+    void begin(Measure *, float, float, float, const float *);   // channels, nominal RMS voltage and currents, and those of the sub-circuits
+    void update(CountTime *, Simul *, Measure *, Values *);   // computes the statistics of the last cycle
+    void print(CountTime *, Measure *, Values *);             // prints the statistics and the recommended nominal values
+    float recommended(int, Values *);                         // recommended nominal value of a channel
+    int swing = 0;                                            // counts available from V0 to the nearest end of the ADC range, last cycle
+    int peak[HEADROOM_CHANNELS];                              // largest distance of a sample to V0, last cycle (counts)
+    int clipped[HEADROOM_CHANNELS];                           // samples at the ends of the ADC range, last cycle
+    float crest[HEADROOM_CHANNELS];                           // crest factor, last cycle
+    int peakMax[HEADROOM_CHANNELS];                           // largest peak since start (counts)
+    unsigned long clippedTotal[HEADROOM_CHANNELS];            // clipped samples since start
+    bool warning[HEADROOM_CHANNELS];                          // true if the headroom of the channel is too small
+  private:
+    float nominal[HEADROOM_CHANNELS];                         // nominal RMS values
+    int nChecked = 0;                                         // number of channels checked
+};
+
+void Headroom::begin(Measure *pCM, float vxNom, float igNom, float icNom, const float *isNom)
+{
+  nChecked = pCM->nChannels - 1;
+  for( int c = 0; c < nChecked; c++ )         // statistic c is that of channel c+1 of the table of measure.h
+  {
+    uint8_t type = pCM->chanType[c + 1];
+    nominal[c] = ( type == Measure::CH_VX ) ? vxNom : ( ( type == Measure::CH_IG ) ? igNom : ( ( type == Measure::CH_IC ) ? icNom : isNom[ pCM->chanPhase[c + 1] ] ) );
+    peak[c] = 0;
+    clipped[c] = 0;
+    crest[c] = 0.0;
+    peakMax[c] = 0;
+    clippedTotal[c] = 0UL;
+    warning[c] = false;
+  }
+}
+
+void Headroom::update(CountTime *pCT, Simul *pSM, Measure *pCM, Values *pCV)
+{
+  int top = pCM->saturation;
+  int offset = (int) pCV->V0Avg;
+  int c, i;
+  long sum;
+
+  if( pSM->mode == Simul::SIMUL_POWER ) return;
+
+  swing = min( offset, top - offset );
+
+  for( c = 0; c < nChecked; c++ )
+  {
+    int *samples = pCM->samples[c + 1];
+    peak[c] = 0;
+    clipped[c] = 0;
+    sum = 0L;
+    for( i = 0; i < pCM->numSamples; i++ )
+    {
+      int v = samples[i];
+      int d = abs( v - offset );
+      if( ( v <= 0 ) || ( v >= top ) ) clipped[c]++;
+      peak[c] = max( peak[c], d );
+      sum += (long) d * d;
+    }
+    crest[c] = peak[c] / max( 1.0, sqrt( ( (float) sum ) / pCM->numSamples ) );
+    peakMax[c] = max( peakMax[c], peak[c] );
+    clippedTotal[c] += clipped[c];
+
+    if( !warning[c] && ( ( clipped[c] > 0 ) || ( peak[c] > HEADROOM_WARN_FRACTION * swing ) ) )
+    {
+      char name[4];
+      pCM->channelName(c + 1, name);
+      warning[c] = true;                        // printed only once, the statistics tell how it evolves
+      snprintf_P(buffer, 149, PSTR("%s WARNING: %s headroom too small, peak %d of %d counts, %d samples clipped (print code 6 for details)\n"),
+                                pCT->hhmmss, name, peak[c], swing, clipped[c] );
+      Serial.print(buffer);
+    }
+  }
+}
+
+float Headroom::recommended(int c, Values *pCV)
+{
+  float rec = nominal[c] * ( peakMax[c] * pCV->VoltsPerCount / pCV->MaxAmplV );
+
+  if( clippedTotal[c] > 0UL ) rec = max( rec, nominal[c] * HEADROOM_CLIP_STEP );
+  return( rec );
+}
+
+void Headroom::print(CountTime *pCT, Measure *pCM, Values *pCV)
+{
+  char name[4];
+
+  Serial.print(pCT->hhmmss);
+  for( int c = 0; c < nChecked; c++ )
+  {
+    pCM->channelName(c + 1, name);
+    int crest100 = round( 100.0 * crest[c] );
+    snprintf_P(buffer, 199, PSTR(" \t%s%s peak:%d/%d clipped:%d crest:%d.%02d max_peak:%d (%d%%) clipped_total:%lu rec_nom:"),
+                              name, warning[c] ? "(!)" : "", peak[c], swing, clipped[c],
+                              crest100 / 100, crest100 % 100,
+                              peakMax[c], (int) round( 100.0 * peakMax[c] / max( 1, swing ) ), clippedTotal[c] );
+    Serial.print(buffer);
+    Serial.print( recommended(c, pCV), 1 );
+  }
+  Serial.println();
+}
@@ -0,0 +1,192 @@
+/*
+=====================================================================
+health.h
+Checks every grid cycle that the sampled and computed measures are
+plausible, so that the loads are not managed with wrong measures
+(disconnected transformer, failed reference, broken analog input)
+=====================================================================
+*/
+
+/*
+NOTES:
+
+The checks, in order of priority (only the first fault found in a cycle is kept):
+- V0 out of band: the average of the reference V0 must be near the half of the ADC range (2.5V of 5V),
+  otherwise the volts per count ratio, and so all the measures, are wrong
+- ADC saturation: more than HEALTH_SATURATED_MAX samples of a channel at 0 or at the top of the ADC range
+- stuck channel: the grid voltage Vx has almost no AC amplitude (the grid voltage is always present while the board is powered),
+  or the average of a current input Ig, Ic is far from V0 (both share the floating ground V0, so a broken conditioning circuit shows an offset)
+- RMS out of range: the grid voltage outside HEALTH_VX_MIN_RATIO to HEALTH_VX_MAX_RATIO of its nominal value,
+  or a current above HEALTH_I_MAX_RATIO of its nominal value
+
+A fault trips after HEALTH_TRIP_CYCLES consecutive faulty cycles, and clears after HEALTH_CLEAR_S seconds of consecutive good cycles
+(counted on the seconds of the clock, whatever the cycles measured per second: averaging, night profile),
+so that a single spike does not trip it and the loads do not oscillate between the safe state and the automatic decisions.
+While tripped, every load is set to its safe state (see the load configuration) and no decision is taken on the measures.
+
+With several phases or sub-circuits, every channel of the table of measure.h is checked, and the RMS ranges of every phase and sub-circuit.
+
+The checks are not performed while simulating powers, since then the analog inputs are not used.
+*/
+
+const float HEALTH_V0_MIN_FRACTION = 0.4;   // minimum average of V0, as a fraction of the ADC range (2.0V of 5V)
+const float HEALTH_V0_MAX_FRACTION = 0.6;   // maximum average of V0, as a fraction of the ADC range (3.0V of 5V)
+const int HEALTH_SATURATED_MAX = 2;         // maximum number of samples of a channel at the ends of the ADC range in one cycle
+const int HEALTH_VX_STUCK_COUNTS = 20;      // minimum peak to peak counts of Vx (about 800 counts at the nominal voltage), without the extra bits of oversampling
+const int HEALTH_OFFSET_MAX_COUNTS = 50;    // maximum difference between the averages of a current input and of V0, without the extra bits of oversampling
+const float HEALTH_VX_MIN_RATIO = 0.7;      // minimum grid RMS voltage, as a ratio of its nominal value
+const float HEALTH_VX_MAX_RATIO = 1.2;      // maximum grid RMS voltage, as a ratio of its nominal value
+const float HEALTH_I_MAX_RATIO = 1.3;       // maximum RMS currents, as a ratio of their nominal values
+const int HEALTH_TRIP_CYCLES = 10;          // consecutive faulty cycles to trip a fault
+const int HEALTH_CLEAR_S = 6;               // seconds of consecutive good cycles to clear a fault
+
+class Health
+{
+  public:
+    enum Fault : uint8_t { FAULT_NONE, FAULT_V0_BAND, FAULT_SATURATION, FAULT_STUCK, FAULT_RANGE };   // kinds of fault
+    Health(void) {};
+    void begin(float, float, float);                // nominal RMS voltage and currents
+    void check(CountTime *, Simul *, Measure *, Values *);   // checks the measures of the last cycle, trips and clears the fault
+    Fault checkCycle(Measure *, Values *);          // checks the measures of the last cycle, returns the fault found
+    void print(CountTime *);                        // prints the trip or the clearing of a fault
+    bool faulty = false;                            // true if the fault is tripped, the loads must be set to their safe state
+    Fault fault = FAULT_NONE;                       // kind of the tripped fault (or of the last one, once cleared)
+    uint8_t channel = 0;                            // channel of the fault, in the table of measure.h (with a single phase: 0 V0, 1 Vx, 2 Ig, 3 Ic)
+    char text[17] = "";                             // description of the fault, to be displayed
+    unsigned int nTrips = 0;                        // number of faults tripped since start
+    bool jsonMode = false;                          // true if the trips and clearings are printed as JSON lines instead of text
+  private:
+    void describe(Measure *);                       // writes the description of the fault
+    float vxNom, igNom, icNom;                      // nominal RMS voltage and currents
+    int badCycles = 0;                              // consecutive faulty cycles
+    int goodSec = 0;                                // seconds of consecutive good cycles, while tripped
+    Fault cycleFault = FAULT_NONE;                  // fault found in the last cycle
+    uint8_t cycleChannel = 0;                       // channel of the fault found in the last cycle
+};
+
+void Health::begin(float vxNom_arg, float igNom_arg, float icNom_arg)
+{
+  vxNom = vxNom_arg;
+  igNom = igNom_arg;
+  icNom = icNom_arg;
+}
+
+void Health::check(CountTime *pCT, Simul *pSM, Measure *pCM, Values *pCV)
+{
+  if( pSM->mode == Simul::SIMUL_POWER )  cycleFault = FAULT_NONE;    // the analog inputs are not used
+  else                                   cycleFault = checkCycle(pCM, pCV);
+
+  if( cycleFault != FAULT_NONE )
+  {
+    goodSec = 0;
+    if( !faulty && ( ++badCycles >= HEALTH_TRIP_CYCLES ) )
+    {
+      faulty = true;
+      fault = cycleFault;
+      channel = cycleChannel;
+      nTrips++;
+      describe(pCM);
+      print(pCT);
+    }
+  }
+  else
+  {
+    badCycles = 0;
+    if( faulty && pCT->flagOneSec && ( ++goodSec >= HEALTH_CLEAR_S ) )
+    {
+      goodSec = 0;
+      faulty = false;
+      print(pCT);
+    }
+  }
+}
+
+Health::Fault Health::checkCycle(Measure *pCM, Values *pCV)
+{
+  int top = pCM->saturation;
+  int n = pCM->numSamples;
+  int c, i, p, saturated, minVal, maxVal;
+  long sum;
+
+  cycleChannel = 0;
+  if( ( pCV->V0Avg < HEALTH_V0_MIN_FRACTION * pCM->resolution ) || ( pCV->V0Avg > HEALTH_V0_MAX_FRACTION * pCM->resolution ) )
+    return(FAULT_V0_BAND);
+
+  for( c = 0; c < pCM->nChannels; c++ )
+  {
+    int *samples = pCM->samples[c];
+    uint8_t type = pCM->chanType[c];
+
+    saturated = 0;
+    sum = 0L;
+    minVal = top;
+    maxVal = 0;
+    for( i = 0; i < n; i++ )
+    {
+      int v = samples[i];
+      if( ( v <= 0 ) || ( v >= top ) ) saturated++;
+      minVal = min(minVal, v);
+      maxVal = max(maxVal, v);
+      sum += v;
+    }
+
+    cycleChannel = c;
+    if( saturated > HEALTH_SATURATED_MAX )                                                                     return(FAULT_SATURATION);
+    if( ( type == Measure::CH_VX ) && ( maxVal - minVal < ( HEALTH_VX_STUCK_COUNTS << pCM->extraBits ) ) )     return(FAULT_STUCK);
+    if( ( type >= Measure::CH_IG ) && ( abs( sum / n - (long) pCV->V0Avg ) > ( HEALTH_OFFSET_MAX_COUNTS << pCM->extraBits ) ) ) return(FAULT_STUCK);
+  }
+
+  for( p = 0; p < pCM->nPhases; p++ )
+  {
+    cycleChannel = pCM->vxCh[p];
+    if( ( pCV->VxEffPh[p] < HEALTH_VX_MIN_RATIO * vxNom ) || ( pCV->VxEffPh[p] > HEALTH_VX_MAX_RATIO * vxNom ) )   return(FAULT_RANGE);
+    cycleChannel = pCM->igCh[p];
+    if( pCV->IgEffPh[p] > HEALTH_I_MAX_RATIO * igNom )                                                            return(FAULT_RANGE);
+    cycleChannel = pCM->icCh[p];
+    if( pCV->IcEffPh[p] > HEALTH_I_MAX_RATIO * icNom )                                                            return(FAULT_RANGE);
+  }
+  for( p = 0; p < pCM->nSubcircuits; p++ )
+  {
+    cycleChannel = pCM->isCh[p];
+    if( pCV->IsEff[p] > HEALTH_I_MAX_RATIO * pCV->NodeNomA[p] )                                                   return(FAULT_RANGE);
+  }
+
+  return(FAULT_NONE);
+}
+
+void Health::describe(Measure *pCM)
+{
+  char name[4];
+
+  pCM->channelName(channel, name);
+  switch( fault )
+  {
+    case FAULT_V0_BAND:     snprintf_P(text, sizeof(text), PSTR("V0 out of band")); break;
+    case FAULT_SATURATION:  snprintf_P(text, sizeof(text), PSTR("%s saturated"), name); break;
+    case FAULT_STUCK:       snprintf_P(text, sizeof(text), PSTR("%s stuck"), name); break;
+    case FAULT_RANGE:       snprintf_P(text, sizeof(text), PSTR("%s out of range"), name); break;
+    default:                text[0] = 0; break;
+  }
+}
+
+void Health::print(CountTime *pCT)
+{
+  if( jsonMode )
+  {
+    JsonWriter js(&Serial);
+
+    js.open();
+    js.add(PSTR("type"), "event");
+    js.add(PSTR("t"), pCT->hours * 3600L + pCT->minutes * 60L + pCT->seconds);
+    js.add(PSTR("event"), faulty ? "fault" : "faultCleared");
+    js.add(PSTR("fault"), text);
+    js.close();
+    return;
+  }
+
+  if( faulty )
+    snprintf_P(buffer, 149, PSTR("%s MEASURE FAULT: %s, loads set to their safe state\n"), pCT->hhmmss, text);
+  else
+    snprintf_P(buffer, 149, PSTR("%s Measures plausible again (%s cleared), automatic decisions resumed\n"), pCT->hhmmss, text);
+  Serial.print(buffer);
+}
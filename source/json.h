@@ -0,0 +1,147 @@
+/*
+=================================================================
+json.h
+Writes JSON objects, one per line (JSON lines), directly into a
+Print stream (the serial TX queue), without any buffer or memory
+allocation
+=================================================================
+*/
+
+/*
+NOTES:
+
+Keys are strings stored in flash (PSTR), string values are in RAM and are escaped.
+Numbers are written as integers, or as fixed-point numbers with a given number of decimals,
+without using printf nor the float printing.
+Objects and arrays can be nested up to JSON_DEPTH_MAX levels, and every nested one must be closed before closing the line.
+
+Example:
+  JsonWriter js(&Serial);
+  js.open();  js.add(PSTR("type"), "values");  js.add(PSTR("Pg"), 1234L);  js.close();
+writes:
+  {"type":"values","Pg":1234}
+*/
+
+const int JSON_DEPTH_MAX = 4;         // maximum nesting of objects and arrays
+
+class JsonWriter
+{
+  public:
+    JsonWriter(Print *out_arg) : out(out_arg) {};
+    void open(void);                              // opens the object of the line
+    void close(void);                             // closes the object of the line and ends the line
+    void openObject(const char *);                // opens a nested object (key in flash, NULL inside an array)
+    void openArray(const char *);                 // opens a nested array (key in flash)
+    void closeObject(void)  { end('}'); }         // closes a nested object
+    void closeArray(void)   { end(']'); }         // closes a nested array
+    void add(const char *, long);                 // adds an integer value (key in flash)
+    void add(const char *, float, int);           // adds a fixed-point value with the given decimals (key in flash)
+    void add(const char *, const char *);         // adds a string value (key in flash, value in RAM)
+    void addBool(const char *, bool);             // adds a boolean value (key in flash)
+  private:
+    void key(const char *);                       // writes the separator and the key (if not NULL)
+    void begin(char);                             // opens a nesting level
+    void end(char);                               // closes a nesting level
+    Print *out;                                   // stream where the JSON is written
+    uint8_t depth = 0;                            // nesting level
+    uint8_t first = 0;                            // bit n set if no value has been written yet at level n
+};
+
+void JsonWriter::open(void)
+{
+  depth = 0;
+  begin('{');
+}
+
+void JsonWriter::close(void)
+{
+  end('}');
+  out->write('\n');
+}
+
+void JsonWriter::openObject(const char *k)
+{
+  key(k);
+  begin('{');
+}
+
+void JsonWriter::openArray(const char *k)
+{
+  key(k);
+  begin('[');
+}
+
+void JsonWriter::begin(char c)
+{
+  out->write(c);
+  if( depth < JSON_DEPTH_MAX ) depth++;
+  first |= ( 1 << depth );
+}
+
+void JsonWriter::end(char c)
+{
+  out->write(c);
+  if( depth > 0 ) depth--;
+}
+
+void JsonWriter::key(const char *k)
+{
+  char c;
+
+  if( first & ( 1 << depth ) ) first &= ~( 1 << depth );
+  else                         out->write(',');
+
+  if( k == NULL ) return;                         // value inside an array
+
+  out->write('"');
+  while( ( c = pgm_read_byte(k++) ) != 0 ) out->write(c);
+  out->write('"');
+  out->write(':');
+}
+
+void JsonWriter::add(const char *k, long value)
+{
+  key(k);
+  out->print(value);
+}
+
+void JsonWriter::add(const char *k, float value, int decimals)
+{
+  long scale = 1L;
+  long scaled;
+
+  for( int i = 0; i < decimals; i++ ) scale *= 10L;
+  scaled = round( value * scale );
+
+  key(k);
+  if( scaled < 0 )
+  {
+    out->write('-');
+    scaled = -scaled;
+  }
+  out->print( scaled / scale );
+  if( decimals > 0 )
+  {
+    out->write('.');
+    for( long d = scale / 10L; d > 0; d /= 10L )    // fraction digits, with leading zeros
+      out->write( '0' + ( ( scaled % scale ) / d ) % 10 );
+  }
+}
+
+void JsonWriter::add(const char *k, const char *value)
+{
+  key(k);
+  out->write('"');
+  for( ; *value; value++ )
+  {
+    if( ( *value == '"' ) || ( *value == '\\' ) ) out->write('\\');
+    if( (uint8_t) *value >= ' ' ) out->write(*value);     // control characters are dropped
+  }
+  out->write('"');
+}
+
+void JsonWriter::addBool(const char *k, bool value)
+{
+  key(k);
+  out->print( value ? F("true") : F("false") );
+}
@@ -9,7 +9,26 @@ Periodically refreshes the activation status of the loads
 ============================================================
 */
 
-const int N_LOADS_MAX = 3;                  // Maximum number of loads to be managed
+// The maximum number of loads to be managed, N_LOADS_MAX, is set in config.h as the size of the load table
+// With several phases, each load is supplied by one phase: it is switched On only if there is margin on its phase and in total,
+// and only if there is excedent according to the metering rule (see values.h); when there is no margin or no excedent on a phase,
+// the load with least priority on that phase is switched Off. With a single phase, the decisions are those of the total margin and excedent.
+// In the same way, a load behind sub-circuits (node) is switched On only if there is margin on every sub-circuit of its path (see values.h),
+// and when a sub-circuit has no margin, the loads of that branch are switched Off first, before the loads elsewhere.
+
+// The loads On which draw next to nothing (satisfied) are detected every second, see watchDraw()
+const float SATISFIED_FRACTION = 0.2;       // fraction of its power below which a load On draws next to nothing (satisfied)
+const int SATISFIED_PROBE_S = 30;           // seconds after a switch to On before its step is measured, and seconds of confirmation of a satisfied load
+const int SATISFIED_STEP_S = 10;            // seconds over which a step of the consumption is measured
+const float SATISFIED_STEP_TOLERANCE = 0.3; // tolerance of a step of the consumption to match the draw of a load, as a fraction of it
+const int SATISFIED_REPROBE_S = 900;        // seconds after which a satisfied load is probed again
+const float BASELINE_TIME_CONSTANT_S = 600.0;   // time constant of the learned baseline of the consumption without the managed loads
+
+// The decide period adapts to the volatility of the excedent, see adaptDecide()
+const float DECIDE_STABILITY_FACTOR = 6.0;  // shortest decide period, in time constants of the filtered powers
+const float VOLATILITY_LOW = 0.05;          // volatility of the excedent below which the shortest decide period is used, in powers of the smallest load per second
+const float VOLATILITY_HIGH = 0.5;          // volatility of the excedent above which the longest decide period is used, in powers of the smallest load per second
+
 const float POWER_REDUCTION_FACTOR = 0.85;  // To solve a priority inversion, the nominal power of the load to be set to off is reduced by this factor, 
                                             // in order not to compute a too optimistic available power
 
@@ -17,17 +36,28 @@ class Loads
 { 
   public:
     Loads(void) {};                                             // constructor
-    int add(char *,float,int,int,int,int,Radio::RadioHW, int);  // adds and inicializes a new load
-    void decide(CountTime *, Values *);                         // decides which loads are activated or deactivated according to the powers
-    void activate(CountTime *, Radio *, Values * );             // executes the activation and deactivation of the loads according to the decision, and also periodically refreshes the activation status
+    int add(const Config::LoadData *, int, int);                // adds and inicializes a new load, from its configuration, on the given phase (from 0) and sub-circuit
+    bool allowed(int, int);                                     // true if the load may be On: its parent is On, and no other load of its group (but the one given) is On
+    void shed(int, const char *);                               // switches Off a load, and its dependents, with the cause
+    void begin(int);                                            // sets the rotate period of the loads of equal priority
+    void rotate(void);                                          // sorts the loads of every priority class by their time On, into the decision order
+    void watchDraw(CountTime *, Values *);                      // every second, detects the loads On which draw next to nothing (satisfied)
+    void printDraw( int, CountTime *, Values *, const char * ); // prints a load becoming satisfied or drawing again
+    void decide(CountTime *, Values *, Health *);               // decides which loads are activated or deactivated according to the powers
+    void adaptDecide(CountTime *, Values *);                    // adapts the decide period to the volatility of the excedent
+    void activate(CountTime *, Radio *, Values *, Breadcrumbs *);   // executes the activation and deactivation of the loads according to the decision, and also periodically refreshes the activation status
     void print( int, CountTime *, Values * );                   // prints the change of status of load
-    void printRefr( int, CountTime * );                         // prints the periodical refresh of load
+    void printRefr( int, CountTime *, Values * );               // prints the periodical refresh of load
+    void printJson( int, CountTime *, Values *, const char * ); // prints a change or a refresh of load as a JSON line
+    void printStats( CountTime * );                             // prints the statistics since start
     int nLoadsMax = N_LOADS_MAX;                                // maximum number of loads to be managed
     int nLoads = 0;                                             // actual number of loads which are managed
-    char *cause = "program start";                              // reason for the most recent change on loads
+    const char *cause = "program start";                        // reason for the most recent change on loads
+    bool jsonMode = false;                                      // true if the changes are printed as JSON lines instead of text
+    bool overloadOnly = false;                                  // true in the night profile: the solar activations and the avoidance of priority inversion are skipped (see lowpower.h)
 
     // configuration data
-    char *name[N_LOADS_MAX];                                    // name of the load, to be displayed (max 5 characters)
+    const char *name[N_LOADS_MAX];                              // name of the load, to be displayed (max 5 characters)
     float powerW[N_LOADS_MAX];                                  // nominal power of the load (Watts)
     int lockOnSec[N_LOADS_MAX];                                 // time in seconds which the activated load is prevented to be switched off 
     int lockOffSec[N_LOADS_MAX];                                // time in seconds which the deactivated load is prevented to be switched on 
@@ -35,29 +65,86 @@ class Loads
     int gpioMode[N_LOADS_MAX];                                  // number of the digital input gpio where the manual/solar switch of the load is connected
     Radio::RadioHW radioModel[N_LOADS_MAX];                     // type of radio model/protocol used by the remote switch which controls the load
     int channel[N_LOADS_MAX];                                   // radio channel number used by the remote switch which controls the load
+    int safeState[N_LOADS_MAX];                                 // state of the load while the measures are not plausible: 0 Off, 1 On, -1 unchanged
+    uint8_t phase[N_LOADS_MAX];                                 // phase which supplies the load, from 0
+    uint8_t node[N_LOADS_MAX];                                  // sub-circuit which supplies the load, from 1, or 0 if only the main supply
+    int onReserveW[N_LOADS_MAX];                                // excedent required above the power of the load to switch it On
+    int offReserveW[N_LOADS_MAX];                               // excedent below which the load is switched Off
+    uint8_t importPct[N_LOADS_MAX];                             // percentage of the power of the load which may be imported before it is switched Off
+    uint8_t group[N_LOADS_MAX];                                 // group of mutually exclusive loads, or 0 if none
+    int8_t parent[N_LOADS_MAX];                                 // load which must be On for this one to be On, or -1 if none
+    uint8_t prioClass[N_LOADS_MAX];                             // class of loads of equal priority, which share the excedent by rotation, or 0 if none
+    int rotatePeriod_s = 1800;                                  // time in seconds between successive rotations of the loads of equal priority
+    int settleMs[N_LOADS_MAX];                                  // settle window after a switch to On (inrush), in milliseconds
 
     // Status data
     bool solarMode[N_LOADS_MAX];                                // load mode, false = manual, true = solar
     bool flag[N_LOADS_MAX];                                     // true if the ativation status is pending to be changed, false if not
     bool on[N_LOADS_MAX];                                       // true if the load is On, false if Off
     int lockSec[N_LOADS_MAX];                                   // remaining time in seconds until a change in the activation status of the load will be allowed 
+    bool forced[N_LOADS_MAX];                                   // true if the activation is overridden remotely (Modbus), instead of automatically decided
+    bool forcedOn[N_LOADS_MAX];                                 // commanded activation status when overridden, true = On
+    uint8_t order[N_LOADS_MAX];                                 // loads from highest to lowest priority, as decided (the table order, but rotated within the priority classes)
+    int rotateCount_s = 0;                                      // remaining time in seconds until the next rotation
+    bool decidePending = false;                                 // true if the decisions on the excedent are due, postponed until the settle window ends
+    bool satisfied[N_LOADS_MAX];                                // true if the load is On but draws next to nothing (its thermostat is open)
+    float drawW[N_LOADS_MAX];                                   // learned actual draw of the load when On (Watts)
+    float probeBaseW[N_LOADS_MAX];                              // consumption before the load was switched On
+    int probeSec[N_LOADS_MAX];                                  // remaining time in seconds until the step of a load switched On is measured, 0 if none
+    int satisfiedSec[N_LOADS_MAX];                              // time in seconds since the load was found satisfied, or seconds of confirmation while a candidate
+    bool stepSeen[N_LOADS_MAX];                                 // true if a drop of the consumption of about the draw of the load has been seen (candidate)
+    float baseW = -1.0;                                         // learned baseline of the consumption without the managed loads, -1 until the first second
+    unsigned int baseSec = 0;                                   // seconds learned into the baseline, a plain average until BASELINE_TIME_CONSTANT_S
+    int consumedW[SATISFIED_STEP_S];                            // filtered consumption of the last seconds, to measure the steps
+    uint8_t iConsumed = 0;                                      // oldest second of consumedW
+    bool waiting[N_LOADS_MAX];                                  // true while its switch to On waits for the settle window of another load
+
+    // Statistics since start
+    unsigned int switches[N_LOADS_MAX];                         // switches to On of every load
+    unsigned long onSec[N_LOADS_MAX];                           // time On of every load (seconds)
+    float generatedWh = 0.0;                                    // energy generated (filtered)
+    float exportedWh = 0.0;                                     // energy exported to the grid (filtered excedent)
+    float importedWh = 0.0;                                     // energy imported from the grid (filtered deficit)
+    unsigned int rotations = 0;                                 // rotations which have changed the decision order
+    unsigned int staggered = 0;                                 // switches to On delayed by the settle window of another load
 };
 
-int Loads::add( char * name_arg, float powerW_arg, int lockOnSec_arg, int lockOffSec_arg, int gpioOut_arg, int gpioMode_arg, Radio::RadioHW radioModel_arg, int channel_arg )
+int Loads::add( const Config::LoadData *pL, int phase_arg, int node_arg )
 {
   if (nLoads >= nLoadsMax ) return(-1);       // ERROR: no space for another load
 
-  name[nLoads] =        name_arg;
-  powerW[nLoads] =      powerW_arg;
-  lockOnSec[nLoads] =   lockOnSec_arg;
-  lockOffSec[nLoads] =  lockOffSec_arg;
-  gpioOut[nLoads] =     gpioOut_arg;
-  gpioMode[nLoads] =    gpioMode_arg;
-  radioModel[nLoads] =  radioModel_arg;
-  channel[nLoads] =     channel_arg;
+  name[nLoads] =        pL->name;
+  powerW[nLoads] =      pL->powerW;
+  lockOnSec[nLoads] =   pL->lockOnSec;
+  lockOffSec[nLoads] =  pL->lockOffSec;
+  gpioOut[nLoads] =     pL->gpioOut;
+  gpioMode[nLoads] =    pL->gpioMode;
+  radioModel[nLoads] =  (Radio::RadioHW) pL->radioModel;
+  channel[nLoads] =     pL->channel;
+  safeState[nLoads] =   pL->safeState;
+  phase[nLoads] =       phase_arg;
+  node[nLoads] =        node_arg;
+  onReserveW[nLoads] =  pL->onReserveW;
+  offReserveW[nLoads] = pL->offReserveW;
+  importPct[nLoads] =   pL->importPct;
+  group[nLoads] =       pL->group;
+  parent[nLoads] =      pL->parent;
+  prioClass[nLoads] =   pL->prioClass;
+  settleMs[nLoads] =    pL->settleMs;
+  order[nLoads] =       nLoads;
+  satisfied[nLoads] =   false;
+  drawW[nLoads] =       pL->powerW;
+  probeSec[nLoads] =    0;
+  satisfiedSec[nLoads] = 0;
+  stepSeen[nLoads] =    false;
+  waiting[nLoads] =     false;
+  switches[nLoads] =    0;
+  onSec[nLoads] =       0UL;
   flag[nLoads] =        true;
   on[nLoads] =          false;
   lockSec[nLoads]  =    0;
+  forced[nLoads] =      false;
+  forcedOn[nLoads] =    false;
 
   if( gpioOut[nLoads] != -1 )                 // initializes load output to Off, if there is a pin assigned
   {
@@ -80,54 +167,310 @@ int Loads::add( char * name_arg, float powerW_arg, int lockOnSec_arg, int lockOf
   return(0);
 }
 
-void Loads::decide(CountTime *pCT, Values *pCV) //decides whether every load must be activated or deactivated according to consumption margin and solar excedent
+void Loads::begin(int rotatePeriod_arg)
+{
+  rotatePeriod_s = rotatePeriod_arg;
+  rotateCount_s = rotatePeriod_s;
+}
+
+// The priority is the order of the load table, but the loads of the same priority class (field class of the configuration, 0 none) share the excedent:
+// every rotate period (setting rotate), the loads of a class are sorted by their time On since start, the one with the largest deficit first,
+// into the place of the first load of the class in the decision order (order[], which every decision follows instead of the table).
+// Then the avoidance of priority inversion swaps them: within a class, with the nominal power of the load On instead of its reduced power
+// (the loads of a class are similar), and with the cause "rotation". The swap waits for the lock times of both loads, as any other decision.
+void Loads::rotate(void)
+{
+  bool placed[N_LOADS_MAX];
+  uint8_t previous[N_LOADS_MAX];
+  int i, j, k = 0, m, start;
+
+  memcpy(previous, order, sizeof(order));
+  memset(placed, 0, sizeof(placed));
+  for( i = 0; i < nLoads; i++ )
+  {
+    if( placed[i] ) continue;
+    start = k;
+    for( j = i; j < nLoads; j++ )                       // the loads of the class take the place of its first load, from the least time On
+    {
+      if( ( j != i ) && ( ( prioClass[i] == 0 ) || ( prioClass[j] != prioClass[i] ) ) ) continue;
+      for( m = k++; ( m > start ) && ( onSec[order[m - 1]] > onSec[j] ); m-- )
+        order[m] = order[m - 1];
+      order[m] = j;
+      placed[j] = true;
+    }
+  }
+  if( memcmp(previous, order, sizeof(order)) ) rotations++;
+}
+
+// Besides their priority, the loads may be constrained by groups and dependencies (fields group and parent of the configuration):
+// the loads of the same group are never On together (two heater elements on one supply), the one of higher priority wins, and a load with a parent
+// is On only while its parent is On (the chlorinator only while the pool pump runs), so that its parent must have a higher priority.
+// Every load switched Off, by any rule, goes through shed(), which switches Off its dependents in the same decision (with the cause of the parent),
+// disregarding their lock times, and a load which is found On against the constraints (after a watchdog reset, a fault or an override) is switched Off first.
+bool Loads::allowed(int iLoad, int except)
+{
+  if( ( parent[iLoad] >= 0 ) && !on[parent[iLoad]] ) return(false);
+  if( group[iLoad] == 0 ) return(true);
+  for( int j = 0; j < nLoads; j++ )
+    if( ( j != iLoad ) && ( j != except ) && on[j] && ( group[j] == group[iLoad] ) ) return(false);
+  return(true);
+}
+
+void Loads::shed(int iLoad, const char *cause_arg)
+{
+  on[iLoad] = false;
+  flag[iLoad] = true;
+  lockSec[iLoad] = lockOffSec[iLoad];
+  cause = cause_arg;
+
+  for( int j = iLoad + 1; j < nLoads; j++ )           // the dependents have less priority than their parent, so that a single pass cascades
+  {
+    if( on[j] && ( parent[j] >= 0 ) && !on[parent[j]] )
+    {
+      on[j] = false;
+      flag[j] = true;
+      lockSec[j] = lockOffSec[j];
+    }
+  }
+}
+
+// A load with its own thermostat (a water heater) may be commanded On while it draws nothing. Such a load is detected as satisfied, every second (watchDraw):
+// - SATISFIED_PROBE_S seconds after it is switched On, the step of the filtered consumption since the switch is its draw; below SATISFIED_FRACTION of its power, it is satisfied,
+//   otherwise the step is learned as its actual draw (drawW)
+// - while it is On, a drop of the consumption of about its draw (within SATISFIED_STEP_TOLERANCE, over SATISFIED_STEP_S seconds) makes it a candidate,
+//   which is satisfied if, for SATISFIED_PROBE_S seconds, the consumption is explained by the learned baseline (the consumption not due to the managed loads,
+//   learned with BASELINE_TIME_CONSTANT_S while steady) and the draws of the other loads On
+// - a rise of the consumption of about its draw (the thermostat closes) makes it unsatisfied at once, and every SATISFIED_REPROBE_S seconds it is probed again,
+//   so that a missed rise does not keep it satisfied
+// A satisfied load stays On (its thermostat decides), but its power is not counted as available: it is not shed for lack of excedent, nor to avoid a priority inversion,
+// so that its budget goes to the lower priority loads. When its thermostat closes, the lack of excedent sheds those lower priority loads. The margin checks still shed it.
+void Loads::watchDraw(CountTime *pCT, Values *pCV)
+{
+  int i;
+  float consumed = - pCV->PcFilt;
+  float drop = ( baseW < 0.0 ) ? 0.0 : consumedW[iConsumed] - consumed;   // drop of the consumption over the last SATISFIED_STEP_S seconds
+  float explained = 0.0;                              // consumption due to the managed loads which draw
+  float smallest = 9999.0;                            // power of the smallest load
+  bool probing = false;
+
+  if( baseW < 0.0 )                                   // first second
+  {
+    baseW = consumed;
+    for( i = 0; i < SATISFIED_STEP_S; i++ ) consumedW[i] = consumed;
+  }
+  consumedW[iConsumed] = consumed;
+  iConsumed = ( iConsumed + 1 ) % SATISFIED_STEP_S;
+
+  for( i = 0; i < nLoads; i++ )
+  {
+    if( on[i] && !satisfied[i] ) explained += drawW[i];
+    if( probeSec[i] > 0 ) probing = true;
+    smallest = min( smallest, powerW[i] );
+  }
+
+  for( i = 0; i < nLoads; i++ )
+  {
+    if( !on[i] ) continue;
+    float others = explained - ( satisfied[i] ? 0.0 : drawW[i] );    // draws of the other loads On
+    bool stepMatches = fabs( fabs(drop) - drawW[i] ) < SATISFIED_STEP_TOLERANCE * drawW[i];
+
+    if( probeSec[i] > 0 )                             // switched On: measures the step
+    {
+      if( --probeSec[i] > 0 ) continue;
+      float step = consumed - probeBaseW[i];
+      if( step < SATISFIED_FRACTION * powerW[i] )
+      {
+        satisfied[i] = true;
+        satisfiedSec[i] = 0;
+        printDraw(i, pCT, pCV, "satisfied");
+      }
+      else drawW[i] = min( step, powerW[i] * ( 1.0 + SATISFIED_STEP_TOLERANCE ) );
+    }
+    else if( satisfied[i] )                           // satisfied: draws again on a rise, or is probed again after a while
+    {
+      if( ( ( drop < 0.0 ) && stepMatches ) || ( ++satisfiedSec[i] >= SATISFIED_REPROBE_S ) )
+      {
+        satisfied[i] = false;
+        stepSeen[i] = ( satisfiedSec[i] >= SATISFIED_REPROBE_S );    // a re-probe is confirmed from the baseline, without a step
+        satisfiedSec[i] = 0;
+        if( !stepSeen[i] ) printDraw(i, pCT, pCV, "drawing");
+      }
+    }
+    else                                              // drawing: a drop of about its draw, confirmed by the baseline, makes it satisfied
+    {
+      if( ( drop > 0.0 ) && stepMatches ) stepSeen[i] = true;
+      if( stepSeen[i] && ( consumed - baseW - others < SATISFIED_FRACTION * drawW[i] ) )
+      {
+        if( ++satisfiedSec[i] >= SATISFIED_PROBE_S )
+        {
+          satisfied[i] = true;
+          stepSeen[i] = false;
+          satisfiedSec[i] = 0;
+          printDraw(i, pCT, pCV, "satisfied");
+        }
+      }
+      else
+      {
+        if( satisfiedSec[i] > 0 ) stepSeen[i] = false;   // not confirmed
+        satisfiedSec[i] = 0;
+      }
+    }
+  }
+
+  if( !probing && ( fabs(drop) < SATISFIED_FRACTION * smallest ) )   // steady: learns the baseline
+  {
+    if( baseSec < BASELINE_TIME_CONSTANT_S ) baseSec++;
+    baseW += ( max( 0.0, consumed - explained ) - baseW ) / baseSec;
+  }
+}
+
+// The decide period adapts to the volatility of the excedent (PnVolat, see values.h), once per second: with a steady excedent the decisions
+// are taken at the shortest period, so that the loads converge quickly after a change, and with broken clouds the period grows up to
+// the setting decidemax, so that the loads do not churn. The period goes linearly from the shortest to the longest one while the volatility goes
+// from VOLATILITY_LOW to VOLATILITY_HIGH times the power of the smallest load per second. The shortest period is the setting decide,
+// but never below DECIDE_STABILITY_FACTOR times the time constant of the filtered powers (for stability).
+void Loads::adaptDecide(CountTime *pCT, Values *pCV)
+{
+  float smallest = 9999.0;                            // power of the smallest load
+  for( int i = 0; i < nLoads; i++ )
+    smallest = min( smallest, powerW[i] );
+
+  int shortest = max( pCT->decideMin_s, (int) ceil( DECIDE_STABILITY_FACTOR * pCV->TimeConst / 1.0e6 ) );
+  int longest = max( shortest, pCT->decideMax_s );
+  float x = constrain( ( pCV->PnVolat / smallest - VOLATILITY_LOW ) / ( VOLATILITY_HIGH - VOLATILITY_LOW ), 0.0, 1.0 );
+  pCT->decidePeriod_s = shortest + (int) round( x * ( longest - shortest ) );
+  if( pCT->countDecide_s > pCT->decidePeriod_s ) pCT->countDecide_s = pCT->decidePeriod_s;   // a shorter period applies at once
+}
+
+// Every load in solar mode has its own hysteresis: it is switched On when the excedent exceeds its power plus onReserveW,
+// and switched Off when the excedent falls to offReserveW minus importPct percent of its power (with the load On, a negative excedent is an import),
+// so that a load allowed to import 20% of its power keeps running through a short cloud. With the reserves 0 and no import, the rules are
+// those of the previous versions (On above its power, Off at no excedent).
+// Every switch to On opens the settle window of the load (settleMs, field settle of the configuration, for the inrush of a motor), see values.h:
+// the filtered powers de-weight the windows, and the decisions which may switch a load On (or shed it for lack of excedent) are postponed
+// until it ends, while the shedding for the constraints and the margins is never postponed.
+void Loads::decide(CountTime *pCT, Values *pCV, Health *pHM) //decides whether every load must be activated or deactivated according to consumption margin and solar excedent
 {
-  int i, j;
+  int i, j, k, l;
     
   if( pCT->flagOneSec )                               // task every second
   {
     for(i=0; i< nLoads; i++)
     {
-        solarMode[i] = digitalRead(gpioMode[i]);      // updates mode solar/manual according to switch input
+        if( gpioMode[i] != -1 )
+          solarMode[i] = digitalRead(gpioMode[i]);    // updates mode solar/manual according to switch input
         if(lockSec[i] > 0)   lockSec[i]--;            // decreases lock time counter
+        if( on[i] ) onSec[i]++;
+    }
+    if( --rotateCount_s <= 0 )                        // rotates the loads of equal priority
+    {
+      rotateCount_s = rotatePeriod_s;
+      rotate();
+    }
+    generatedWh += pCV->PgFilt / 3600.0;              // energies of the last second
+    if( pCV->PnFilt > 0.0 ) exportedWh += pCV->PnFilt / 3600.0;
+    else                    importedWh -= pCV->PnFilt / 3600.0;
+    adaptDecide(pCT, pCV);
+    watchDraw(pCT, pCV);
+  }
+
+  // IF THE MEASURES ARE NOT PLAUSIBLE, SET AT ONCE EVERY LOAD TO ITS SAFE STATE, DISREGARDING LOCK TIME COUNTERS AND REMOTE OVERRIDES
+  // NO DECISION IS TAKEN ON THE MEASURES UNTIL THEY ARE PLAUSIBLE AGAIN
+
+  if( pHM->faulty )
+  {
+    for( i=0; i < nLoads; i++ )
+    {
+      if( ( safeState[i] != -1 ) && ( on[i] != ( safeState[i] == 1 ) ) )
+      {
+        on[i] = ( safeState[i] == 1 );
+        flag[i] = true;
+        lockSec[i] = on[i] ? lockOnSec[i] : lockOffSec[i];
+        cause = "measure fault";
+      }
     }
+    return;
   }
 
   if( pCT->flagDecide )                               // decision tasks are run every decide period, period should be >= 6 * filtering time constant (for stability)
   {
-    // IF NO CONSUMPTION MARGIN, DEACTIVATE THE ACTIVE LOAD WITH LEAST PRIORITY
+    decidePending = false;
+    // IF A LOAD IS ON WITHOUT ITS PARENT, OR TOGETHER WITH ANOTHER LOAD OF ITS GROUP, DEACTIVATE IT (THE ONE WITH LEAST PRIORITY FIRST)
+    // DISREGARD LOCK TIME COUNTER, THE CONSTRAINTS BETWEEN LOADS ARE NEVER BROKEN
+
+    for( k=nLoads-1; k>=0; k-- )                    // from less to more priority
+    {
+      i = order[k];
+      if( on[i] && !allowed(i, -1) )
+      {
+        shed(i, "group or parent");
+        return;                                     // no more tasks are performed until next decide period
+      }
+    }
+
+    // IF NO CONSUMPTION MARGIN ON A SUB-CIRCUIT, DEACTIVATE THE ACTIVE LOAD WITH LEAST PRIORITY OF THAT BRANCH
+    // THEN, IF NO CONSUMPTION MARGIN (IN TOTAL, ON ITS PHASE OR ON ITS SUB-CIRCUITS), DEACTIVATE THE ACTIVE LOAD WITH LEAST PRIORITY
     // DISREGARD LOCK TIME COUNTER, DEACTIVATION MUST BE IMMEDIATE TO AVOID GRID PROTECTION TO TRIP
 
-    if( pCV->Margin <= 0 )
+    for( k=nLoads-1; k>=0; k-- )                    // from less to more priority
     {
-      for( i=nLoads-1; i>=0; i-- )                    // from less to more priority
+      i = order[k];
+      if( on[i] && pCV->branchOverloaded(node[i]) )
       {
-        if(on[i])
+        shed(i, "no margin in sub-circuit");
+        return;                                     // no more tasks are performed until next decide period
+      }
+    }
+
+    for( k=nLoads-1; k>=0; k-- )                    // from less to more priority
+    {
+      i = order[k];
+      if( on[i] && ( pCV->shedMargin(phase[i], node[i]) <= 0 ) )
+      {
+        shed(i, "no margin");
+        return;                                     // no more tasks are performed until next decide period
+      }
+    }
+    decidePending = true;
+  }
+
+  if( decidePending && !pCV->settling() )             // the other decisions are postponed until the settle window after a switch to On ends (inrush)
+  {                                                   // the shedding above is not, since the inrush is already de-weighted in the margins
+    decidePending = false;
+
+    // REMOTELY OVERRIDDEN LOADS FOLLOW THEIR COMMANDED STATUS, BUT ARE SET TO ON ONLY IF THERE IS ENOUGH CONSUMPTION MARGIN FOR THEIR NOMINAL POWER
+    // AND ONLY IF THEIR PARENT IS ON AND NO OTHER LOAD OF THEIR GROUP IS ON
+    // THEY ARE NOT CONSIDERED BY THE AUTOMATIC DECISIONS BELOW
+
+    for( i=0; i < nLoads; i++ )
+    {
+      if( forced[i] && ( on[i] != forcedOn[i] ) && ( !forcedOn[i] || ( ( powerW[i] < pCV->margin(phase[i], node[i]) ) && allowed(i, -1) ) ) )
+      {
+        if( !forcedOn[i] )
         {
-          on[i] = false;  
-          flag[i] = true; 
-          lockSec[i] = lockOffSec[i];
-          cause = "no margin";
+          shed(i, "remote override");
           return;                                     // no more tasks are performed until next decide period
         }
+        on[i] = true;
+        flag[i] = true;
+        lockSec[i] = lockOnSec[i];
+        cause = "remote override";
+        return;                                       // no more tasks are performed until next decide period
       }
     }
 
-    // IF SOLAR EXCEDENT NEGATIVE, DEACTIVATE THE ACTIVE LOAD IN SOLAR MODE WITH LEAST PRIORITY
+    // IF SOLAR EXCEDENT (FOR ITS PHASE) BELOW THE OFF THRESHOLD OF THE LOAD, DEACTIVATE THE ACTIVE LOAD IN SOLAR MODE WITH LEAST PRIORITY
+    // THE OFF THRESHOLD IS ITS OFF RESERVE, MINUS THE PART OF ITS POWER WHICH MAY BE IMPORTED
+    // A SATISFIED LOAD IS SKIPPED, SINCE IT DRAWS NEXT TO NOTHING
 
-    if( pCV->PnFilt <= 0.0)
+    for( k=nLoads-1; k>=0; k-- )                    // from less to more priority
     {
-      for( i=nLoads-1; i>=0; i-- )                    // from less to more priority
+      i = order[k];
+      if( solarMode[i] && on[i] && !satisfied[i] && (lockSec[i] == 0) && !forced[i] && ( pCV->excedent(phase[i]) <= offReserveW[i] - importPct[i] * powerW[i] / 100.0 ) ) 
       {
-        if( solarMode[i] && on[i] && (lockSec[i] == 0) ) 
-        {
-          on[i] = false;  
-          flag[i] = true; 
-          lockSec[i] = lockOffSec[i];
-          cause = "no excedent";
-          return;                                      // no more tasks are performed until next decide period
-        }                         
-      }
+        shed(i, "no excedent");
+        return;                                      // no more tasks are performed until next decide period
+      }                         
     }
 
     // AVOIDING PRIORITY INVERSION
@@ -135,20 +478,26 @@ void Loads::decide(CountTime *pCT, Values *pCV) //decides whether every load mus
     // and the (reduced) nominal power of the lower priority load plus the solar excedent would suffice to supply the load with higher priority
     // in such a case, set to Off the load with lower priority,
     // so that in the next decision period, if there is actually enough excedent, the higher priority load will be set to On 
+    // If each phase is metered on its own, the power of a load on another phase does not add to the excedent of the higher priority load
+    // Only if the higher priority load would be allowed with the lower priority one Off (its parent On, no other load of its group On)
+    // Within a priority class, the nominal power of the lower priority load is taken, so that the loads of the class rotate
 
-    for( i = 0; i < nLoads; i++ )
+    for( k = 0; k < nLoads && !overloadOnly; k++ )
     {
-      if( ( !on[i] ) && ( solarMode[i] ) && ( lockSec[i] == 0 ) )                   // a higher priority load in off condition, solar mode, and ready to change status
+      i = order[k];
+      if( ( !on[i] ) && ( solarMode[i] ) && ( lockSec[i] == 0 ) && !forced[i] )     // a higher priority load in off condition, solar mode, and ready to change status
       {
-        for( j = i+1; j < nLoads; j++ )
+        for( l = k+1; l < nLoads; l++ )
         {
-          if( ( on[j] ) && ( solarMode[j] ) && ( lockSec[j] == 0 ) &&               // a lower priority load in on condition, solar mode, and ready to change status
-              ( powerW[j] * POWER_REDUCTION_FACTOR + pCV->PnFilt >= powerW[i] ) )   // the (reduced) power of the lower priority load plus the excedent would suffice to supply the higher prority load
+          j = order[l];
+          bool sameClass = ( prioClass[i] != 0 ) && ( prioClass[j] == prioClass[i] );
+          if( ( on[j] ) && ( solarMode[j] ) && ( lockSec[j] == 0 ) && !forced[j] && // a lower priority load in on condition, solar mode, and ready to change status
+              !satisfied[j] &&                                                      // which actually draws its power
+              ( !pCV->meteringPerPhase || ( phase[j] == phase[i] ) ) &&             // whose power would be available to the higher priority load
+              allowed(i, j) &&                                                      // which is the only one keeping the higher priority load Off by its group, if any
+              ( powerW[j] * ( sameClass ? 1.0 : POWER_REDUCTION_FACTOR ) + pCV->excedent(phase[i]) >= powerW[i] + onReserveW[i] ) )   // the (reduced) power of the lower priority load plus the excedent would suffice to supply the higher prority load
           {                                                                                
-            on[j] = false;                                                          // put to Off the lower priority load
-            flag[j] = true; 
-            lockSec[j] = lockOffSec[j];
-            cause = "priority inversion";
+            shed(j, sameClass ? "rotation" : "priority inversion");                 // put to Off the lower priority load, and its dependents
             return;                                                                 // no more tasks are performed until next decide period
           }
         }
@@ -156,11 +505,13 @@ void Loads::decide(CountTime *pCT, Values *pCV) //decides whether every load mus
     }
 
     // ACTIVATE THE MOST PRIORITY LOAD IF THERE IS ENOUGH CONSUMPTION MARGIN FOR ITS NOMINAL POWER
-    // AND, IF THE LOAD IS IN SOLAR MODE, IF THERE IS ENOUGH SOLAR EXCEDENT FOR ITS NOMINAL POWER
+    // AND, IF THE LOAD IS IN SOLAR MODE, IF THERE IS ENOUGH SOLAR EXCEDENT FOR ITS NOMINAL POWER PLUS ITS ON RESERVE
+    // AND IF ITS PARENT IS ON AND NO OTHER LOAD OF ITS GROUP IS ON
 
-    for( i=0; i < nLoads; i++)                                      // from more to less priority
+    for( k=0; k < nLoads; k++)                                      // from more to less priority
     {
-      if( ( !on[i] ) && ( lockSec[i] == 0 ) && ( powerW[i] < pCV->Margin ) && ( ( !solarMode[i] ) || ( powerW[i] < pCV->PnFilt ) ) )
+      i = order[k];
+      if( ( !on[i] ) && ( lockSec[i] == 0 ) && !forced[i] && allowed(i, -1) && ( powerW[i] < pCV->margin(phase[i], node[i]) ) && ( ( !solarMode[i] ) || ( !overloadOnly && ( powerW[i] + onReserveW[i] < pCV->excedent(phase[i]) ) ) ) )
       {
           on[i] = true;  
           flag[i] = true; 
@@ -174,7 +525,9 @@ void Loads::decide(CountTime *pCT, Values *pCV) //decides whether every load mus
 }
 
 
-void Loads::activate(CountTime *pCT, Radio *pRD, Values *pCV)  // manages the load output and sends the load radio messsage to the remote switch
+// A switch to On decided while a settle window is open waits (staggered) until it ends, so that the inrush peaks of several loads never overlap
+// (after a measure fault, a watchdog reset or remote overrides); the switches to Off are never delayed.
+void Loads::activate(CountTime *pCT, Radio *pRD, Values *pCV, Breadcrumbs *pBC)  // manages the load output and sends the load radio messsage to the remote switch
                                                                // to activate/deactivate the loads which have changed (according to their flag)
                                                                // and also to periodically refresh their status (to cope with radio interferences which prevented receiving previous messages by the remote switches)
 {
@@ -182,33 +535,142 @@ void Loads::activate(CountTime *pCT, Radio *pRD, Values *pCV)  // manages the lo
 
   for( i=0; i < nLoads; i++)
   {
+    if( flag[i] && on[i] && pCV->settling() )                   // staggered: waits for the settle window of the previous switch to On
+    {
+      if( !waiting[i] ) staggered++;
+      waiting[i] = true;
+      continue;
+    }
+    waiting[i] = false;
+
     if( flag[i] || pCT->flagRefresh )
     {
       if( flag[i] ) print( i, pCT, pCV);
-      else          printRefr( i, pCT );
+      else          printRefr( i, pCT, pCV );
     
+      if( flag[i] && on[i] )                                    // the step of its consumption is measured after SATISFIED_PROBE_S seconds
+      {
+        switches[i]++;
+        probeBaseW[i] = - pCV->PcFilt;
+        probeSec[i] = SATISFIED_PROBE_S;
+        pCV->settle( settleMs[i] );                             // de-weights its inrush, and staggers the next switches to On
+      }
+      else if( flag[i] ) probeSec[i] = 0;
+      if( flag[i] ) satisfied[i] = stepSeen[i] = false;
       flag[i] = false;
+      pBC->load( i, on[i] );                                    // the status is kept through a watchdog reset
       
       if( gpioOut[i] != -1 )
         digitalWrite( gpioOut[i], on[i] ? HIGH : LOW );
       
       if( radioModel[i] != Radio::NO_RADIO )                    // only if there is a radio model assigned
+      {
+        pBC->radio( radioModel[i], channel[i], on[i] );
         pRD->send( radioModel[i], channel[i], on[i] );
+      }
     }
   }
 }
 
 void Loads::print( int iLoad, CountTime *pCT, Values *pCV )     // prints the change on load status which has been decided
 {
+  if( jsonMode )
+  {
+    printJson( iLoad, pCT, pCV, "change" );
+    return;
+  }
+
   snprintf_P(buffer,149,PSTR("%s Load \"%s\" set to %s \tPg_W:%d \tPc_W:%d \texcedent_W:%d \tmargin_W:%d \tcause: %s\n"),
                             pCT->hhmmss, name[iLoad], on[iLoad]?"On ":"Off", 
                             (int) round( pCV->PgFilt ), (int) round( pCV->PcFilt ),
-                            (int) round( pCV->PgFilt + pCV->PcFilt ), (int) round( pCV->Margin ), cause );
+                            (int) round( pCV->excedent(phase[iLoad]) ), (int) round( pCV->margin(phase[iLoad], node[iLoad]) ), cause );
   Serial.print(buffer);
 }
 
-void Loads::printRefr( int iLoad, CountTime *pCT )              // prints the refreshed load status
+void Loads::printRefr( int iLoad, CountTime *pCT, Values *pCV ) // prints the refreshed load status
 {
+  if( jsonMode )
+  {
+    printJson( iLoad, pCT, pCV, "refresh" );
+    return;
+  }
+
   snprintf_P(buffer,99,PSTR("%s Load \"%s\" refreshed (%s)\n"),pCT->hhmmss, name[iLoad], on[iLoad]?"On":"Off" );
   Serial.print(buffer);
 }
+
+void Loads::printDraw( int iLoad, CountTime *pCT, Values *pCV, const char *event )
+{
+  if( jsonMode )
+  {
+    printJson( iLoad, pCT, pCV, event );
+    return;
+  }
+
+  snprintf_P(buffer,149,PSTR("%s Load \"%s\" %s \tdraw_W:%d \tbaseline_W:%d \tPc_W:%d\n"),
+                            pCT->hhmmss, name[iLoad], satisfied[iLoad] ? "satisfied, its excedent is released" : "drawing again",
+                            (int) round( drawW[iLoad] ), (int) round( baseW ), (int) round( pCV->PcFilt ) );
+  Serial.print(buffer);
+}
+
+void Loads::printJson( int iLoad, CountTime *pCT, Values *pCV, const char *event )
+{
+  JsonWriter js(&Serial);
+
+  js.open();
+  js.add(PSTR("type"), "event");
+  js.add(PSTR("t"), pCT->hours * 3600L + pCT->minutes * 60L + pCT->seconds);
+  js.add(PSTR("event"), event);
+  js.add(PSTR("load"), name[iLoad]);
+  js.add(PSTR("index"), (long) iLoad);
+  js.addBool(PSTR("on"), on[iLoad]);
+  js.addBool(PSTR("solar"), solarMode[iLoad]);
+  if( event[0] == 'c' ) js.add(PSTR("cause"), cause);
+  js.add(PSTR("PgFilt"), (long) round( pCV->PgFilt ));
+  js.add(PSTR("PcFilt"), (long) round( pCV->PcFilt ));
+  js.add(PSTR("PnFilt"), (long) round( pCV->PnFilt ));
+  js.add(PSTR("Margin"), (long) round( pCV->Margin ));
+  js.close();
+}
+
+// The statistics since start (print with the command S) count the switches and the time On of every load, and the energies generated, exported and imported,
+// whose ratio gives the self-consumption, so that the reserves can be tuned on the days of the installation.
+// The statistics print the share of the time On of every load within its class, and the fairness of every class (Jain's index of their times On,
+// 100% when they are equal, 100/n % when a single load of n gets all of it).
+void Loads::printStats( CountTime *pCT )
+{
+  int i, c;
+
+  snprintf_P(buffer, 99, PSTR("%s Statistics since start \trotations: %u \tstaggered: %u"), pCT->hhmmss, rotations, staggered);
+  Serial.println(buffer);
+  for( i = 0; i < nLoads; i++ )
+  {
+    unsigned long classSec = 0UL;                   // time On of the loads of its class
+    for( c = 0; c < nLoads; c++ )
+      if( ( c == i ) || ( ( prioClass[i] != 0 ) && ( prioClass[c] == prioClass[i] ) ) ) classSec += onSec[c];
+    snprintf_P(buffer, 149, PSTR("  %-5s switches: %u \ton: %lu s \tclass: %d share: %d%% \tdraw: %dW%s \treserves on/off: %d/%dW import: %d%%"),
+                              name[i], switches[i], onSec[i], prioClass[i], (int) ( classSec ? ( 100UL * onSec[i] + classSec / 2 ) / classSec : 0 ),
+                              (int) round( drawW[i] ), satisfied[i] ? " satisfied" : "",
+                              onReserveW[i], offReserveW[i], importPct[i] );
+    Serial.println(buffer);
+  }
+  for( c = 1; c <= N_LOADS_MAX; c++ )               // fairness of every class, Jain's index of the times On of its loads
+  {
+    int n = 0;
+    float sum = 0.0, sumSq = 0.0;
+    for( i = 0; i < nLoads; i++ )
+    {
+      if( prioClass[i] != c ) continue;
+      n++;
+      sum += onSec[i];
+      sumSq += (float) onSec[i] * onSec[i];
+    }
+    if( n == 0 ) continue;
+    snprintf_P(buffer, 99, PSTR("  class %d: %d loads \tfairness: %d%%"), c, n, (int) round( sumSq > 0.0 ? 100.0 * sum * sum / ( n * sumSq ) : 100.0 ));
+    Serial.println(buffer);
+  }
+  int selfPct = ( generatedWh > 0.0 ) ? (int) round( 100.0 * ( generatedWh - exportedWh ) / generatedWh ) : 0;
+  snprintf_P(buffer, 99, PSTR("  generated: %ld Wh \texported: %ld Wh \timported: %ld Wh \tself-consumption: %d%%"),
+                            (long) round( generatedWh ), (long) round( exportedWh ), (long) round( importedWh ), selfPct );
+  Serial.println(buffer);
+}
@@ -0,0 +1,96 @@
+/*
+=====================================================================
+lowpower.h
+Low-activity profile from dusk to dawn: while there is no solar
+generation, one cycle per second is measured, only the overload
+checks are decided, and the display backlight is off
+=====================================================================
+*/
+
+/*
+NOTES:
+
+From dusk to dawn Pg is zero, so that no load can be switched On by the solar decisions, and there is nothing to follow at full rate:
+sampling every grid cycle, refreshing the display every second, and its backlight, only spend power.
+When the filtered generated power has been below NIGHT_PG_W for NIGHT_ENTER_S seconds, the night profile is entered:
+- one grid cycle is measured per second (the aggregation window of values.h lasts its cycles in seconds, the breaker model integrates the real time),
+  and between the measures the CPU sleeps in SLEEP_MODE_IDLE until the next interrupt (Timer0 every millisecond, serial reception)
+- the loads are decided only on the overload checks (margins of the sub-circuits, the phases and the total, and the lack of excedent)
+  and the remote overrides and manual loads: the solar activations and the avoidance of priority inversion are skipped (loads.h)
+- the display backlight is off, and the screen is refreshed every DISPLAY_DIMMED_S seconds (display.h)
+The full profile is restored at once when a cycle measures more than NIGHT_EXIT_PG_W of generation (dawn, or a cloud passing at dusk),
+when the consumption gets within NIGHT_MARGIN_FRACTION of its limit (so that the overloads are followed at full rate),
+on a measure fault, or when the button of the display is pressed.
+The time spent in each profile since start, and the changes of profile, are printed by print command '1'.
+*/
+
+const float NIGHT_PG_W = 10.0;          // filtered generated power below which there is no solar generation
+const int NIGHT_ENTER_S = 600;          // seconds without solar generation before entering the night profile
+const float NIGHT_EXIT_PG_W = 30.0;     // generated power of a cycle which restores the full profile
+const float NIGHT_MARGIN_FRACTION = 0.25;   // fraction of the maximum consumption: a smaller margin restores the full profile
+
+class LowPower
+{
+  public:
+    LowPower(void) {};
+    void begin(bool);                                                   // true if the night profile is allowed
+    void update(CountTime *, Values *, Health *, Loads *, Display *);   // every second, enters or leaves the night profile
+    bool measureDue(CountTime *pCT) { return( !night || pCT->flagOneSec ); }    // true if a cycle must be measured in this loop
+    void idle(void);                                                    // sleeps until the next interrupt
+    bool enabled = true;                                                // true if the night profile is allowed
+    bool night = false;                                                 // true while in the night profile
+    unsigned long fullS = 0UL;                                          // seconds spent in the full profile since start
+    unsigned long nightS = 0UL;                                         // seconds spent in the night profile since start
+    unsigned int nights = 0;                                            // times the night profile has been entered
+  private:
+    void enter(CountTime *, Loads *, Display *, bool, const char *);    // enters or leaves the night profile, with its cause
+    int quietS = 0;                                                     // seconds without solar generation
+};
+
+void LowPower::begin(bool enabled_arg)
+{
+  enabled = enabled_arg;
+}
+
+void LowPower::update(CountTime *pCT, Values *pCV, Health *pHM, Loads *pLD, Display *pDS)
+{
+  if( !pCT->flagOneSec ) return;
+
+  if( night ) nightS++;
+  else        fullS++;
+
+  float consumed = max( - pCV->Pc, - pCV->PcFilt );   // of the last cycle, or filtered
+  bool nearLimit = ( pCV->MaxConsumpt - consumed < NIGHT_MARGIN_FRACTION * pCV->MaxConsumpt ) || ( pCV->Margin < NIGHT_MARGIN_FRACTION * pCV->MaxConsumpt );
+
+  if( night )
+  {
+    if( pCV->Pg > NIGHT_EXIT_PG_W )  enter(pCT, pLD, pDS, false, PSTR("generation"));
+    else if( nearLimit )             enter(pCT, pLD, pDS, false, PSTR("margin"));
+    else if( pHM->faulty )           enter(pCT, pLD, pDS, false, PSTR("measure fault"));
+    else if( pDS->woken )            enter(pCT, pLD, pDS, false, PSTR("button"));
+    pDS->woken = false;
+    return;
+  }
+
+  bool quiet = enabled && ( pCV->PgFilt < NIGHT_PG_W ) && ( pCV->Pg < NIGHT_EXIT_PG_W ) && !nearLimit && !pHM->faulty;
+  quietS = quiet ? quietS + 1 : 0;
+  if( quietS >= NIGHT_ENTER_S ) enter(pCT, pLD, pDS, true, PSTR("no generation"));
+}
+
+void LowPower::enter(CountTime *pCT, Loads *pLD, Display *pDS, bool night_arg, const char *cause)
+{
+  night = night_arg;
+  quietS = 0;
+  if( night ) nights++;
+  pLD->overloadOnly = night;
+  pDS->dim(night);
+
+  snprintf_P(buffer, 99, PSTR("%s %S profile \tcause: %S"), pCT->hhmmss, night ? PSTR("Night") : PSTR("Full"), cause);
+  Serial.println(buffer);
+}
+
+void LowPower::idle(void)
+{
+  set_sleep_mode(SLEEP_MODE_IDLE);      // Timer0 and the serial ports keep running, and wake the CPU
+  sleep_mode();
+}
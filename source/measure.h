@@ -16,9 +16,83 @@ The values of grid frequency, samples per cycle and ADC prescaler must ensure
 that the resulting ADC conversion duration (samplingUs) is lower than the sampling period (samplingPeriodUs)
 The default values supplied in the program fulfill this requirement for an Arduino Mega 2560
 
-A complete grid cycle is measured but the phase at which the cycle sampling starts is not fixed
+A complete grid cycle is measured, starting at a positive zero crossing of the grid voltage of the first phase (see below)
 
 The getCycle method is blocking during one grid cycle period
+
+OVERSAMPLING OF THE CURRENTS:
+At low currents (dawn, dusk), Ig is only a few counts peak, so that the powers are quantized by the 10 bits of the ADC.
+Each sample of Ig and Ic can be the sum of OVERSAMPLE_FACTOR conversions (4 or 16), decimated by a right shift of 1 or 2 bits,
+which gains 1 or 2 bits of resolution, provided that the noise at the inputs is about 1 count (it acts as a dither).
+The conversions of Ig and Ic are interleaved around the single conversion of Vx (Ig Ic .. Vx .. Ic Ig), so that the average instant
+of both currents coincides with that of the voltage, and no phase error is added.
+All the channels are then stored with the extra bits (V0 and Vx are just shifted), so that the computations are not changed:
+resolution and saturation are those of the stored values.
+At begin(), the duration of a conversion is measured, and the factor is reduced if the conversions of a sample
+would exceed OVERSAMPLE_BUDGET of the sampling period (with prescaler = 32 and 40 samples/cycle at 50Hz, 4 conversions fit, 16 do not).
+
+DIRECT ADC DRIVER:
+analogRead() maps the pin to its channel, writes ADMUX and ADCSRB, starts the conversion and waits for it, every time (about 34.5us with prescaler = 32, see ADC_PRESCALER).
+Instead, at begin() the values of ADMUX and ADCSRB of every channel are precomputed, together with the sequence of the conversions of a sample
+(V0, then for every phase Ig Ic .. Vx .. Ic Ig, then the sub-circuits), so that every conversion:
+- starts the conversion of the channel already selected
+- one ADC clock later, once the sample and hold has captured it (the channel is locked from then on), selects the channel of the next conversion
+- waits for the end of the conversion and reads the result
+so that the multiplexer settles on the next channel while the current one is converted, and no pin mapping is paid.
+The last conversion of a sample selects the first one of the next sample.
+At begin(), the time of the conversions of a sample with analogRead() is measured as a reference, and printed with print command '1'
+next to the average time achieved by the direct driver (samplingUs).
+With ADC_DIRECT = false (boards with other ADC registers), analogRead() is used in the same sequence.
+
+ADC NOISE REDUCTION SLEEP:
+While the CPU runs (and Timer0, the I/O clock, the USARTs), its switching noise couples into the analog inputs, by a fraction of a count,
+which is most of the reading of Ig and Ic at low currents. With ADC_SLEEP = true (direct driver only), every conversion is done
+with the CPU asleep in SLEEP_MODE_ADC: entering the sleep starts the conversion, and its end wakes the CPU through the ADC interrupt.
+The next channel cannot be selected during the conversion then, so it is selected right after it (it settles before the next sleep).
+In this mode the I/O clock is stopped, so that Timer0 stops too, and micros() and millis() miss about ADC_SLEEP_CLOCKS ADC clocks
+per conversion (28us with prescaler = 32, about 11 ms per cycle with one phase oversampled). The measure keeps its own clock (nowUs), micros() plus the time asleep,
+for the sampling schedule, the zero crossings and the start of the cycles, and the time asleep is handed to CountTime every loop (takeSleptUs),
+which adds it to millis() and micros(), so that the sample schedule, the seconds and the timed tasks are kept exact.
+The USARTs are stopped too: a byte received over Serial or Serial1 (Modbus) while sampling may be corrupted, so that the mode is off by default.
+The serial command N measures the noise floor of every input (standard deviation of its samples, in ADC counts) awake and asleep,
+with the inputs grounded to V0 (currents transformers unplugged), in order to check the improvement on a given board before enabling it.
+
+EXTERNAL ADC:
+Instead of the ADC of the Mega, the samples can be captured by an external simultaneous-sampling ADC (see ads131.h),
+a backend derived from ExternalAdc which fills its wide buffers (long) with the Vx, Ig and Ic of a cycle, from a zero crossing of Vx.
+They are copied into the usual buffers as 12 bits counts (wideScale, V0 in the middle of the range), for the health checks, the headroom and the recorder,
+while values.h computes the RMS values and powers from the wide buffers themselves. Only a single phase without sub-circuits is measured then,
+and there is no synchronous averaging (the noise of the external ADC is far below a count of the Mega ADC).
+
+THREE-PHASE SUPPLIES:
+Up to PHASES_MAX phases (set in config.h) are measured, each with its grid voltage Vx, its consumed current Ic,
+and optionally its solar generated current Ig (the first phase always has one; the others only if an inverter feeds them).
+The channels are kept in a table, in the order V0, Vx1, Ig1, Ic1, Vx2, (Ig2), Ic2 ..; the arrays V0, Vx, Ig, Ic point to those of the first phase.
+All the phases share the reference V0, and every sample reads the phases one after the other, each one with its currents around its voltage,
+so that the phase error within a phase is the same as with a single phase.
+With 3 phases and an inverter on one of them, there are 8 conversions per sample (about 280us of the 500us sampling period),
+so that oversampling does not fit and is reduced to 1.
+The samples themselves (80 bytes per channel) are not kept for CHANNELS_MAX channels: the sketch declares their storage
+for the phases and sub-circuits it measures (N_PHASES, N_SUBCIRCUITS), 320 bytes for a single phase, and hands it to begin().
+
+ZERO-CROSS ALIGNMENT AND SYNCHRONOUS AVERAGING:
+Before sampling, Vx of the first phase is read continuously until it rises through V0 (the average of V0 in the previous cycle),
+after having been ZC_HYSTERESIS_COUNTS below it, so that sample i is always taken at the same phase of the grid cycle
+(within a conversion, about 0.6 degrees). This waits up to one cycle (10 ms on average) before every measured cycle.
+If no crossing is found within ZC_TIMEOUT_CYCLES (no grid voltage), the cycle is sampled anyway and counted as not aligned.
+The alignment is skipped while simulating, since the simulated sine waves start at phase 0.
+
+Since sample i has a fixed phase, it can be averaged over several consecutive cycles (setting average: 1, 4 or 16 cycles)
+before the RMS values and powers are computed: the noise which is not correlated with the grid (ADC noise, interferences)
+is divided by the square root of the number of cycles, which gives 1 (4 cycles) or 2 (16 cycles) more bits of resolution
+on the small currents. The averaged samples are stored with those extra bits, but at most 12 bits altogether with those of oversampling,
+since the computations overflow beyond it (see ADC_RESOLUTION_STEPS), and the number of cycles is reduced if the sums would overflow an int.
+A measure then lasts the averaged cycles, so that the aggregation window of values.h, and the decisions, are slower in proportion.
+
+SUB-CIRCUITS:
+Up to SUBCIRCUITS_MAX (set in config.h) extra current transformers measure the current of sub-circuits (Is1, Is2 ..),
+whose margins are checked besides those of the main supply (see values.h). Their channels follow those of the phases in the table,
+and each one is read alone (oversampled as the other currents), since only its RMS current is used.
 */
 
 
@@ -28,46 +102,454 @@ const long SAMPLES_PER_CYCLE = 40L;     // number of samples that are taken from
 
 // ADC configuration
 const int ADC_PRESCALER = 32;           // ADC prescaler value, for prescaler = 32 a conversion time of 34.5us is achieved
-const int ADC_RESOLUTION_STEPS = 1024;  // must coincide with the resoluciton of the ADC, maximum 4096 (12 bits) in order to avoid long int overflow during calculations
+const int ADC_RESOLUTION_STEPS = 1024;  // must coincide with the resoluciton of the ADC, maximum 4096 (12 bits, including the extra bits of oversampling) in order to avoid long int overflow during calculations
+const int OVERSAMPLE_FACTOR = 4;        // conversions of Ig and Ic per sample: 1 (no oversampling), 4 (1 extra bit) or 16 (2 extra bits)
+const float OVERSAMPLE_BUDGET = 0.8;    // maximum fraction of the sampling period spent in conversions
+const bool ADC_DIRECT = true;           // true: conversions by the registers of the ATmega2560 ADC (see DIRECT ADC DRIVER), false: analogRead()
+const bool ADC_SLEEP = false;           // true: every conversion with the CPU asleep in SLEEP_MODE_ADC, lower noise (see ADC NOISE REDUCTION SLEEP)
+const int ADC_SLEEP_CLOCKS = 14;        // ADC clocks with the CPU and Timer0 stopped for every conversion asleep (13.5 of the conversion, started on the next ADC clock)
+const int NOISE_CYCLES = 8;             // cycles sampled for every mode by the noise floor measure
+const int CONVERSIONS_MAX = 48;         // maximum number of conversions of a sample (size of the sequence), the oversampling is reduced to fit
+const int ZC_HYSTERESIS_COUNTS = 8;     // counts that Vx must be below V0 before a positive zero crossing is accepted (noise immunity)
+const float ZC_TIMEOUT_CYCLES = 1.5;    // grid cycles waited at most for a zero crossing, the cycle is sampled anyway afterwards
+const int AVERAGE_CYCLES_MAX = 16;      // maximum number of cycles of the synchronous averaging
+
+// channels: V0, the grid voltage and both currents of every phase, and the current of every sub-circuit (PHASES_MAX and SUBCIRCUITS_MAX are set in config.h)
+const int CHANNELS_MAX = 1 + 3 * PHASES_MAX + SUBCIRCUITS_MAX;   // with 3 phases and 4 sub-circuits, 14 of the 16 analog inputs of the Mega
+
+const int WIDE_CHANNELS = 3;            // channels of the wide buffers of an external ADC: Vx, Ig, Ic
+
+class ExternalAdc                       // backend of an external ADC, see ads131.h
+{
+  public:
+    virtual int capture(int, unsigned long) = 0;   // captures a cycle of samples from a zero crossing, 0 aligned, 1 no zero crossing, 2 no samples
+    long wide[WIDE_CHANNELS][SAMPLES_PER_CYCLE];   // samples of the last cycle captured: Vx, Ig, Ic, centred on 0
+    float wideScale = 1.0;                // counts of the usual buffers (12 bits) equivalent to a count of the wide buffers
+    volatile unsigned int frameUs = 0;    // duration of the reading of a sample
+};
+
+EMPTY_INTERRUPT(ADC_vect);              // the end of a conversion only wakes the CPU from SLEEP_MODE_ADC
 
 // REQUIRES PREVIOUS DECLARATION OF CLASS Simul
 
 class Measure
 {
   public:
+    enum ChannelType : uint8_t { CH_V0, CH_VX, CH_IG, CH_IC, CH_IS };   // kinds of channel
     Measure(void)  {};
-    void begin(int v0Gpio, int vxGpio, int igGpio, int icGpio);
+    void begin(int v0Gpio, const int *vxGpio, const int *igGpio, const int *icGpio, int nPhases_arg, const int *isGpio, int nSubcircuits_arg,
+               int (*samples_arg)[SAMPLES_PER_CYCLE], int nRows_arg);   // the storage of the samples, at least 4 rows: the channels that do not fit are not measured
     void setADCprescaler(int prescalerValue);
+    void beginExternal(ExternalAdc *);    // samples with an external ADC instead of the ADC of the Mega (a single phase without sub-circuits)
+    void setAverage(int);                 // sets the number of cycles of the synchronous averaging (1, 4 or 16), reduced if the sums would overflow
     void getCycle(class Simul *pSM);
+    void channelName(int, char *);        // writes the name of a channel (at least 4 characters): "Vx", "Ig", "Ic" for one phase, "Vx2", "Ic3".. for several, "Is1".. for the sub-circuits
+    int conversions(int);                 // conversions per sample for an oversampling factor
+    void noiseFloor(Simul *, bool, float *);   // standard deviation of the samples of every channel (ADC counts), awake or asleep
     int numSamples = SAMPLES_PER_CYCLE;
     float samplingPeriodUs = ( 1000000.0 / MAINS_FREQ_HZ ) / ( (float) SAMPLES_PER_CYCLE );
-    int resolution = ADC_RESOLUTION_STEPS;
-    int v0In;
-    int vxIn;
-    int igIn;
-    int icIn;
-    int V0[SAMPLES_PER_CYCLE];            // array of samples from the analog input corresponding to reference/offset
-    int Vx[SAMPLES_PER_CYCLE];            // array of samples from the analog input corresponding to the grid voltage
-    int Ig[SAMPLES_PER_CYCLE];            // array of samples from the analog input corresponding to the solar generation current
-    int Ic[SAMPLES_PER_CYCLE];            // array of samples from the analog input corresponding to the consumption current
-    int samplingUs[SAMPLES_PER_CYCLE];    // time that lasted the sampling and conversion of all four analog inputs
-                                          // With prescaler = 32 and 40 samples/grid cycle, this uses to be 150us 
+    int oversample = 1;                   // conversions of the currents per sample
+    int extraBits = 0;                    // bits of resolution gained by oversampling and averaging (stored values are shifted left by extraBits)
+    int ovsBits = 0;                      // bits of resolution gained by oversampling the currents
+    int average = 1;                      // cycles averaged synchronously into a measure
+    int avgBits = 0;                      // bits of resolution gained by the synchronous averaging
+    bool aligned = false;                 // true if the last measure started at a zero crossing of the grid voltage
+    unsigned long zcMisses = 0UL;         // cycles sampled without finding a zero crossing since start
+    bool adcSleep = false;                // true if the conversions are done with the CPU asleep (ADC noise reduction)
+    unsigned long takeSleptUs(void) { unsigned long us = sleptUs; sleptUs = 0UL; return( us ); }   // time asleep since the previous call, missed by micros() and millis()
+    ExternalAdc *pExt = NULL;             // external ADC, NULL if the ADC of the Mega is used
+    long *wide[CHANNELS_MAX];             // wide samples of every channel, NULL if the channel has none (with the ADC of the Mega, every channel)
+    int resolution = ADC_RESOLUTION_STEPS;// resolution of the stored values
+    int saturation = ADC_RESOLUTION_STEPS - 1;   // stored value when the ADC is saturated at its top
+    unsigned int conversionUs = 0;        // duration of one conversion, measured at begin()
+    unsigned int analogReadSampleUs = 0;  // duration of the conversions of a sample with analogRead(), measured at begin() as a reference
+    int nPhases = 1;                      // number of phases measured
+    int nSubcircuits = 0;                 // number of sub-circuits measured
+    int nChannels = 0;                    // number of channels in the table
+    int8_t chanIn[CHANNELS_MAX];          // analog input of each channel
+    uint8_t chanType[CHANNELS_MAX];       // kind of each channel, as ChannelType
+    uint8_t chanPhase[CHANNELS_MAX];      // phase of each channel (0 for V0), or sub-circuit (from 0) of the channels Is
+    int8_t vxCh[PHASES_MAX];              // channel of the grid voltage of each phase
+    int8_t igCh[PHASES_MAX];              // channel of the solar generated current of each phase (-1 if there is no inverter on the phase)
+    int8_t icCh[PHASES_MAX];              // channel of the consumed current of each phase
+    int8_t isCh[SUBCIRCUITS_MAX];         // channel of the current of each sub-circuit
+    int (*samples)[SAMPLES_PER_CYCLE];    // arrays of samples of every channel, in the order of the table (storage sized by the sketch)
+    int nRows = 0;                        // rows of the storage of the samples
+    int *V0;                              // samples of the reference/offset (channel 0)
+    int *Vx;                              // samples of the grid voltage of the first phase
+    int *Ig;                              // samples of the solar generation current of the first phase
+    int *Ic;                              // samples of the consumption current of the first phase
+    int samplingUs[SAMPLES_PER_CYCLE];    // time that lasted the sampling and conversion of all the analog inputs
+                                          // With prescaler = 32 and 40 samples/grid cycle, this uses to be 150us for one phase
                                           // so that there are 350us left until the 500us of samplig period (= 20000us / 40)
     unsigned long prevCycleStartUs = 0UL; // Time when the previous grid cycle sampling started
     unsigned long cycleStartUs = 0UL;     // Time when the current grid cycle sampling started 
     unsigned long cycleEndUs;             // Time when the current grid cycle samplig has finished
+  private:
+    void addChannel(int, ChannelType, int);   // adds a channel to the table
+    void sampleCycle(Simul *, bool);      // samples one grid cycle, storing or adding the values to those stored
+    void getExternal(void);               // captures a cycle with the external ADC
+    bool waitZeroCross(bool);             // waits for a positive zero crossing of Vx of the first phase, false if not found
+    void buildSequence(void);             // builds the sequence of the conversions of a sample, for the oversampling factor
+    void select(int);                     // selects the channel of the next conversion
+    int convert(int);                     // converts the channel selected, selecting the following one during the conversion
+    unsigned long nowUs(void) { return( micros() + sleptTotalUs ); }   // micros() plus the time asleep, the clock of the measure
+    unsigned long sleptTotalUs = 0UL;     // time asleep since start
+    unsigned long sleptUs = 0UL;          // time asleep not yet taken by CountTime
+    void put(int c, int i, int v) { samples[c][i] = ( accumulate ? samples[c][i] : 0 ) + v; }   // stores or adds a sample
+    bool accumulate = false;              // true while the cycles after the first one of an averaged measure are sampled
+    int v0Level = ADC_RESOLUTION_STEPS / 2;   // average of V0 in the previous cycle, in counts without extra bits
+    uint8_t admux[CHANNELS_MAX];          // value of ADMUX of every channel (reference AVcc and low bits of the channel)
+    uint8_t adcsrb[CHANNELS_MAX];         // value of the MUX5 bit of ADCSRB of every channel (channels 8 to 15)
+    uint8_t sequence[CONVERSIONS_MAX];    // channels of the conversions of a sample, in order
+    int nConversions = 0;                 // conversions of a sample
+    int selected = 0;                     // channel selected for the next conversion
 };
 
-void Measure::begin(int v0Gpio, int vxGpio, int igGpio, int icGpio)
+void Measure::begin(int v0Gpio, const int *vxGpio, const int *igGpio, const int *icGpio, int nPhases_arg, const int *isGpio, int nSubcircuits_arg,
+                    int (*samples_arg)[SAMPLES_PER_CYCLE], int nRows_arg)
 {
-  v0In = v0Gpio;
-  vxIn = vxGpio;
-  igIn = igGpio;
-  icIn = icGpio;
+  samples = samples_arg;
+  nRows = nRows_arg;
+  nPhases = constrain( nPhases_arg, 1, min( PHASES_MAX, ( nRows - 1 ) / 3 ) );
+  nSubcircuits = constrain( nSubcircuits_arg, 0, min( SUBCIRCUITS_MAX, nRows - 1 - 3 * nPhases ) );
+
+  nChannels = 0;
+  memset(wide, 0, sizeof(wide));
+  addChannel(v0Gpio, CH_V0, 0);
+  for( int p = 0; p < nPhases; p++ )
+  {
+    vxCh[p] = nChannels;
+    addChannel(vxGpio[p], CH_VX, p);
+    igCh[p] = -1;
+    if( ( igGpio[p] != -1 ) || ( p == 0 ) )   // the first phase has always a solar generation input
+    {
+      igCh[p] = nChannels;
+      addChannel(igGpio[p], CH_IG, p);
+    }
+    icCh[p] = nChannels;
+    addChannel(icGpio[p], CH_IC, p);
+  }
+  for( int k = 0; k < nSubcircuits; k++ )
+  {
+    isCh[k] = nChannels;
+    addChannel(isGpio[k], CH_IS, k);
+  }
+  V0 = samples[0];
+  Vx = samples[vxCh[0]];
+  Ig = samples[igCh[0]];
+  Ic = samples[icCh[0]];
 
   setADCprescaler(ADC_PRESCALER);
+
+  unsigned long startUs = micros();       // duration of a conversion with analogRead(), the reference
+  for( int i = 0; i < 8; i++ )
+    analogRead(v0Gpio);
+  unsigned int analogReadUs = ( micros() - startUs ) / 8;
+
+  conversionUs = analogReadUs;
+  if( ADC_DIRECT )                        // duration of a conversion with the direct driver
+  {
+    select(0);
+    startUs = micros();
+    for( int i = 0; i < 8; i++ )
+      convert(0);
+    conversionUs = ( micros() - startUs ) / 8;
+  }
+
+  for( oversample = OVERSAMPLE_FACTOR; oversample > 1; oversample /= 4 )   // largest factor within the budget and the size of the sequence
+    if( ( conversions(oversample) * (float) conversionUs <= OVERSAMPLE_BUDGET * samplingPeriodUs ) && ( conversions(oversample) <= CONVERSIONS_MAX ) ) break;
+  ovsBits = ( oversample == 16 ) ? 2 : ( ( oversample == 4 ) ? 1 : 0 );
+  setAverage(1);
+  buildSequence();
+  adcSleep = ADC_SLEEP && ADC_DIRECT;
+
+  analogReadSampleUs = nConversions * analogReadUs;   // the time achieved is the average of samplingUs
+
+  if( oversample != OVERSAMPLE_FACTOR )
+  {
+    snprintf_P(buffer, 149, PSTR("Measure: oversampling reduced to %d, %d conversions of %u us do not fit into the sampling period\n"),
+                              oversample, conversions(OVERSAMPLE_FACTOR), conversionUs);
+    Serial.print(buffer);
+  }
+}
+
+void Measure::beginExternal(ExternalAdc *pExt_arg)
+{
+  pExt = pExt_arg;
+  nPhases = 1;                            // the table keeps the channels V0, Vx, Ig, Ic of the first phase
+  nSubcircuits = 0;
+  nChannels = icCh[0] + 1;
+  oversample = 1;
+  ovsBits = 2;                            // the usual buffers get 12 bits counts
+  setAverage(1);
+  wide[vxCh[0]] = pExt->wide[0];
+  wide[igCh[0]] = pExt->wide[1];
+  wide[icCh[0]] = pExt->wide[2];
+}
+
+void Measure::setAverage(int average_arg)
+{
+  int requested = ( pExt == NULL ) ? average_arg : 1;   // no averaging with an external ADC
+
+  for( average = AVERAGE_CYCLES_MAX; average > 1; average /= 4 )     // largest of 16, 4, 1 not above the requested one, whose sums fit into an int
+    if( ( average <= requested ) && ( ( (long) ( ADC_RESOLUTION_STEPS - 1 ) << ovsBits ) * average <= 32767L ) ) break;
+  avgBits = min( ( average == 16 ) ? 2 : ( ( average == 4 ) ? 1 : 0 ), 2 - ovsBits );   // at most 12 bits altogether
+  extraBits = ovsBits + avgBits;
+  resolution = ADC_RESOLUTION_STEPS << extraBits;
+  saturation = ( ADC_RESOLUTION_STEPS - 1 ) << extraBits;
+
+  if( ( average != requested ) && ( requested > 1 ) )
+  {
+    snprintf_P(buffer, 149, PSTR("Measure: synchronous averaging reduced to %d cycles, the sums of %d cycles would overflow\n"), average, requested);
+    Serial.print(buffer);
+  }
+}
+
+void Measure::addChannel(int gpio, ChannelType type, int phase)
+{
+  int mux = ( gpio >= A0 ) ? gpio - A0 : gpio;   // channel of the ADC multiplexer
+
+  admux[nChannels] = bit(REFS0) | ( mux & 0x07 );
+  adcsrb[nChannels] = ( mux & 0x08 ) ? bit(MUX5) : 0;
+  chanIn[nChannels] = gpio;
+  chanType[nChannels] = type;
+  chanPhase[nChannels] = phase;
+  nChannels++;
+}
+
+void Measure::buildSequence(void)
+{
+  int p, k;
+
+  nConversions = 0;
+  #define MEASURE_ADD(c) sequence[nConversions++] = (c)
+  MEASURE_ADD(0);
+  for( p = 0; p < nPhases; p++ )
+  {
+    int v = vxCh[p], g = igCh[p], c = icCh[p];
+    if( oversample == 1 )                 // the grid voltage is read between both currents, in order to minimize phase delay between voltage and current
+    {
+      if( g != -1 ) MEASURE_ADD(g);
+      MEASURE_ADD(v);
+      MEASURE_ADD(c);
+      continue;
+    }
+    for( k = 0; k < oversample / 2; k++ ) // first half of the conversions of the currents: Ig Ic Ig Ic .. (or Ic Ic .. if there is no Ig on this phase)
+    {
+      if( g != -1 ) MEASURE_ADD(g);
+      MEASURE_ADD(c);
+    }
+    MEASURE_ADD(v);                       // the grid voltage is read in the middle of the conversions of both currents
+    for( k = 0; k < oversample / 2; k++ ) // second half, reversed: Ic Ig Ic Ig .., so that both currents are centred on Vx
+    {
+      MEASURE_ADD(c);
+      if( g != -1 ) MEASURE_ADD(g);
+    }
+  }
+  for( p = 0; p < nSubcircuits; p++ )
+    for( k = 0; k < oversample; k++ )
+      MEASURE_ADD(isCh[p]);
+  #undef MEASURE_ADD
+}
+
+void Measure::select(int c)
+{
+  selected = c;
+  if( !ADC_DIRECT ) return;
+  ADCSRB = ( ADCSRB & ~bit(MUX5) ) | adcsrb[c];
+  ADMUX = admux[c];
+}
+
+int Measure::convert(int next)
+{
+  if( !ADC_DIRECT )
+  {
+    int value = analogRead(chanIn[selected]);
+    selected = next;
+    return( value );
+  }
+
+  if( adcSleep )
+  {
+    ADCSRA |= bit(ADIE);
+    set_sleep_mode(SLEEP_MODE_ADC);
+    sleep_enable();
+    do sleep_cpu();                     // entering the sleep starts the conversion of the channel selected
+    while( ADCSRA & bit(ADSC) );        // another interrupt may wake the CPU before the end of the conversion
+    sleep_disable();
+    ADCSRA &= ~bit(ADIE);
+    sleptTotalUs += ADC_SLEEP_CLOCKS * ADC_PRESCALER / 16;   // Timer0 was stopped meanwhile
+    sleptUs += ADC_SLEEP_CLOCKS * ADC_PRESCALER / 16;
+    int value = ADC;
+    select(next);                       // the next channel settles before the next sleep
+    return( value );
+  }
+
+  ADCSRA |= bit(ADSC);                  // starts the conversion of the channel selected
+  delayMicroseconds( ADC_PRESCALER / 16 + 1 );   // one ADC clock: the sample and hold has captured the input, the channel is locked
+  ADCSRB = ( ADCSRB & ~bit(MUX5) ) | adcsrb[next];   // selects the next channel while this one is converted
+  ADMUX = admux[next];
+  selected = next;
+  while( ADCSRA & bit(ADSC) );          // waits for the end of the conversion
+  return( ADC );
 }
 
+int Measure::conversions(int factor)
+{
+  return( 1 + nPhases + factor * ( nChannels - 1 - nPhases ) );   // V0, the voltages, and the currents oversampled
+}
+
+void Measure::channelName(int c, char *name)
+{
+  static const char typeNames[5][3] = { "V0", "Vx", "Ig", "Ic", "Is" };
+
+  if( ( chanType[c] != CH_IS ) && ( ( nPhases == 1 ) || ( c == 0 ) ) ) strcpy(name, typeNames[chanType[c]]);
+  else                                 snprintf_P(name, 4, PSTR("%s%d"), typeNames[chanType[c]], chanPhase[c] + 1);
+}
+
+
+void Measure::getCycle(Simul *pSM)    // From a zero crossing, reads and stores the values of the analog inputs at each sampling period, averaged over the cycles set. Blocking method
+{
+  int c, i;
+  long sum = 0L;
+
+  prevCycleStartUs = cycleStartUs;
+  if( ( pExt != NULL ) && ( pSM->mode != Simul::SIMUL_ANALOG ) )
+  {
+    getExternal();
+    return;
+  }
+  aligned = ( pSM->mode == Simul::SIMUL_ANALOG ) || waitZeroCross(false);   // the simulated sine waves start at phase 0
+  cycleStartUs = nowUs();
+
+  sampleCycle(pSM, false);
+  for( int k = 1; k < average; k++ )    // the following cycles start right after the previous one, at the next zero crossing
+  {
+    if( pSM->mode != Simul::SIMUL_ANALOG ) aligned &= waitZeroCross(true);
+    sampleCycle(pSM, true);
+  }
+
+  if( average > 1 )                     // the sums of the cycles divided by their number, keeping avgBits more bits
+  {
+    int shift = ( ( average == 16 ) ? 4 : 2 ) - avgBits;
+    for( c = 0; c < nChannels; c++ )
+      for( i = 0; i < numSamples; i++ )
+        samples[c][i] >>= shift;
+  }
+
+  for( i = 0; i < numSamples; i++ )
+    sum += V0[i];
+  v0Level = ( sum / numSamples ) >> extraBits;
+  cycleEndUs = nowUs();
+}
+
+void Measure::getExternal(void)
+{
+  int c, i;
+
+  cycleStartUs = nowUs();
+  int result = pExt->capture(numSamples, ZC_TIMEOUT_CYCLES * 1.0e6 / MAINS_FREQ_HZ);
+  aligned = ( result == 0 );
+  if( !aligned ) zcMisses++;
+
+  for( i = 0; i < numSamples; i++ )     // 12 bits counts equivalent to those of the Mega ADC
+  {
+    V0[i] = resolution / 2;
+    for( c = 1; c < nChannels; c++ )
+      samples[c][i] = constrain( resolution / 2 + (long) ( wide[c][i] * pExt->wideScale ), 0L, (long) saturation );
+    samplingUs[i] = pExt->frameUs;
+  }
+  cycleEndUs = nowUs();
+}
+
+void Measure::noiseFloor(Simul *pSM, bool asleep, float *rms)
+{
+  bool adcSleepKept = adcSleep;
+  float sumSq[CHANNELS_MAX];
+  int c, i;
+
+  adcSleep = asleep && ADC_DIRECT;
+  memset(sumSq, 0, sizeof(sumSq));
+  for( int k = 0; k < NOISE_CYCLES; k++ )
+  {
+    sampleCycle(pSM, false);
+    for( c = 0; c < nChannels; c++ )    // deviations from the mean of the cycle
+    {
+      long sum = 0L, sq = 0L;
+      for( i = 0; i < numSamples; i++ )
+        sum += samples[c][i];
+      int mean = sum / numSamples;
+      for( i = 0; i < numSamples; i++ )
+        sq += (long) ( samples[c][i] - mean ) * ( samples[c][i] - mean );
+      sumSq[c] += sq;
+    }
+  }
+  for( c = 0; c < nChannels; c++ )      // in counts of the ADC, without the extra bits of oversampling
+    rms[c] = sqrt( sumSq[c] / ( NOISE_CYCLES * numSamples ) ) / ( 1 << ovsBits );
+  adcSleep = adcSleepKept;
+}
+
+bool Measure::waitZeroCross(bool continuing)
+{
+  unsigned long startUs = nowUs();
+  unsigned long timeoutUs = ZC_TIMEOUT_CYCLES * 1.0e6 / MAINS_FREQ_HZ;
+  bool below = continuing;              // a following cycle starts just before the crossing which ends the previous one
+
+  select(vxCh[0]);
+  while( nowUs() - startUs < timeoutUs )
+  {
+    int v = convert(vxCh[0]);
+    if( v < v0Level - ZC_HYSTERESIS_COUNTS ) below = true;
+    else if( below && ( v >= v0Level ) )  return(true);
+  }
+  zcMisses++;
+  return(false);
+}
+
+void Measure::sampleCycle(Simul *pSM, bool accumulate_arg)
+{
+  accumulate = accumulate_arg;
+  select(sequence[0]);
+  unsigned long prevUs = nowUs();
+
+  unsigned long samplingStartUs;
+  int p, v, g, c;
+  for(int i=0; i<numSamples; i++)
+  {
+    samplingStartUs = nowUs();
+
+    if(pSM->mode == Simul::SIMUL_ANALOG)   // simulation of sine wave at analog inputs, the phases shifted by 1/nPhases of cycle
+    {
+      put(0, i, ( (int) pSM->ValV0 ) << ovsBits);    // simulated values are in ADC counts, without the extra bits
+      for( p = 0; p < nPhases; p++ )
+      {
+        int shift = p * numSamples / nPhases;
+        v = vxCh[p];  g = igCh[p];  c = icCh[p];
+        put(v, i, constrain( pSM->ValV0  + (int) ((pSM->AmplVx) * pSM->sine1000[ (i+shift             ) % numSamples ] / 1000L), 0, ADC_RESOLUTION_STEPS - 1) << ovsBits);
+        put(c, i, constrain( pSM->ValV0  + (int) ((pSM->AmplIc) * pSM->sine1000[ (i+shift+pSM->ShiftIc) % numSamples ] / 1000L), 0, ADC_RESOLUTION_STEPS - 1) << ovsBits);
+        if( g != -1 )
+          put(g, i, constrain( pSM->ValV0  + (int) ((pSM->AmplIg) * pSM->sine1000[ (i+shift+pSM->ShiftIg) % numSamples ] / 1000L), 0, ADC_RESOLUTION_STEPS - 1) << ovsBits);
+      }
+      for( p = 0; p < nSubcircuits; p++ )     // the sub-circuits carry the consumed current of the first phase
+        samples[isCh[p]][i] = samples[icCh[0]][i];
+    }
+    else                                  // reading the actual analog inputs, in the order of the sequence
+    {
+      int sum[CHANNELS_MAX];
+      memset(sum, 0, sizeof(sum));
+      for( int k = 0; k < nConversions; k++ )
+        sum[ sequence[k] ] += convert( sequence[ ( k + 1 ) % nConversions ] );   // selects the next channel during the conversion
+      for( c = 0; c < nChannels; c++ )    // the voltages are converted once and shifted, the sums of the 4^n conversions of the currents
+        put(c, i, ( chanType[c] <= CH_VX ) ? sum[c] << ovsBits : sum[c] >> ovsBits);   // shifted right by n bits have n extra bits (decimation)
+    }
+     
+    samplingUs[i]=(int)(nowUs()-samplingStartUs);
+        
+    while( nowUs() - prevUs < ((unsigned long) samplingPeriodUs) );  // waiting for the next sampling period
+    prevUs += ((unsigned long) samplingPeriodUs); 
+  }
+}
 
 void Measure::setADCprescaler(int prescalerValue) 
 {
@@ -102,39 +584,3 @@ void Measure::setADCprescaler(int prescalerValue)
       return(-1);  
   }
 }
-
-void Measure::getCycle(Simul *pSM)    // During one grid cycle reads and stores the values of the analog inputs at each sampling period. Blocking method during one grid cycle
-{
-  prevCycleStartUs = cycleStartUs;    
-  cycleStartUs = micros();        
-
-  unsigned long prevUs = micros();
-
-  unsigned long samplingStartUs;
-  for(int i=0; i<numSamples; i++)
-  {
-    samplingStartUs = micros();
-
-    if(pSM->mode == Simul::SIMUL_ANALOG)   // simulation of sine wave at analog inputs
-    {
-      V0[i] = (int) pSM->ValV0;
-      Ig[i] = constrain( pSM->ValV0  + (int) ((pSM->AmplIg) * pSM->sine1000[ (i+pSM->ShiftIg) % numSamples ] / 1000L), 0, resolution);
-      Vx[i] = constrain( pSM->ValV0  + (int) ((pSM->AmplVx) * pSM->sine1000[ (i+0           ) % numSamples ] / 1000L), 0, resolution);
-      Ic[i] = constrain( pSM->ValV0  + (int) ((pSM->AmplIc) * pSM->sine1000[ (i+pSM->ShiftIc) % numSamples ] / 1000L), 0, resolution);
-    }
-    else                                  // reading the actual analog inpunts
-    {
-      V0[i]=analogRead(v0In);
-      Ig[i]=analogRead(igIn);
-      Vx[i]=analogRead(vxIn);              // the grid voltage is read between both currents, in order to minimize phase delay between voltage and current
-      Ic[i]=analogRead(icIn);
-    }
-     
-    samplingUs[i]=(int)(micros()-samplingStartUs);
-        
-    while( micros() - prevUs < ((unsigned long) samplingPeriodUs) );  // waiting for the next sampling period
-    prevUs += ((unsigned long) samplingPeriodUs); 
-  }
-  cycleEndUs = micros();
-  return(0);
-}
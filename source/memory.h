@@ -0,0 +1,87 @@
+/*
+==============================================================
+memory.h
+Measures the RAM use at runtime: free RAM, peak stack depth,
+heap use, and the largest fill of the shared text buffer
+==============================================================
+*/
+
+/*
+NOTES:
+
+The AVR RAM is organized as: static data (.data, .bss), then the heap growing upwards, then free RAM, then the stack growing downwards from RAMEND.
+
+At boot (begin), the free RAM between the top of the heap and the current stack pointer is painted with STACK_PAINT,
+and so is the shared text buffer.
+Later, the periodical scan looks for the lowest byte of free RAM which is no longer painted:
+it has been reached by the stack (or by the heap), so that the peak stack depth is known
+without any instrumentation of the functions.
+In the same way, the last byte of the shared buffer which is no longer painted gives its largest fill.
+
+The scan of free RAM lasts about 2 ms, so it is performed only every MEMORY_SCAN_PERIOD_S seconds.
+*/
+
+const uint8_t STACK_PAINT = 0xC5;       // value painted on the free RAM at boot
+const int STACK_PAINT_GUARD = 64;       // bytes below the stack pointer which are not painted (used by the painting function itself)
+const int MEMORY_SCAN_PERIOD_S = 10;    // time in seconds between successive scans
+
+extern char __heap_start;               // start of the heap (end of static data), set by the linker
+extern char *__brkval;                  // top of the heap, set by malloc (0 if nothing allocated yet)
+
+class Memory
+{
+  public:
+    Memory(void) {};
+    void begin(char *, int);            // paints the free RAM and the shared buffer
+    void update(CountTime *);           // scans the memory periodically
+    void scan(void);                    // scans the memory and updates the statistics
+    int freeRam = 0;                    // bytes between the top of the heap and the stack pointer, now
+    int unusedRam = 0;                  // bytes between the top of the heap and the deepest stack reached (never used so far)
+    int stackPeak = 0;                  // deepest stack reached so far, in bytes
+    int heapUsed = 0;                   // bytes of heap, now
+    int heapPeak = 0;                   // largest heap so far, in bytes
+    int bufferPeak = 0;                 // largest number of bytes written in the shared buffer (including the string terminator)
+    int bufferSize = 0;                 // size of the shared buffer
+  private:
+    char *heapTop(void) { return( __brkval ? __brkval : &__heap_start ); }
+    char *pBuffer;                      // shared buffer
+};
+
+void Memory::begin(char *buffer_arg, int bufferSize_arg)
+{
+  char *p;
+  char *stackPointer = (char *) SP;
+
+  pBuffer = buffer_arg;
+  bufferSize = bufferSize_arg;
+  memset(pBuffer, STACK_PAINT, bufferSize);
+
+  for( p = heapTop(); p < stackPointer - STACK_PAINT_GUARD; p++ )
+    *p = STACK_PAINT;
+
+  scan();
+}
+
+void Memory::update(CountTime *pCT)
+{
+  if( pCT->flagOneSec && ( pCT->seconds % MEMORY_SCAN_PERIOD_S == 0 ) )
+    scan();
+}
+
+void Memory::scan(void)
+{
+  char *p;
+  char *top = heapTop();
+  char *stackPointer = (char *) SP;
+
+  heapUsed = top - &__heap_start;
+  heapPeak = max(heapPeak, heapUsed);
+  freeRam = stackPointer - top;
+
+  for( p = top; ( p < stackPointer ) && ( (uint8_t) *p == STACK_PAINT ); p++ );   // lowest byte reached by the stack
+  unusedRam = p - top;
+  stackPeak = max( stackPeak, (int) ( (char *) RAMEND - p ) + 1 );
+
+  for( p = pBuffer + bufferSize - 1; ( p >= pBuffer ) && ( (uint8_t) *p == STACK_PAINT ); p-- );   // last byte written in the buffer
+  bufferPeak = ( p - pBuffer ) + 1;
+}
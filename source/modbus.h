@@ -0,0 +1,357 @@
+/*
+==================================================================
+modbus.h
+Modbus RTU slave on a spare serial port, so that a building
+controller can poll the measures, the powers and the loads status
+and can override the activation of the loads
+==================================================================
+*/
+
+/*
+NOTES:
+
+The slave is polled once every loop() cycle, which lasts 20 ms or more.
+Since received characters wait in the serial buffer meanwhile, the end of a frame is not detected by the 3.5 characters silence,
+but by its expected length (according to its function code) and its CRC. On a shared RS485 bus the slave also receives the requests
+of the master to the other slaves and their replies: a frame addressed to another slave may have the length of a request or of a reply,
+and whichever ends with a right CRC is taken (and ignored). When no length fits, the first byte is dropped and the rest is scanned again,
+so that the next frame is found without waiting for a silence. Incomplete frames are discarded after MODBUS_TIMEOUT_MS without new characters.
+Requests are limited to MODBUS_FRAME_MAX bytes, so that the answer always fits in the frame buffer.
+
+Supported functions:
+  01 read coils, 02 read discrete inputs, 03 read holding registers, 04 read input registers,
+  05 write single coil, 15 write multiple coils
+Exceptions: 01 illegal function, 02 illegal data address, 03 illegal data value
+Broadcast requests (address 0) are executed only if they are writes, and never answered.
+
+REGISTER MAP (input registers, also readable as holding registers, signed 16 bits):
+   0  VxEff   grid RMS voltage              x10  V
+   1  IgEff   generated RMS current         x100 A
+   2  IcEff   consumed RMS current          x100 A
+   3  Pg      generated power                    W
+   4  Pc      consumed power (negative)          W
+   5  Pn      net power (negative if imported)   W
+   6  PFg     generated power factor        x100
+   7  PFc     consumed power factor         x100
+   8  PgFilt  filtered generated power           W
+   9  PcFilt  filtered consumed power            W
+  10  PnFilt  filtered net power (excedent)      W
+  11  Margin  consumption margin                 W
+  12  MaxConsumpt  maximum allowed consumption   W
+  13  hours of uptime
+  14  minutes of uptime
+  15  seconds of uptime
+  16  simulation mode (0 none, 1 analog inputs, 2 powers)
+  17  number of loads
+  18  measure fault (0 none, 1 V0 out of band, 2 ADC saturation, 3 stuck channel, 4 RMS out of range)
+  19  channel of the measure fault (with a single phase: 0 V0, 1 Vx, 2 Ig, 3 Ic, see measure.h)
+  20 + 8*n  load n: on (0/1)
+  21 + 8*n  load n: solar mode (0 manual, 1 solar)
+  22 + 8*n  load n: remaining lock time       s
+  23 + 8*n  load n: nominal power             W
+  24 + 8*n  load n: override (0 none, 1 forced Off, 2 forced On)
+  25 + 8*n  load n: phase (1 to 3)
+  26 + 8*n  load n: sub-circuit (0 main supply)
+  P = 20 + 8*N_LOADS_MAX (68 with 6 loads), for every phase p (from 0, 0 if the phase is not measured):
+  P + 6*p  phase p: VxEff   RMS voltage       x10  V
+  P+1+6*p  phase p: IcEff   consumed current  x100 A
+  P+2+6*p  phase p: PgFilt  filtered generated power  W
+  P+3+6*p  phase p: PcFilt  filtered consumed power   W
+  P+4+6*p  phase p: PnFilt  filtered net power        W
+  P+5+6*p  phase p: Margin  consumption margin of the phase  W
+
+COILS (read / write):
+   0 + n  load n: override enabled (1 = the load follows coil 16+n instead of the automatic decisions)
+  16 + n  load n: commanded state when overridden (1 = On, 0 = Off)
+
+DISCRETE INPUTS (read only):
+   0 + n  load n: on
+  16 + n  load n: solar mode
+
+Overridden loads are still switched off when there is no consumption margin,
+and forced On only when there is enough margin for their nominal power.
+*/
+
+const long MODBUS_BAUD = 19200L;              // baud rate of the Modbus serial port
+const uint8_t MODBUS_ADDRESS = 1;             // address of this slave
+const int MODBUS_FRAME_MAX = 64;              // maximum length of a frame (requests and answers)
+const unsigned long MODBUS_TIMEOUT_MS = 100UL;// an incomplete frame is discarded after this time without new characters
+const int MODBUS_PHASE_REGS = 20 + 8 * N_LOADS_MAX;      // first register of the phases
+const int MODBUS_REGS = MODBUS_PHASE_REGS + 6 * PHASES_MAX; // number of input registers
+const int MODBUS_BITS = 16 + N_LOADS_MAX;     // number of coils and of discrete inputs
+
+class Modbus
+{
+  public:
+    Modbus(void) {};
+    void begin(HardwareSerial *, long, uint8_t, int);           // set-up of the serial port, the address and the RS485 driver enable output (-1 if none)
+    void poll(CountTime *, Simul *, Values *, Loads *, Health *);   // receives and answers the requests, non-blocking
+    unsigned long nRequests = 0UL;                              // requests answered
+    unsigned long nErrors = 0UL;                                // frames discarded (wrong CRC or timeout) and exceptions answered
+  private:
+    void scan(CountTime *, Simul *, Values *, Loads *, Health *);   // finds a complete frame at the start of the received bytes, or drops the first byte
+    int frameLength(bool);                                      // expected length of the frame being received, as a request (false) or a reply (true), 0 if still unknown
+    void process(CountTime *, Simul *, Values *, Loads *, Health *);   // executes a complete request and answers it
+    int readRegister(int, CountTime *, Simul *, Values *, Loads *, Health *);   // value of an input register
+    bool readBit(bool, int, Loads *);                           // value of a coil (true) or a discrete input (false)
+    bool writeCoil(int, bool, Loads *);                         // writes a coil, false if it does not exist
+    void answer(int);                                           // sends the answer in the frame, with its CRC
+    void exception(uint8_t);                                    // sends an exception answer
+    uint16_t crc(int);                                          // CRC of the first bytes of the frame
+    HardwareSerial *port;                                       // serial port
+    uint8_t address;                                            // slave address
+    int deGpio;                                                 // RS485 driver enable output, -1 if none
+    uint8_t frame[MODBUS_FRAME_MAX];                            // received request and answer
+    int len = 0;                                                // received bytes of the request
+    bool resync = false;                                        // true while bytes are dropped to find the start of the next frame
+    unsigned long lastRxMs = 0UL;                               // when the last byte was received
+};
+
+void Modbus::begin(HardwareSerial *port_arg, long baud, uint8_t address_arg, int deGpio_arg)
+{
+  port = port_arg;
+  address = address_arg;
+  deGpio = deGpio_arg;
+
+  port->begin(baud);
+  if( deGpio != -1 )
+  {
+    pinMode(deGpio, OUTPUT);
+    digitalWrite(deGpio, LOW);                // receiving
+  }
+}
+
+void Modbus::poll(CountTime *pCT, Simul *pSM, Values *pCV, Loads *pLD, Health *pHM)
+{
+  int c;
+
+  while( ( c = port->read() ) >= 0 )
+  {
+    lastRxMs = millis();
+    if( len >= MODBUS_FRAME_MAX ) continue;     // never reached, scan() drops the bytes of frames too long
+    frame[len++] = c;
+    scan(pCT, pSM, pCV, pLD, pHM);
+  }
+
+  if( ( len > 0 ) && ( millis() - lastRxMs > MODBUS_TIMEOUT_MS ) )   // incomplete frame
+  {
+    nErrors++;
+    len = 0;
+    resync = false;
+  }
+}
+
+void Modbus::scan(CountTime *pCT, Simul *pSM, Values *pCV, Loads *pLD, Health *pHM)
+{
+  while( len >= 2 )
+  {
+    bool other = ( frame[0] != address ) && ( frame[0] != 0 );   // another slave: a request of the master, or its reply
+    int request = frameLength(false);
+    int reply = other ? frameLength(true) : 0;
+
+    if( ( request == 0 ) || ( other && ( reply == 0 ) ) ) return;  // length still unknown
+    if( ( ( len == request ) || ( len == reply ) ) && ( crc(len - 2) == ( frame[len-2] | ( frame[len-1] << 8 ) ) ) )
+    {
+      process(pCT, pSM, pCV, pLD, pHM);         // the frames of the other slaves are ignored
+      len = 0;
+      resync = false;
+      return;
+    }
+    if( ( ( len < request ) && ( request <= MODBUS_FRAME_MAX ) ) || ( ( len < reply ) && ( reply <= MODBUS_FRAME_MAX ) ) ) return;   // still incomplete
+
+    if( !resync ) nErrors++;                    // wrong CRC, or not the start of a frame: the first byte is dropped
+    resync = true;
+    len--;
+    memmove(frame, frame + 1, len);
+  }
+}
+
+int Modbus::frameLength(bool reply)
+{
+  if( len < 2 ) return(0);
+  uint8_t fc = frame[1];                        // function code
+
+  if( reply )
+  {
+    if( fc & 0x80 ) return(5);                  // exception: address, function, code, CRC
+    if( fc <= 4 ) return( ( len < 3 ) ? 0 : 5 + frame[2] );   // reads: address, function, byte count, data, CRC
+    return(8);                                  // writes: echo of the request, or of its start and quantity
+  }
+  if( ( fc == 15 ) || ( fc == 16 ) )
+    return( ( len < 7 ) ? 0 : 9 + frame[6] );   // address, function, start, quantity, byte count, data, CRC
+  return(8);                                    // address, function, start, quantity or value, CRC (also assumed for unsupported functions)
+}
+
+void Modbus::process(CountTime *pCT, Simul *pSM, Values *pCV, Loads *pLD, Health *pHM)
+{
+  uint8_t fc = frame[1];
+  unsigned int start = ( frame[2] << 8 ) | frame[3];
+  unsigned int qty = ( frame[4] << 8 ) | frame[5];
+  bool broadcast = ( frame[0] == 0 );
+  unsigned int i;
+  int n;
+
+  if( ( frame[0] != address ) && !broadcast ) return;         // request for another slave
+  if( broadcast && ( fc != 5 ) && ( fc != 15 ) ) return;      // only writes are accepted as broadcast
+
+  switch( fc )
+  {
+    case 3:                                                   // read holding registers
+    case 4:                                                   // read input registers
+      if( ( qty < 1 ) || ( qty > ( MODBUS_FRAME_MAX - 5 ) / 2 ) )  { exception(3); return; }
+      if( (long) start + qty > MODBUS_REGS )                              { exception(2); return; }
+      frame[2] = 2 * qty;
+      for( i = 0; i < qty; i++ )
+      {
+        int value = readRegister(start + i, pCT, pSM, pCV, pLD, pHM);
+        frame[3 + 2*i] = highByte(value);
+        frame[4 + 2*i] = lowByte(value);
+      }
+      answer(3 + 2 * qty);
+      return;
+
+    case 1:                                                   // read coils
+    case 2:                                                   // read discrete inputs
+      if( ( qty < 1 ) || ( qty > 8 * ( MODBUS_FRAME_MAX - 5 ) ) ) { exception(3); return; }
+      if( (long) start + qty > MODBUS_BITS )                             { exception(2); return; }
+      n = ( qty + 7 ) / 8;
+      frame[2] = n;
+      memset(frame + 3, 0, n);
+      for( i = 0; i < qty; i++ )
+        if( readBit( fc == 1, start + i, pLD ) ) frame[3 + i/8] |= ( 1 << (i%8) );
+      answer(3 + n);
+      return;
+
+    case 5:                                                   // write single coil, the answer is the request echo
+      if( ( qty != 0xFF00 ) && ( qty != 0x0000 ) ) { exception(3); return; }
+      if( !writeCoil(start, qty == 0xFF00, pLD) ) { exception(2); return; }
+      if( !broadcast ) answer(6);
+      return;
+
+    case 15:                                                  // write multiple coils, the answer is the start and quantity
+      if( ( qty < 1 ) || ( frame[6] != ( qty + 7 ) / 8 ) ) { exception(3); return; }
+      if( (long) start + qty > MODBUS_BITS )                      { exception(2); return; }
+      for( i = 0; i < qty; i++ )
+        if( !writeCoil(start + i, frame[7 + i/8] & ( 1 << (i%8) ), pLD) ) { exception(2); return; }
+      if( !broadcast ) answer(6);
+      return;
+
+    default:
+      exception(1);
+      return;
+  }
+}
+
+int Modbus::readRegister(int reg, CountTime *pCT, Simul *pSM, Values *pCV, Loads *pLD, Health *pHM)
+{
+  switch( reg )
+  {
+    case  0: return( round( 10.0 * pCV->VxEff ) );
+    case  1: return( round( 100.0 * pCV->IgEff ) );
+    case  2: return( round( 100.0 * pCV->IcEff ) );
+    case  3: return( round( pCV->Pg ) );
+    case  4: return( round( pCV->Pc ) );
+    case  5: return( round( pCV->Pn ) );
+    case  6: return( round( 100.0 * pCV->PFg ) );
+    case  7: return( round( 100.0 * pCV->PFc ) );
+    case  8: return( round( pCV->PgFilt ) );
+    case  9: return( round( pCV->PcFilt ) );
+    case 10: return( round( pCV->PnFilt ) );
+    case 11: return( round( constrain( pCV->Margin, -32000.0, 32000.0 ) ) );
+    case 12: return( round( pCV->MaxConsumpt ) );
+    case 13: return( pCT->hours );
+    case 14: return( pCT->minutes );
+    case 15: return( pCT->seconds );
+    case 16: return( pSM->mode );
+    case 17: return( pLD->nLoads );
+    case 18: return( pHM->faulty ? pHM->fault : 0 );
+    case 19: return( pHM->faulty ? pHM->channel : 0 );
+  }
+
+  if( reg >= MODBUS_PHASE_REGS )
+  {
+    int p = ( reg - MODBUS_PHASE_REGS ) / 6;
+    if( p >= pCV->nPhases ) return(0);                        // phase not measured
+
+    switch( ( reg - MODBUS_PHASE_REGS ) % 6 )
+    {
+      case 0:  return( round( 10.0 * pCV->VxEffPh[p] ) );
+      case 1:  return( round( 100.0 * pCV->IcEffPh[p] ) );
+      case 2:  return( round( pCV->PgFiltPh[p] ) );
+      case 3:  return( round( pCV->PcFiltPh[p] ) );
+      case 4:  return( round( pCV->PnFiltPh[p] ) );
+      default: return( round( constrain( pCV->MarginPh[p], -32000.0, 32000.0 ) ) );
+    }
+  }
+
+  int iLoad = ( reg - 20 ) / 8;
+  if( ( reg < 20 ) || ( iLoad >= pLD->nLoads ) ) return(0);   // unused register
+
+  switch( ( reg - 20 ) % 8 )
+  {
+    case 0:  return( pLD->on[iLoad] );
+    case 1:  return( pLD->solarMode[iLoad] );
+    case 2:  return( pLD->lockSec[iLoad] );
+    case 3:  return( round( pLD->powerW[iLoad] ) );
+    case 4:  return( pLD->forced[iLoad] ? ( pLD->forcedOn[iLoad] ? 2 : 1 ) : 0 );
+    case 5:  return( pLD->phase[iLoad] + 1 );
+    case 6:  return( pLD->node[iLoad] );
+    default: return(0);
+  }
+}
+
+bool Modbus::readBit(bool coil, int n, Loads *pLD)
+{
+  int iLoad = n % 16;
+
+  if( iLoad >= pLD->nLoads ) return(false);
+
+  if( coil ) return( ( n < 16 ) ? pLD->forced[iLoad]  : pLD->forcedOn[iLoad] );
+  else       return( ( n < 16 ) ? pLD->on[iLoad]      : pLD->solarMode[iLoad] );
+}
+
+bool Modbus::writeCoil(int n, bool value, Loads *pLD)
+{
+  int iLoad = n % 16;
+
+  if( iLoad >= pLD->nLoads ) return(false);
+
+  if( n < 16 ) pLD->forced[iLoad] = value;
+  else         pLD->forcedOn[iLoad] = value;
+  return(true);
+}
+
+void Modbus::answer(int n)          // the first n bytes of the frame are sent, followed by their CRC
+{
+  uint16_t c = crc(n);
+
+  frame[n++] = lowByte(c);
+  frame[n++] = highByte(c);
+
+  if( deGpio != -1 ) digitalWrite(deGpio, HIGH);   // transmitting
+  port->write(frame, n);
+  if( deGpio != -1 )
+  {
+    port->flush();                                 // waits until the last byte is sent
+    digitalWrite(deGpio, LOW);                     // receiving
+  }
+  nRequests++;
+}
+
+void Modbus::exception(uint8_t code)
+{
+  nErrors++;
+  if( frame[0] == 0 ) return;                      // broadcast requests are never answered
+  frame[1] |= 0x80;
+  frame[2] = code;
+  answer(3);
+}
+
+uint16_t Modbus::crc(int n)                        // Modbus CRC16 (polynomial 0xA001, initial value 0xFFFF)
+{
+  uint16_t c = 0xFFFF;
+
+  for( int i = 0; i < n; i++ )
+    c = _crc16_update(c, frame[i]);
+  return(c);
+}
@@ -4,12 +4,17 @@ void printTimes(void)
 {
   snprintf_P(buffer,199,PSTR("%s\t"
                             "loop_us:%lu \t+display_us:%lu \t"
-                            "sampling_us:%lu \tcomputing_us:%lu \t"
-                            "next_decide_s:%d \tnext_refresh_s:%d"), 
+                            "sampling_us:%lu (analogRead_us:%u) \tcomputing_us:%lu \t"
+                            "next_decide_s:%d \tdecide_period_s:%d \tvolatility_W/s:%d \tnext_refresh_s:%d \t"), 
                               CT.hhmmss, 
                               CT.loopTime_us, DS.displayTimeUs,
-                              CV.samplingTimeAvg_us, CV.endUs - CV.startUs,
-                              CT.countDecide_s, CT.countRefresh_s );
+                              CV.samplingTimeAvg_us, CM.analogReadSampleUs, CV.endUs - CV.startUs,
+                              CT.countDecide_s, CT.decidePeriod_s, (int) round(CV.PnVolat), CT.countRefresh_s );
+  Serial.print(buffer);
+  snprintf_P(buffer,199,PSTR("averaged_cycles:%d \taligned:%d \tzc_misses:%lu \tadc_sleep:%d \t"
+                            "profile:%S \tfull_s:%lu \tnight_s:%lu \tnights:%u"), 
+                              CM.average, CM.aligned, CM.zcMisses, CM.adcSleep,
+                              LP.night ? PSTR("night") : PSTR("full"), LP.fullS, LP.nightS, LP.nights );
   
   Serial.println(buffer);
 }
@@ -42,3 +47,126 @@ void printFilteredValues() //imprimeix l'interval de mostreig en ms i els valors
   Serial.println(buffer);
 }
 
+void printMemory()  // prints the RAM use measured by the last scan
+{
+  snprintf_P(buffer, 199, PSTR("%s \tfree_ram:%d \tunused_ram:%d \tstack_peak:%d \theap:%d \theap_peak:%d \tbuffer_peak:%d/%d"),
+                        CT.hhmmss, MS.freeRam, MS.unusedRam, MS.stackPeak, MS.heapUsed, MS.heapPeak, MS.bufferPeak, MS.bufferSize );
+  Serial.println(buffer);
+}
+
+void printHeadroom()  // prints the peaks, clipped samples and crest factors of Vx, Ig and Ic, and their recommended nominal values
+{
+  HR.print(&CT, &CM, &CV);
+}
+
+void printWindowValues()  // prints the values of the last cycle, and those aggregated over the last window of cycles
+{
+  snprintf_P(buffer, 249, PSTR("%s \tcycle: VxEff_V:%d IgEff_A:%d.%02d IcEff_A:%d.%02d Pg_W:%d Pc_W:%d Pn_W:%d"
+                               " \twindow(%d): VxEff_V:%d IgEff_A:%d.%02d IcEff_A:%d.%02d Pg_W:%d Pc_W:%d Pn_W:%d PFg:%d PFc:%d"),
+                               CT.hhmmss,
+                               (int) round(CV.VxEff), (int) CV.IgEff, ( (int) (100.0*CV.IgEff) )%100, (int) CV.IcEff, ( (int) (100.0*CV.IcEff) )%100,
+                               (int) round(CV.Pg), (int) round(CV.Pc), (int) round(CV.Pn),
+                               CV.windowCycles,
+                               (int) round(CV.VxEffWin), (int) CV.IgEffWin, ( (int) (100.0*CV.IgEffWin) )%100, (int) CV.IcEffWin, ( (int) (100.0*CV.IcEffWin) )%100,
+                               (int) round(CV.PgWin), (int) round(CV.PcWin), (int) round(CV.PnWin), (int) round(100.0*CV.PFgWin), (int) round(100.0*CV.PFcWin) );
+  Serial.println(buffer);
+}
+
+void printPhases()  // prints the RMS values, the filtered powers and the margin of every phase and sub-circuit, and the metering rule
+{
+  Serial.print(CT.hhmmss);
+  for(int p=0; p<CV.nPhases; p++)
+  {
+    snprintf_P(buffer, 199, PSTR(" \tL%d: VxEff_V:%d IgEff_A:%d.%1d IcEff_A:%d.%1d PgFilt_W:%d PcFilt_W:%d PnFilt_W:%d margin_W:%d max_W:%d"),
+                              p + 1, (int) round(CV.VxEffPh[p]), (int) CV.IgEffPh[p], ( (int) (10.0*CV.IgEffPh[p]) )%10, (int) CV.IcEffPh[p], ( (int) (10.0*CV.IcEffPh[p]) )%10,
+                              (int) round(CV.PgFiltPh[p]), (int) round(CV.PcFiltPh[p]), (int) round(CV.PnFiltPh[p]),
+                              (int) round(CV.MarginPh[p]), (int) round(CV.PhaseMax[p]) );
+    Serial.print(buffer);
+  }
+  for(int k=0; k<CV.nNodes; k++)
+  {
+    snprintf_P(buffer, 199, PSTR(" \tnode %d: Is_A:%d.%1d limit_A:%d.%1d margin_W:%d"),
+                              k + 1, (int) CV.IsFilt[k], ( (int) (10.0*CV.IsFilt[k]) )%10, (int) CV.NodeLimitA[k], ( (int) (10.0*CV.NodeLimitA[k]) )%10,
+                              (int) round(CV.MarginNd[k]) );
+    Serial.print(buffer);
+  }
+  snprintf_P(buffer, 99, PSTR(" \ttotal: PnFilt_W:%d margin_W:%d metering:%S"),
+                            (int) round(CV.PnFilt), (int) round(CV.Margin), CV.meteringPerPhase ? PSTR("per phase") : PSTR("vector sum") );
+  Serial.println(buffer);
+}
+
+void printBreaker()  // prints the current, the equivalent current, the thermal stress, the margin and the time to trip of every breaker
+{
+  BK.print(&CT);
+}
+
+void printJsonValues()  // prints the computed and filtered values, and the status of the loads, as a JSON line, every HEARTBEAT_PERIOD_S adds a heartbeat line
+{
+  JsonWriter js(&Serial);
+  long t = CT.hours * 3600L + CT.minutes * 60L + CT.seconds;
+
+  js.open();
+  js.add(PSTR("type"), "values");
+  js.add(PSTR("t"), t);
+  js.add(PSTR("VxEff"), CV.VxEff, 1);
+  js.add(PSTR("IgEff"), CV.IgEff, 2);
+  js.add(PSTR("IcEff"), CV.IcEff, 2);
+  js.add(PSTR("Pg"), (long) round(CV.Pg));
+  js.add(PSTR("Pc"), (long) round(CV.Pc));
+  js.add(PSTR("Pn"), (long) round(CV.Pn));
+  js.add(PSTR("PFg"), CV.PFg, 2);
+  js.add(PSTR("PFc"), CV.PFc, 2);
+  js.add(PSTR("PgWin"), (long) round(CV.PgWin));
+  js.add(PSTR("PcWin"), (long) round(CV.PcWin));
+  js.add(PSTR("PgFilt"), (long) round(CV.PgFilt));
+  js.add(PSTR("PcFilt"), (long) round(CV.PcFilt));
+  js.add(PSTR("PnFilt"), (long) round(CV.PnFilt));
+  js.add(PSTR("Margin"), (long) round(CV.Margin));
+  js.add(PSTR("fault"), HM.faulty ? HM.text : "");
+  if( CV.nPhases > 1 )
+  {
+    js.openArray(PSTR("phases"));
+    for(int p=0; p<CV.nPhases; p++)
+    {
+      js.openObject(NULL);
+      js.add(PSTR("VxEff"), CV.VxEffPh[p], 1);
+      js.add(PSTR("PgFilt"), (long) round(CV.PgFiltPh[p]));
+      js.add(PSTR("PcFilt"), (long) round(CV.PcFiltPh[p]));
+      js.add(PSTR("PnFilt"), (long) round(CV.PnFiltPh[p]));
+      js.add(PSTR("Margin"), (long) round(CV.MarginPh[p]));
+      js.closeObject();
+    }
+    js.closeArray();
+  }
+  js.openArray(PSTR("loads"));
+  for(int i=0; i<LD.nLoads; i++)
+  {
+    js.openObject(NULL);
+    js.add(PSTR("load"), LD.name[i]);
+    js.addBool(PSTR("on"), LD.on[i]);
+    js.addBool(PSTR("solar"), LD.solarMode[i]);
+    js.addBool(PSTR("forced"), LD.forced[i]);
+    js.add(PSTR("lockSec"), (long) LD.lockSec[i]);
+    js.add(PSTR("phase"), (long) LD.phase[i] + 1);
+    js.add(PSTR("node"), (long) LD.node[i]);
+    js.closeObject();
+  }
+  js.closeArray();
+  js.close();
+
+  if( t % HEARTBEAT_PERIOD_S == 0 )
+  {
+    js.open();
+    js.add(PSTR("type"), "heartbeat");
+    js.add(PSTR("t"), t);
+    js.add(PSTR("uptime"), CT.hhmmss);
+    js.add(PSTR("sim"), (long) SM.mode);
+    js.add(PSTR("loop_us"), (long) CT.loopTime_us);
+    js.add(PSTR("cmdErrors"), CMD.nErrors);
+    js.add(PSTR("modbusRequests"), (long) MB.nRequests);
+    js.add(PSTR("modbusErrors"), (long) MB.nErrors);
+    js.add(PSTR("freeRam"), (long) MS.unusedRam);
+    js.add(PSTR("stackPeak"), (long) MS.stackPeak);
+    js.close();
+  }
+}
@@ -20,6 +20,7 @@ class Radio
     Radio(void) {};
     void begin(int pinRadio);
     enum RadioHW { NO_RADIO, RADIO_GMOMXEN };                 // enum of the diverse radio types, here only GMOMXSEN brand is implemented
+    static const int N_CHANNELS = 3;                          // channels of the cloned codes, from 1
     int send(RadioHW radioType, int channel, bool setToOn);
   private:
     int sendGmomxen(int channel, bool setToOn);
@@ -67,7 +68,6 @@ int Radio::sendGmomxen(int channel, bool setToOn)   // sends an activation or de
 
   // cloned codes
 
-  static const int N_CHANNELS = 3;
                                               // Off code                          // On code
   static const char *codes[N_CHANNELS][2] = { {"100000011011010000110100000000000","100011101011010000110100000000000"},    // Channel 1
                                               {"101011101011010000110100000000000","101001101011010000110100000000000"},    // Channel 2
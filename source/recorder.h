@@ -0,0 +1,242 @@
+/*
+=====================================================================
+recorder.h
+Records the waveforms of the last grid cycles in a circular buffer,
+and freezes them around an event (overload, voltage sag, clipping,
+load switch) so that they can be dumped later for plotting
+=====================================================================
+*/
+
+/*
+NOTES:
+
+Every grid cycle, the samples of Vx, Ig and Ic of the first phase are stored in a ring of RECORDER_CYCLES cycles.
+They are stored without the extra bits of oversampling (10 bits, as read by the ADC), packed 4 samples in 5 bytes,
+so that a cycle takes 150 bytes instead of 240 (1.2 kB for the whole ring).
+
+While armed, the triggers enabled in the mask are checked on every cycle (after the values are computed):
+  1 margin:  the consumption margin of a phase is negative
+  2 sag:     the RMS voltage of a phase is below RECORDER_SAG_RATIO of its nominal value
+  4 clip:    a recorded sample is at an end of the ADC range
+  8 switch:  a load has been switched On or Off since the previous cycle
+  16 manual: the serial command WT
+When a trigger fires, RECORDER_POST more cycles are recorded and the ring is frozen: it keeps RECORDER_PRE cycles
+before the trigger cycle (fewer if the ring had not been filled yet), the trigger cycle and the cycles after it.
+The snapshot is kept until the recorder is armed again (command W with the mask of triggers), so that it can be dumped several times.
+
+The serial command WD dumps the snapshot in binary, after a text line "WAVE n" with the number n of bytes which follow (little endian),
+and ended by a line end, so that a reader of the text lines can skip it:
+  header (28 bytes):
+    'W' 'V'         magic
+    uint8           version of the format (RECORDER_FORMAT)
+    uint8           channels per sample (3: Vx, Ig, Ic)
+    uint8           samples per cycle
+    uint8           cycles in the dump
+    uint8           index of the trigger cycle in the dump
+    uint8           triggers fired (mask as above)
+    uint32          uptime of the trigger cycle (seconds)
+    float           sampling period (microseconds)
+    float x 3       volts or amperes per count of Vx, Ig and Ic (from the calibrated nominal values and V0 at the trigger)
+  every cycle, from the oldest (4 + 2 + 150 bytes):
+    uint32          start of the cycle (microseconds, micros())
+    uint16          average of V0 (counts), the zero of the three channels
+    150 bytes       samples in the order Vx[0] Ig[0] Ic[0] Vx[1] ..., 10 bits each, the first one in the lowest bits of the first byte
+  trailer:
+    uint16          CRC16 (polynomial 0xA001, initial 0xFFFF) of all the previous bytes
+A value is volts or amperes = ( counts - V0 ) * scale.
+*/
+
+const int RECORDER_CYCLES = 8;          // cycles kept in the ring
+const int RECORDER_PRE = 3;             // cycles kept before the trigger cycle
+const int RECORDER_POST = RECORDER_CYCLES - RECORDER_PRE - 1;   // cycles recorded after the trigger cycle
+const int RECORDER_CHANNELS = 3;        // channels recorded: Vx, Ig, Ic of the first phase
+const int RECORDER_BITS = 10;           // bits stored per sample
+const int RECORDER_VALUES = RECORDER_CHANNELS * SAMPLES_PER_CYCLE;   // samples stored per cycle
+const int RECORDER_BYTES = ( RECORDER_VALUES * RECORDER_BITS + 7 ) / 8;   // bytes of the packed samples of a cycle
+const float RECORDER_SAG_RATIO = 0.9;   // the sag trigger fires below this ratio of the nominal RMS voltage
+const uint8_t RECORDER_FORMAT = 1;      // version of the format of the binary dump
+
+class Recorder
+{
+  public:
+    enum Trigger : uint8_t { TRIG_MARGIN = 1, TRIG_SAG = 2, TRIG_CLIP = 4, TRIG_SWITCH = 8, TRIG_MANUAL = 16, TRIG_ALL = 31 };   // masks of the triggers
+    enum State : uint8_t { IDLE, ARMED, POST, FROZEN };   // states of the recorder
+    Recorder(void) {};
+    void begin(float, uint8_t);                     // nominal RMS voltage, mask of the triggers armed at start (0 idle)
+    void arm(uint8_t);                              // clears the snapshot and arms the triggers of the mask (0 idle)
+    void update(CountTime *, Measure *, Values *, Loads *);   // stores the last cycle, checks the triggers
+    void dump(CountTime *);                         // writes the snapshot in binary
+    void print(CountTime *);                        // prints the status of the recorder
+    State state = IDLE;                             // status of the recorder
+    uint8_t mask = 0;                               // triggers armed
+    uint8_t fired = 0;                              // triggers fired on the trigger cycle
+    bool manual = false;                            // true if the manual trigger is pending
+    unsigned long triggerTime = 0UL;                // uptime of the trigger cycle (seconds)
+  private:
+    void store(Measure *, Values *);                // stores the last cycle into the ring
+    uint8_t check(Measure *, Values *, Loads *);    // returns the mask of the triggers fired by the last cycle
+    uint8_t oldest(void);                           // slot of the oldest cycle kept
+    void write(const void *, int, uint16_t *);      // writes bytes to serial, updating the CRC
+    uint8_t packed[RECORDER_CYCLES][RECORDER_BYTES];   // packed samples of every cycle of the ring
+    unsigned long startUs[RECORDER_CYCLES];         // start of every cycle of the ring
+    uint16_t v0[RECORDER_CYCLES];                   // average of V0 of every cycle of the ring
+    uint8_t head = 0;                               // slot where the next cycle is stored
+    uint8_t filled = 0;                             // cycles stored since armed (up to RECORDER_CYCLES)
+    uint8_t trigSlot = 0;                           // slot of the trigger cycle
+    uint8_t post = 0;                               // cycles still to be recorded after the trigger
+    uint8_t loadsOn = 0;                            // loads On in the previous cycle, one bit per load
+    float scale[RECORDER_CHANNELS];                 // volts or amperes per count at the trigger
+    float periodUs;                                 // sampling period at the trigger
+    float vxNom;                                    // nominal RMS voltage
+};
+
+void Recorder::begin(float vxNom_arg, uint8_t mask_arg)
+{
+  vxNom = vxNom_arg;
+  arm(mask_arg);
+}
+
+void Recorder::arm(uint8_t mask_arg)
+{
+  mask = mask_arg & TRIG_ALL;
+  state = mask ? ARMED : IDLE;
+  fired = 0;
+  manual = false;
+  filled = 0;
+}
+
+void Recorder::update(CountTime *pCT, Measure *pCM, Values *pCV, Loads *pLD)
+{
+  if( ( state != ARMED ) && ( state != POST ) ) return;
+
+  store(pCM, pCV);
+  if( state == POST )
+  {
+    if( --post == 0 )
+    {
+      state = FROZEN;
+      snprintf_P(buffer, 149, PSTR("%s Waveform recorded (triggers %d at %02d:%02d:%02d), enter WD to dump it\n"),
+                                pCT->hhmmss, fired, (int) ( triggerTime / 3600L ), (int) ( ( triggerTime / 60L ) % 60L ), (int) ( triggerTime % 60L ) );
+      Serial.print(buffer);
+    }
+    return;
+  }
+
+  fired = check(pCM, pCV, pLD) & mask;
+  if( fired )
+  {
+    int extra = 1 << pCM->extraBits;
+    trigSlot = ( head + RECORDER_CYCLES - 1 ) % RECORDER_CYCLES;
+    triggerTime = pCT->hours * 3600L + pCT->minutes * 60L + pCT->seconds;
+    scale[0] = pCV->VoltsPerCount * extra * pCV->VxRatio;
+    scale[1] = pCV->VoltsPerCount * extra * pCV->IgRatio;
+    scale[2] = pCV->VoltsPerCount * extra * pCV->IcRatio;
+    periodUs = pCM->samplingPeriodUs;
+    post = RECORDER_POST;
+    state = ( post > 0 ) ? POST : FROZEN;
+  }
+}
+
+void Recorder::store(Measure *pCM, Values *pCV)
+{
+  uint8_t *p = packed[head];
+  int *ch[RECORDER_CHANNELS] = { pCM->Vx, pCM->Ig, pCM->Ic };
+  int n = min( pCM->numSamples, (int) SAMPLES_PER_CYCLE );
+  unsigned int bit = 0;
+
+  memset(p, 0, RECORDER_BYTES);
+  for( int i = 0; i < n; i++ )
+    for( int c = 0; c < RECORDER_CHANNELS; c++, bit += RECORDER_BITS )
+    {
+      unsigned long v = (unsigned long) ( ch[c][i] >> pCM->extraBits ) << ( bit & 7 );   // 10 bits spanning up to 3 bytes
+      uint8_t *q = p + ( bit >> 3 );
+      q[0] |= v;
+      q[1] |= v >> 8;
+      if( ( bit & 7 ) > 6 ) q[2] |= v >> 16;
+    }
+  startUs[head] = pCM->cycleStartUs;
+  v0[head] = ( (unsigned int) pCV->V0Avg ) >> pCM->extraBits;
+  head = ( head + 1 ) % RECORDER_CYCLES;
+  if( filled < RECORDER_CYCLES ) filled++;
+}
+
+uint8_t Recorder::check(Measure *pCM, Values *pCV, Loads *pLD)
+{
+  uint8_t found = 0;
+  uint8_t on = 0;
+  int i, p;
+
+  for( p = 0; p < pCV->nPhases; p++ )
+  {
+    if( pCV->margin(p) < 0.0 )                           found |= TRIG_MARGIN;
+    if( pCV->VxEffPh[p] < RECORDER_SAG_RATIO * vxNom )   found |= TRIG_SAG;
+  }
+  for( i = 0; i < pCM->numSamples; i++ )
+  {
+    if( ( pCM->Vx[i] <= 0 ) || ( pCM->Vx[i] >= pCM->saturation ) ) found |= TRIG_CLIP;
+    if( ( pCM->Ig[i] <= 0 ) || ( pCM->Ig[i] >= pCM->saturation ) ) found |= TRIG_CLIP;
+    if( ( pCM->Ic[i] <= 0 ) || ( pCM->Ic[i] >= pCM->saturation ) ) found |= TRIG_CLIP;
+  }
+  for( i = 0; i < pLD->nLoads; i++ )
+    if( pLD->on[i] ) on |= 1 << i;
+  if( ( filled > 1 ) && ( on != loadsOn ) )              found |= TRIG_SWITCH;
+  loadsOn = on;
+  if( manual )                                           found |= TRIG_MANUAL;
+  manual = false;
+  return( found );
+}
+
+uint8_t Recorder::oldest(void)
+{
+  int before = min( (int) RECORDER_PRE, filled - 1 - RECORDER_POST );   // cycles kept before the trigger cycle
+  return( ( trigSlot + RECORDER_CYCLES - before ) % RECORDER_CYCLES );
+}
+
+void Recorder::write(const void *data, int n, uint16_t *pCrc)
+{
+  const uint8_t *p = (const uint8_t *) data;
+
+  Serial.write(p, n);
+  for( int i = 0; i < n; i++ )
+    *pCrc = _crc16_update(*pCrc, p[i]);
+}
+
+void Recorder::dump(CountTime *pCT)
+{
+  if( state != FROZEN )
+  {
+    print(pCT);
+    return;
+  }
+
+  uint8_t first = oldest();
+  uint8_t cycles = ( trigSlot + RECORDER_CYCLES - first ) % RECORDER_CYCLES + 1 + RECORDER_POST;
+  uint8_t header[8] = { 'W', 'V', RECORDER_FORMAT, RECORDER_CHANNELS, SAMPLES_PER_CYCLE, cycles,
+                        (uint8_t) ( ( trigSlot + RECORDER_CYCLES - first ) % RECORDER_CYCLES ), fired };
+  uint16_t crc = 0xFFFF;
+
+  snprintf_P(buffer, 29, PSTR("WAVE %d\n"), 28 + cycles * ( 6 + RECORDER_BYTES ) + 2);
+  Serial.print(buffer);
+  write(header, sizeof(header), &crc);
+  write(&triggerTime, 4, &crc);
+  write(&periodUs, 4, &crc);
+  write(scale, sizeof(scale), &crc);
+  for( uint8_t k = 0; k < cycles; k++ )
+  {
+    uint8_t s = ( first + k ) % RECORDER_CYCLES;
+    write(&startUs[s], 4, &crc);
+    write(&v0[s], 2, &crc);
+    write(packed[s], RECORDER_BYTES, &crc);
+  }
+  Serial.write( (uint8_t *) &crc, 2 );
+  Serial.println();
+}
+
+void Recorder::print(CountTime *pCT)
+{
+  static const char text[4][7] PROGMEM = { "idle", "armed", "post", "frozen" };
+
+  snprintf_P(buffer, 149, PSTR("%s Waveform recorder: %S, triggers armed:%d fired:%d, %d of %d cycles (1 margin, 2 sag, 4 clip, 8 switch, 16 manual)"),
+                            pCT->hhmmss, text[state], mask, fired, filled, RECORDER_CYCLES);
+  Serial.println(buffer);
+}
@@ -51,7 +51,12 @@ To port this software to other processors, take into account:
 - In measure.h, the ADC prescaler must be modified according to the particular ADC registers
   and the conversion time must be lower than 1/4 of the designed sampling interval
 - The assignation of the digital and analog gpios must be revised according to the disponibility of the board
-- RAM and FLASH memory size must be enough. In SW v3 we have: RAM usage: 2442 bytes, FLASH usage: 26778 bytes
+- RAM and FLASH memory size must be enough. The first release of SW v3 had: RAM usage: 2442 bytes, FLASH usage: 26778 bytes.
+  Both are larger now and were not measured again on the Mega: the IDE (or avr-size) gives the exact figures.
+  The sizes of the global objects, compiled on a host with 16-bit int and without padding, sum about 5100 bytes of the 8192 of the Mega,
+  and about 3800 bytes with the waveform recorder left out (WAVEFORM_RECORDER 0, 1200 bytes of ring); the samples of measure.h are stored
+  only for the phases and sub-circuits measured (N_PHASES, N_SUBCIRCUITS, 80 bytes per channel), and the external ADC (EXTERNAL_ADC 1) adds 480 bytes.
+  The free RAM and the peak stack depth at runtime are printed by the serial print command '5', see memory.h
 - The schematic must be revised to cope with ADC input ranges other than 0 to 5V
 
 To use different electrical parameters:
@@ -60,6 +65,60 @@ To use different electrical parameters:
 */
 
 /*
+Changes after v3:
+- The load table, timing and electrical settings are stored in EEPROM (versioned and CRC-protected) and edited through serial commands,
+  the constants in this file are the compiled defaults used when no valid configuration is stored
+- Serial commands are parsed by a command interpreter with a registry of named commands with typed arguments,
+  error replies and a help generated from the registry (the commands are in file "commands.ino")
+- Modbus RTU slave on Serial1, exposing measures, powers and loads status, and coils to override the loads (register map in modbus.h)
+- JSON lines output mode (print command 'J') for home-automation bridges: values every second, load change events with their cause, and heartbeats
+- Crash breadcrumbs: the loop stage, uptime, last radio command and loads status are recorded in .noinit RAM;
+  at start, the cause of the reset (power-on, brown-out, watchdog) and the breadcrumbs are printed and displayed,
+  and the loads which were On are restored after a watchdog reset
+- Measure health monitor: implausible measures (V0 reference out of band, ADC saturation, stuck channel, RMS out of range)
+  set every load to its configured safe state, and the fault is shown on the display and printed
+- Headroom statistics of the analog inputs (print command '6'): peak counts, clipped samples and crest factor of each channel,
+  a warning when the headroom is too small, and the recommended nominal values to resize the conditioning circuits
+- The RMS values and powers are aggregated over a configurable window of cycles (10 at 50Hz, 12 at 60Hz by default),
+  the loads are decided on the windowed values, and both the per-cycle and windowed values are printed (print command '7')
+- Oversampling of the currents Ig and Ic (4 conversions per sample, interleaved around Vx) for one extra bit of resolution at low currents,
+  reduced automatically if the conversions do not fit into the sampling period (see measure.h)
+- Three-phase supplies: up to 3 grid voltages and 6 currents (N_PHASES, channel table in measure.h), per-phase powers and margins
+  against the limit of each phase (settings phmax1..3), loads tagged with their phase, and excedent netted by the metering rule
+  (setting metering: vector sum or per phase), printed with print command '8'
+- Sub-circuits measured by their own current transformers (N_SUBCIRCUITS), as a tree of nodes with current limits (command CNODE):
+  loads are tagged with their node, switched On only with margin at every level of their path, and shed within an overloaded branch first
+- Thermal model of the breakers (setting breaker, its rating, and curve): the thermal stress of the main breaker of every phase and of every sub-circuit
+  is integrated from the RMS current of every cycle: loads are switched On within the steady-state rating of the breakers, and shed only when
+  the remaining thermal headroom is used, so that short inrush peaks are tolerated while sustained overloads are shed before a trip (print command '9')
+- Waveform recorder: the samples of the last 8 cycles are kept packed at 10 bits, and frozen around a trigger (negative margin,
+  voltage sag, clipping, load switch or manual) with 3 cycles before and 4 after it, to be dumped in binary (commands W, WT, WD),
+  left out of the build with WAVEFORM_RECORDER 0
+- Every measured cycle starts at a positive zero crossing of the grid voltage, so that sample i has a fixed phase,
+  and the samples can be averaged synchronously over 4 or 16 cycles (setting average) for 1 or 2 more bits on the small currents
+- Direct ADC driver: precomputed ADMUX/ADCSRB of every channel and sequence of conversions of a sample, the next channel selected
+  while the current one is converted, instead of analogRead(); the time of a sample with analogRead() is printed as a reference (print command '1')
+- Optional external simultaneous-sampling ADC (ADS131M04 over SPI, EXTERNAL_ADC): Vx, Ig and Ic sampled at the same instant with 24 bits,
+  RMS values and powers computed with 64 bits sums (single phase, see ads131.h)
+- Optional conversions with the CPU asleep in SLEEP_MODE_ADC (ADC_SLEEP), for lower noise on the small currents, with the time missed by Timer0
+  added to the sampling schedule and to the time counting; serial command N measures the noise floor of the inputs awake and asleep
+- Night profile (NIGHT_PROFILE, see lowpower.h): without solar generation, one cycle measured per second, overload decisions only,
+  display backlight off; time spent in each profile printed with print command '1'
+- Adaptive decide period, from decide (at least 6 time constants of the filtered powers) to decidemax, driven by the volatility of the excedent,
+  shown on the loads screen and printed with print command '1'
+- Per-load hysteresis of the solar decisions: reserve of excedent to switch On and to switch Off, and percentage of the power
+  which may be imported before shedding (load fields onres, offres, import); serial command S prints the switches, the time On
+  and the self-consumption since start
+- Groups of mutually exclusive loads and dependencies on a parent load (load fields group, parent): a load is switched On only
+  while its parent is On and no other load of its group is On, and shedding a load sheds its dependents in the same decision
+- Priority classes (load field class): the loads of equal priority share the excedent, rotated every rotate period by their deficit
+  of time On, respecting their lock times; serial command S prints their share and the fairness of every class
+- Detection of loads commanded On which draw next to nothing (thermostat open), from the step of the consumption and a learned baseline:
+  a satisfied load stays On, but is not shed for lack of excedent nor to avoid a priority inversion, and is probed again periodically
+- Settle window of every load after a switch to On (load field settle): its inrush is de-weighted in the filtered powers, the decisions
+  wait for its end, and further switches to On are staggered so that the inrush peaks never overlap
+- Runtime measure of the RAM use (print command '5'): free RAM, peak stack depth by stack painting, heap use and largest fill of the shared buffer
+
 Changes in v3:
 - Added a change cause to the text printed when a load chages activation status
 - Credits of the code (file name and compilation date and hour) are printed on start and on a third display screen
@@ -74,26 +133,48 @@ Changes in v2:
 #include <Wire.h>               // I2C communications
 #include <LiquidCrystal_I2C.h>  // LCD display via I2C
 #include <avr/wdt.h>            // Watchdog
+#include <avr/sleep.h>          // conversions of the ADC with the CPU asleep
+#include <EEPROM.h>             // storage of the configuration
+#include <util/crc16.h>         // CRC of the stored configuration
+#include <SPI.h>                // external ADC
 
 char buffer[300];               // shared buffer to assemble formatted text, only for immediate use in functions
 
 #include "credits.h"            // source file name and compilation date-time
 #include "countTime.h"          // time counting and timed launch of tasks
+#include "breadcrumbs.h"        // cause of the last reset and record of the program stage in RAM kept through resets
+#include "memory.h"             // runtime measure of the RAM use (stack, heap and shared buffer)
+#include "command.h"            // interpreter of the serial commands
+#include "json.h"               // writing JSON lines directly to serial
 #include "radio.h"              // transmission of radio codes for remote switches activating loads
-#include "simul.h"              // simulation of the analog inputs (AC currents, AC tension and DC reference), and processing received  print commands
+#include "config.h"             // runtime configuration of loads, timing and electrical settings, stored in EEPROM
+#include "simul.h"              // simulation of the analog inputs (AC currents, AC tension and DC reference), and print code
 #include "measure.h"            // sampling and storing the analog inputs (AC currents, AC tension and DC reference) during one grid cycle
+#include "ads131.h"             // external simultaneous-sampling ADC over SPI, as an alternative to the ADC of the Mega
 #include "values.h"             // computing the electrical values from the stored analog input measures
+#include "health.h"             // checking that the measures are plausible
+#include "headroom.h"           // headroom of the analog inputs to the ends of the ADC range
+#include "breaker.h"            // thermal model of the breakers, margins from their thermal headroom
 #include "loads.h"              // managing the loads according to the powers from the computed electrical values
+#include "recorder.h"           // recording the waveforms around an event
+#include "modbus.h"             // Modbus RTU slave for a building controller
 #include "display.h"            // managing the LCD display
+#include "lowpower.h"           // night profile: reduced sampling and decisions while there is no solar generation
+
+// there are also the file "print.ino" containing auxiliary printing functions
+// and the file "commands.ino" containing the handlers and the registry of the serial commands
 
-// there is also the file "print.ino" containing auxiliary printing functions
+// The settings below are the compiled defaults, used only when there is no valid configuration stored in EEPROM (see config.h)
 
 // TIME SETTINGS
 
 const int DECIDE_PERIOD_S = 6;        // time in seconds between successive load activation decisions, recommended 6 times the time constant of filtering powers in values.h
+const int DECIDE_MAX_PERIOD_S = 30;   // longest decide period, reached with a volatile excedent (broken clouds), see loads.h
+const int ROTATE_PERIOD_S = 1800;     // time in seconds between successive rotations of the loads of equal priority (class), see loads.h
 const int REFRESH_PERIOD_S = 60;      // time in seconds between successive load status refreshes
 const int VAR_REFRESH_PERIOD_S = 5;   // màximum random variation (+ or -) of load refresh period
 const int RANDOM_SEED_ANALOG_IN = A0; // analog input whose instantaneous value is used as a seed to initialize random values generation
+const int HEARTBEAT_PERIOD_S = 10;    // time in seconds between successive heartbeat lines, in the JSON lines print mode
 
 // RADIO SETTINGS
 
@@ -101,10 +182,18 @@ const int RADIO_OUT = 8;              // output to PWM modulate the 433.92 MHz r
 
 // MAINS CYCLE MEASURE SETTINGS
 
+const int N_PHASES = 1;               // number of phases of the supply which are measured: 1, or up to PHASES_MAX (set in config.h) for a three-phase supply
 const int V0_IN = A0;                 // analog input for the reference voltage (and floating-ground input voltage)
-const int VX_IN = A1;                 // analog input for the grid voltage (scaled-down)
-const int IG_IN = A2;                 // analog input for the solar generated current (scaled-down and converted to voltage)
-const int IC_IN = A3;                 // analog input for the consumed current (scaled-down and converted to voltage) 
+const int VX_IN[PHASES_MAX] = { A1, A8, A10 };  // analog inputs for the grid voltage of each phase (scaled-down)
+const int IG_IN[PHASES_MAX] = { A2, -1, -1 };   // analog inputs for the solar generated current of each phase (scaled-down and converted to voltage), -1 if no inverter on the phase (the first phase must have one)
+const int IC_IN[PHASES_MAX] = { A3, A9, A11 };  // analog inputs for the consumed current of each phase (scaled-down and converted to voltage) 
+const int N_SUBCIRCUITS = 0;          // number of sub-circuits measured by their own current transformer, up to SUBCIRCUITS_MAX (set in config.h)
+const int IS_IN[SUBCIRCUITS_MAX] = { A4, A5, A12, A13 };  // analog inputs for the current of each sub-circuit (scaled-down and converted to voltage)
+const int N_SAMPLE_ROWS = 1 + 3 * N_PHASES + N_SUBCIRCUITS;  // channels whose samples are stored: V0, and Vx, Ig, Ic of every phase, and the sub-circuits (80 bytes each)
+#define EXTERNAL_ADC 0                // 1 to sample Vx, Ig and Ic with an external ADS131M04 over SPI instead of the ADC of the Mega (single phase, see ads131.h)
+                                      // a build flag, so that the driver and its buffers (480 bytes) take no RAM without the external ADC
+const int ADS_CS_PIN = 53;            // chip select of the external ADC
+const int ADS_DRDY_PIN = 2;           // data ready of the external ADC (an external interrupt pin)
 
 // ELECTRICAL VALUES SETTINGS
 
@@ -115,28 +204,50 @@ const float VX_CAL = 1.012;           // Calibration factor of the grid voltage
 const float IG_CAL = 1.0;             // Calibration factor of the solar generated power (to be fine-tuned to cope with hardware components inaccuracies)
 const float IC_CAL = 1.0;             // Calibration factor of the consumed power (to be fine-tuned to cope with hardware components inaccuracies)
 const float MAX_CONSUMPTION = 4600.0; // Maximum allowed power consumption in watts (to prevent grid protections to trip)
+const float PHASE_MAX_CONSUMPTION = 4600.0; // Maximum allowed power consumption of each phase in watts (breaker of the phase), used only with more than one phase
+const int METERING_PER_PHASE = 0;     // Metering rule of the excedent: 0 vector sum of the phases (most meters), 1 each phase metered on its own
+const float NODE_LIMIT_A = 16.0;      // Maximum allowed RMS current of each sub-circuit (rating of its breaker), its parent and phase are set through the configuration
+const float NODE_NOM_AEFF = 25.0;     // Nominal RMS current of the transformer of each sub-circuit, for which the maximum amplitude MAX_AMPL_V (default 2V) is read at the corresponding analog input
+const float BREAKER_A = 0.0;          // Rating of the main breaker of every phase in amperes, for its thermal model (0 to use the flat limits MAX_CONSUMPTION and PHASE_MAX_CONSUMPTION)
+const int BREAKER_CURVE = 5;          // Trip curve of the breakers, as its magnetic threshold in multiples of the rating: 3 (B), 5 (C), 10 (D)
+#define WAVEFORM_RECORDER 1           // 1 to keep the samples of the last cycles around a trigger (commands W, WT, WD, see recorder.h)
+                                      // a build flag, so that the recorder and its ring (1200 bytes) take no RAM without it
+const uint8_t RECORDER_TRIGGERS = 7;  // Triggers of the waveform recorder armed at start: 1 negative margin, 2 voltage sag, 4 clipping, 8 load switch (0 idle)
+const bool NIGHT_PROFILE = true;      // true to enter the night profile (one cycle per second, overload checks only, backlight off) while there is no solar generation
+const int AVERAGE_CYCLES = 1;         // Cycles averaged synchronously into a measure: 1 (none), 4 or 16, for lower noise on the small currents (see measure.h)
+const int AGGREGATION_CYCLES = round( MAINS_FREQ_HZ / 5.0 );  // Number of cycles of the aggregation window of the measures (200 ms of grid: 10 cycles at 50Hz, 12 at 60Hz), 1 for no aggregation
+
+// LOADS SETTINGS, from highest to lowest priority, do not excceed the max number of loads N_LOADS_MAX set in config.h
+//   name:     Name of the load to be displayed (max 5 characters)
+//   power:    Nominal power of the load in watts
+//   lockOn:   Waiting time in seconds after an activation to On of the load, until a deactivation to Off is permitted
+//   lockOff:  Waiting time in seconds after a deactivation to Off of the load, until an activation to On is permitted
+//   out:      Digital out gpio to signal the activation status of the load, and optionally to manage the load in a wired fashion (-1 if none)
+//   mode:     Digital in gpio (here analog input is used as a digital input), to receive the load mode switch, manual or solar (-1 if none)
+//   radio:    Type of radio used by the remote switches, as defined in radio.h
+//   chan:     Radio channel to which the load remote switch is responding, as defined in radio.h
+//   safe:     State of the load while the measures are not plausible: 0 Off, 1 On, -1 unchanged
+//   phase:    Phase which supplies the load, 1 to N_PHASES
+//   node:     Sub-circuit which supplies the load, 1 to N_SUBCIRCUITS, or 0 if only the main supply
+//   onRes:    Excedent in watts required above the power of the load to switch it On
+//   offRes:   Excedent in watts below which the load is switched Off
+//   imp%:     Percentage of the power of the load which may be imported before it is switched Off
+//   group:    Group of mutually exclusive loads (never On together), or 0 if none
+//   parent:   Load (of higher priority) which must be On for this one to be On, or -1 if none
+//   class:    Class of loads of equal priority, which share the excedent by rotation, or 0 if none
+//   settle:   Settle window in milliseconds after a switch to On, while its inrush is de-weighted and other switches to On wait (motor: some seconds, resistive: 0)
+
+const Config::LoadData LOADS[] PROGMEM =
+{
+  // name    power  lockOn  lockOff  out  mode  radio                 chan  safe  phase  node  onRes  offRes  imp%  group  parent  class  settle
+  { "Pisc",  1500,  60,     60,      10,  A7,   Radio::RADIO_GMOMXEN, 2,    0,    1,     0,    0,     0,      0,    0,     -1,     0,     2000 },
+  { "Term",  1000,  60,     60,      11,  A6,   Radio::RADIO_GMOMXEN, 3,    0,    1,     0,    0,     0,      0,    0,     -1,     0,     0    },
+};
+
+// MODBUS SETTINGS
 
-// LOADS SETTINGS, do not excceed the max number of loads N_LOADS_MAX set in loads.h
-
-// highest priority load
-const char *LOAD0_NAME =          "Pisc";   // Name of the load to be displayed
-const float LOAD0_POWER_W =       1500.0;   // Nominal power of the load
-const int   LOAD0_LOCK_ON_SEC =   60.0;     // Waiting time after an activation to On of the load, until a deactivation to Off is permitted
-const int   LOAD0_LOCK_OFF_SEC =  60.0;     // Waiting time after a deactivation to Off of the load, until an activation to On is permitted
-const int   LOAD0_ON_OUT =        10;       // Digital out gpio to signal the activation status of the load, and optionally to manage the load in a wired fashion
-const int   LOAD0_MODE_IN =       A7;       // Digital in gpio (here analog input is used as a digital input), to receive the load mode switch (manual or solar)
-const Radio::RadioHW LOAD0_RADIO_MODEL = Radio::RADIO_GMOMXEN;  // Type of radio used by the remote switches, as defined in radio.h
-const int   LOAD0_CHANNEL =       2;        // Radio channel to which the load remote switch is responding, as defined in radio.h
-
-// lowest priority load
-const char *LOAD1_NAME =          "Term";   // Name of the load to be displayed
-const float LOAD1_POWER_W =       1000.0;   // Nominal power of the load
-const int   LOAD1_LOCK_ON_SEC =   60.0;     // Waiting time after an activation to On of the load, until a deactivation to Off is permitted
-const int   LOAD1_LOCK_OFF_SEC =  60.0;     // Waiting time after a deactivation to Off of the load, until an activation to On is permitted
-const int   LOAD1_ON_OUT =        11;       // Digital out gpio to signal the activation status of the load, and optionally to manage the load in a wired fashion
-const int   LOAD1_MODE_IN =       A6;       // Digital in gpio (here analog input is used as a digital input), to receive the load mode switch (manual or solar)
-const Radio::RadioHW LOAD1_RADIO_MODEL = Radio::RADIO_GMOMXEN;  // Type of radio used by the remote switches, as defined in radio.h
-const int   LOAD1_CHANNEL =       3;        // Radio channel to which the load remote switch is responding, as defined in radio.h
+HardwareSerial *MODBUS_SERIAL = &Serial1;   // serial port of the Modbus slave (Serial1 uses pins 18 TX1 and 19 RX1 of the Arduino Mega)
+const int MODBUS_DE_OUT = -1;               // Digital out gpio to enable the driver of a RS485 transceiver (-1 if none)
 
 // DISPLAY CONSTANTS
 
@@ -145,13 +256,29 @@ const int BUTTON_IN = 12;  // Digital input gpio where the button to change scre
 // GLOBAL OBJECTS
 
 class Credits CR;     // compilation info
+class Config CF;      // configuration object
+class Command CMD;    // serial commands interpreter object
 class CountTime CT;   // count time object
 class Radio RD;       // radio object
 class Simul SM;       // simulation object
 class Measure CM;     // measure analog inputs object
+int samples[N_SAMPLE_ROWS][SAMPLES_PER_CYCLE];   // samples of every channel measured, stored by CM
+#if EXTERNAL_ADC
+class Ads131 AD;      // external ADC object
+#endif
 class Values CV;      // compute electrical values object
+class Health HM;      // measure health monitor object
+class Headroom HR;    // headroom statistics object
+class Breaker BK;     // breakers thermal model object
 class Loads LD;       // manage loads object
+#if WAVEFORM_RECORDER
+class Recorder WR;    // waveform recorder object
+#endif
 class Display DS;     // manage display object
+class LowPower LP;    // night profile object
+class Modbus MB;      // Modbus slave object
+class Memory MS;      // RAM use statistics object
+class Breadcrumbs BC; // reset cause and breadcrumbs object
 
 //PROGRAM BODY
 
@@ -159,31 +286,95 @@ void setup()
 {
   wdt_disable();
   wdt_enable(WDTO_8S);                    // watchdog time set to 8 segons
+
+  MS.begin(buffer, sizeof(buffer));       // paints the free RAM, before it is used, to measure later the peak stack depth
   
   Serial.begin(115200);                   // serial port is inicialized
   Serial.println("\n\n\n\n\n\n\n\n\n");   // clears the terminal screen
 
   CR.begin(__FILE__, __DATE__, __TIME__); // info of source file compilation
 
+  const Config::Defaults defaults =     // compiled default settings, in the order of Config::Defaults
+  {
+    DECIDE_PERIOD_S, DECIDE_MAX_PERIOD_S, ROTATE_PERIOD_S, REFRESH_PERIOD_S, VAR_REFRESH_PERIOD_S,
+    VX_NOM_VEFF, IG_NOM_AEFF, IC_NOM_AEFF, VX_CAL, IG_CAL, IC_CAL,
+    MAX_CONSUMPTION, AGGREGATION_CYCLES, PHASE_MAX_CONSUMPTION, METERING_PER_PHASE,
+    BREAKER_A, BREAKER_CURVE, AVERAGE_CYCLES, NODE_LIMIT_A, NODE_NOM_AEFF
+  };
+  CF.setDefaults(&defaults);
+  for( unsigned int i = 0; i < sizeof(LOADS) / sizeof(LOADS[0]); i++ )
+    CF.addDefault(&LOADS[i]);             // compiled default load table
+  CF.begin();                             // reads the configuration from EEPROM, or keeps the compiled defaults
+
+  BC.begin( CF.crc(&CF.data) );           // gets the cause of the reset and the breadcrumbs recorded before it
+
   RD.begin(RADIO_OUT);                    // set-up of the radio object
 
   wdt_reset();                            // resets watchdog counter
 
-  CT.begin( DECIDE_PERIOD_S, REFRESH_PERIOD_S, VAR_REFRESH_PERIOD_S, RANDOM_SEED_ANALOG_IN );   // starts time counting
+  CT.begin( CF.data.decidePeriod_s, CF.data.decideMax_s, CF.data.refreshPeriod_s, CF.data.varRefreshPeriod_s, RANDOM_SEED_ANALOG_IN );   // starts time counting
 
-  CM.begin(V0_IN,VX_IN,IG_IN,IC_IN);      // starts sampling the electric values during a grid cycle
+  CM.begin(V0_IN,VX_IN,IG_IN,IC_IN,N_PHASES,IS_IN,N_SUBCIRCUITS,samples,N_SAMPLE_ROWS);   // starts sampling the electric values of every phase and sub-circuit during a grid cycle
+#if EXTERNAL_ADC
+  if( ( N_PHASES > 1 ) || ( N_SUBCIRCUITS > 0 ) )
+    Serial.println(F("WARNING: with the external ADC, only the first phase is measured, without sub-circuits"));
+  AD.begin( ADS_CS_PIN, ADS_DRDY_PIN, MAX_AMPL_V, 2.0 * V0_REF_V );   // the samples are scaled to those of the inputs of the Mega
+  CM.beginExternal(&AD);                  // samples Vx, Ig and Ic of the first phase with the external ADC
+#endif
+  CM.setAverage(CF.data.averageCycles);   // cycles averaged synchronously into a measure
 
   SM.begin(CM.numSamples);                // set-up of the simulation
 
-  CV.begin( VX_CAL * VX_NOM_VEFF, IG_CAL * IG_NOM_AEFF, IC_CAL * IC_NOM_AEFF, MAX_CONSUMPTION );                                            // initiates computing of electric values 
+  beginCommands();                        // set-up of the serial commands interpreter
+
+  CV.begin( CF.data.vxCal * CF.data.vxNomVeff, CF.data.igCal * CF.data.igNomAeff, CF.data.icCal * CF.data.icNomAeff, CF.data.maxConsumption, CF.data.windowCycles,
+            CM.nPhases, CF.data.phaseMax, CF.data.meteringPerPhase );  // initiates computing of electric values 
+  CV.beginNodes( CM.nSubcircuits, CF.data.node );   // tree of the sub-circuits
 
-  LD.add( LOAD0_NAME, LOAD0_POWER_W, LOAD0_LOCK_ON_SEC, LOAD0_LOCK_OFF_SEC, LOAD0_ON_OUT, LOAD0_MODE_IN, LOAD0_RADIO_MODEL, LOAD0_CHANNEL); // initializes the highest-priority load
-  LD.add( LOAD1_NAME, LOAD1_POWER_W, LOAD1_LOCK_ON_SEC, LOAD1_LOCK_OFF_SEC, LOAD1_ON_OUT, LOAD1_MODE_IN, LOAD1_RADIO_MODEL, LOAD1_CHANNEL); // initializes the lowest-priority load
+  HM.begin( CF.data.vxNomVeff, CF.data.igNomAeff, CF.data.icNomAeff );   // nominal values for the plausibility checks of the measures
+  HR.begin( &CM, CF.data.vxNomVeff, CF.data.igNomAeff, CF.data.icNomAeff, CV.NodeNomA );   // nominal values for the recommendations of the headroom statistics
+  BK.begin( CF.data.breakerA, CF.data.breakerCurve, CF.data.vxNomVeff );   // thermal model of the breakers
+#if WAVEFORM_RECORDER
+  WR.begin( CF.data.vxNomVeff, RECORDER_TRIGGERS );   // waveform recorder, armed
+#endif
+  LP.begin( NIGHT_PROFILE );              // night profile allowed
+
+  LD.begin( CF.data.rotate_s );           // rotation of the loads of equal priority
+  for( int i = 0; i < CF.data.nLoads; i++ )   // initializes the loads, from highest to lowest priority
+  {
+    Config::LoadData *pL = &CF.data.load[i];
+    if( pL->phase > CM.nPhases )
+    {
+      snprintf_P(buffer, 99, PSTR("Load \"%s\": phase %d is not measured, decided on the first phase"), pL->name, pL->phase);
+      Serial.println(buffer);
+    }
+    if( pL->node > CM.nSubcircuits )
+    {
+      snprintf_P(buffer, 99, PSTR("Load \"%s\": sub-circuit %d is not measured, decided on the main supply"), pL->name, pL->node);
+      Serial.println(buffer);
+    }
+    LD.add( pL, ( pL->phase > CM.nPhases ) ? 0 : pL->phase - 1, ( pL->node > CM.nSubcircuits ) ? 0 : pL->node );
+  }
+
+  if( ( BC.cause == Breadcrumbs::RESET_WATCHDOG ) && BC.valid && ( BC.previous.configCrc == CF.crc(&CF.data) ) )
+  {
+    for( int i = 0; i < LD.nLoads; i++ )    // restores the loads which were On before the watchdog reset
+    {
+      if( BC.previous.loadsOn & ( 1 << i ) )
+      {
+        LD.on[i] = true;
+        LD.lockSec[i] = LD.lockOnSec[i];
+      }
+    }
+    LD.cause = "restored after watchdog reset";
+  }
 
   wdt_reset();                            // resets watchdog counter
 
   DS.begin( BUTTON_IN );                  // set-up of the display
 
+  MB.begin( MODBUS_SERIAL, MODBUS_BAUD, MODBUS_ADDRESS, MODBUS_DE_OUT );   // set-up of the Modbus slave
+
   wdt_reset();                            // resets watchdog counter
 }
 
@@ -193,16 +384,40 @@ void loop()
   wdt_reset();                            // resets watchdog counter
   //if(CT.minutes>1)  while(1);           // testing watchdog
 
-  CT.update();                            // update time counting   
-  SM.receiveValues();                     // receive optional serial commands for simulation and printing of values
-  CM.getCycle( &SM );                     // samples electrical inputs during a grid cycle
-  CV.compute( &SM, &CM );                 // computes the electrical magnitudes from the sampled values
-  LD.decide( &CT, &CV );                  // decides whether activate or de-activate the loads
-  LD.activate( &CT, &RD, &CV );           // executes the activation/de-activation of the loads
-  DS.show( &CR, &CT, &CV, &SM, &LD );     // refreshes the display
+  BC.mark( Breadcrumbs::STAGE_TIME );     // each task is recorded before it is executed, so that a hung task is known after the watchdog reset
+  CT.update( CM.takeSleptUs() );          // update time counting, with the time missed by millis() during the conversions asleep
+  BC.time( &CT );
+  BC.mark( Breadcrumbs::STAGE_COMMANDS );
+  CMD.receive();                          // receive optional serial commands for simulation, configuration and printing of values
+  BC.mark( Breadcrumbs::STAGE_MODBUS );
+  MB.poll( &CT, &SM, &CV, &LD, &HM );     // answer the Modbus requests
+  if( LP.measureDue( &CT ) )              // every loop, or once per second in the night profile
+  {
+    BC.mark( Breadcrumbs::STAGE_SAMPLING );
+    CM.getCycle( &SM );                   // samples electrical inputs during a grid cycle
+    BC.mark( Breadcrumbs::STAGE_COMPUTING );
+    CV.compute( &SM, &CM );               // computes the electrical magnitudes from the sampled values
+    BK.update( &CT, &SM, &CM, &CV );      // thermal stress of the breakers, margins from their thermal headroom
+    HM.check( &CT, &SM, &CM, &CV );       // checks that the measures are plausible
+    HR.update( &CT, &SM, &CM, &CV );      // headroom statistics of the analog inputs
+#if WAVEFORM_RECORDER
+    WR.update( &CT, &CM, &CV, &LD );      // records the waveforms of the cycle, checks the triggers
+#endif
+  }
+  else
+    LP.idle();                            // sleeps until the next interrupt
+  LP.update( &CT, &CV, &HM, &LD, &DS );   // enters or leaves the night profile
+  BC.mark( Breadcrumbs::STAGE_DECIDING );
+  LD.decide( &CT, &CV, &HM );             // decides whether activate or de-activate the loads
+  BC.mark( Breadcrumbs::STAGE_ACTIVATING );
+  LD.activate( &CT, &RD, &CV, &BC );      // executes the activation/de-activation of the loads
+  BC.mark( Breadcrumbs::STAGE_DISPLAY );
+  DS.show( &CR, &CT, &CV, &SM, &LD, &BC, &HM );   // refreshes the display
+  MS.update( &CT );                       // scans periodically the RAM use
   
   if(CT.flagOneSec) 
   {
+    BC.mark( Breadcrumbs::STAGE_PRINTING );
     switch(SM.printCode)                  // if a print command character has been received, print the corresponding values to serial
     {
       case '1': printTimes();             // prints the elapsed time and the time consumed by each program task
@@ -213,6 +428,18 @@ void loop()
                 break;
       case '4': printFilteredValues();    // prints the powers after being filtered (for time-smoothing)
                 break;
+      case '5': printMemory();            // prints the free RAM, the peak stack depth, the heap use and the largest fill of the shared buffer
+                break;
+      case '6': printHeadroom();          // prints the headroom statistics of the analog inputs and the recommended nominal values
+                break;
+      case '7': printWindowValues();      // prints the values of the last cycle and the values aggregated over the last window
+                break;
+      case '8': printPhases();            // prints the values, the filtered powers and the margin of every phase and sub-circuit
+                break;
+      case '9': printBreaker();           // prints the current, the thermal stress, the margin and the time to trip of every breaker
+                break;
+      case 'J': printJsonValues();        // prints the values as JSON lines (load changes are printed as JSON lines too)
+                break;
       case '0':
       case ' ':
       default:  break;
@@ -15,6 +15,41 @@ This task is performed once for every grid cycle measured
 Hardware conditioning of Vx, Ig and Ic analog inputs must ensure a floating ground of 2.5V 
 and a maximum amplitude of 2 V, in order not to exceeed the 0 to 5V ADC input range
 
+The RMS values and the powers are aggregated over a window of windowCycles measured cycles
+(by default 10 cycles at 50Hz or 12 at 60Hz, i.e. 200 ms, in the spirit of IEC 61000-4-30):
+the windowed RMS values are the square root of the average of the squared RMS values of the cycles, and the windowed powers are their average.
+The cycles of a window are not contiguous, since other tasks are run between two measured cycles (loop() lasts more than one cycle),
+so that the window covers windowCycles loop() cycles, not 200 ms of the grid.
+The consecutive cycles of the synchronous averaging of measure.h (setting average) are not used for the window: they add the samples
+of the same phase, so that the RMS values are those of the averaged waveform (what is not synchronous with the grid cancels out instead of
+being aggregated), their sums fit into an int only up to 16 cycles (4 with two bits of oversampling), and loop() would be blocked for the whole window.
+The filtered powers, and so the decisions about the loads, are updated only once per window, from the windowed powers,
+thus a single noisy cycle weighs 1/windowCycles. With windowCycles = 1, every cycle is used as before.
+
+With several phases (see measure.h), the RMS values and the powers are computed for every phase with the reference V0 shared by all of them.
+The total powers Pg, Pc, Pn (and their windowed and filtered values) are the sums of the phases, and VxEff, IgEff, IcEff are those of the first phase.
+There are two margins: Margin, of the total consumption to MaxConsumpt (contracted power), and MarginPh of each phase to its own limit PhaseMax (breaker of the phase).
+The margin available to a load is the smallest of the total margin and the margin of its phase (margin()).
+The excedent available to a load depends on the metering rule of the grid meter (excedent()):
+- vector sum (most meters): the energy exported by a phase offsets the energy imported by another one, so the excedent is the total PnFilt
+- per phase: every phase is metered on its own, so only the excedent of the phase of the load can be used
+With a single phase, both rules give the same excedent, and the limit of the phase is MaxConsumpt.
+
+The sub-circuits measured by their own current transformer (see measure.h) are the nodes of a tree below the main supply (node 0, see config.h).
+The RMS current of each sub-circuit is aggregated and filtered as the powers, and its margin is its current limit minus its filtered current,
+converted to watts with the voltage of its phase. The margin available to a load is then the smallest of the margins along its path:
+total, its phase, and every sub-circuit from the one of the load up to the main supply.
+The margins below which the loads are shed (ShedMarginPh, ShedMarginNd, shedMargin()) are the same, unless the breakers are modelled (breaker.h):
+then a load is switched On only within the steady-state rating of the breakers, and shed only when their thermal headroom is used.
+
+The volatility of the excedent PnVolat is the RMS rate of change of PnFilt (W/s), averaged over VOLATILITY_TIME_CONSTANT_S:
+near zero with a clear sky or a steady consumption, large with broken clouds. It drives the decide period of the loads (see loads.h).
+
+When a load is switched On, its inrush (a motor draws several times its power for some cycles) would reach the filtered powers and the margins,
+and the decisions would react to the transient instead of to the settled draw. Every switch to On opens a settle window of the load (settle()), set by loads.h:
+while it lasts, the weight of every window in the filters is multiplied by SETTLE_WEIGHT, and the decisions on the excedent are postponed until it ends (settling()), but not the shedding on the margins (see loads.h).
+The breaker model (breaker.h) still integrates every cycle, since it models the inrush tolerance of the breakers.
+
 The sign convention for the powers is:
 - positive for generated solar power and for excedents exported to the grid
 - negative for consumed power and for deficits imported from the grid
@@ -23,14 +58,24 @@ The sign convention for the powers is:
 
 const float V0_REF_V = 2.5;           // DC reference voltage at the V0 analog input, which acts as an offset (floating ground) for the other three analog inputs (grid voltage, solar generated current and consumed current)
 const float MAX_AMPL_V = 2.0;         // Largest expected amplitude at the three analog inputs (grid voltage, solar generated current and consumed current), reached when their nominal RMS voltage or current is achieved
+const float VOLATILITY_TIME_CONSTANT_S = 30.0;  // time constant of the volatility of the filtered excedent (seconds)
 const float TIME_CONSTANT_US = 1.0e6; // Filtering  time constant for the powers in microseconds (default 1 second)
+const float SETTLE_WEIGHT = 0.1;      // weight of the windows in the filters during the settle window after a switch to On, relative to the others
 
 class Values 
 {
   public:
   Values(void) {};
-  void begin( float VxNomVeff, float IgNomAeff, float IcNomAeff, float MaxConsumpt_arg);
+  void begin( float VxNomVeff, float IgNomAeff, float IcNomAeff, float MaxConsumpt_arg, int windowCycles_arg, int nPhases_arg, const float *PhaseMax_arg, bool meteringPerPhase_arg);
   void compute(Simul *pSM, Measure *pCM);
+  float margin(int phase);            // consumption margin available to a load on a phase
+  float excedent(int phase);          // filtered solar excedent available to a load on a phase, according to the metering rule
+  void beginNodes(int nNodes_arg, const Config::NodeData *pNodes);  // sets the tree of sub-circuits
+  float margin(int phase, int node);  // consumption margin available to a load on a phase and behind a sub-circuit (0 if none)
+  float shedMargin(int phase, int node);  // margin below which the loads on a phase and behind a sub-circuit are shed
+  bool branchOverloaded(int node);    // true if there is no margin on a sub-circuit of the path of a node
+  void settle(unsigned long ms);      // opens a settle window after a switch to On (inrush), or extends the current one
+  bool settling(void);                // true while the settle window lasts
   float V0RefV = V0_REF_V;            // Offset voltage of the inputs (floating ground), also used as a voltage reference to compute volts per count ratio of the ADC
   float MaxAmplV = MAX_AMPL_V;        // Maximum expected amplitude in the analog inputs
   float VxRatio;                      // Ratio between the grid RMS voltage and the amplitude at the corresponding analog input
@@ -46,145 +91,370 @@ class Values
   float Pn;                           // Computed net power balance (positive if excedents exported to grid, negative if deficits imported from grid)
   float PFg;                          // Computed power factor (cos phi) of the solar generated power
   float PFc;                          // Computed power factor (cos phi) of the consumed power
+  int windowCycles = 1;               // Number of cycles of the aggregation window
+  int windowCount = 0;                // Cycles already aggregated into the current window
+  bool windowReady = false;           // True on the cycle which completes a window (the windowed values have been updated)
+  float VxEffWin;                     // Grid RMS voltage aggregated over the last window
+  float IgEffWin;                     // Solar generation RMS intensity aggregated over the last window
+  float IcEffWin;                     // Consumption RMS intensity aggregated over the last window
+  float PgWin;                        // Solar generated power aggregated over the last window
+  float PcWin;                        // Consumed power aggregated over the last window
+  float PnWin;                        // Net power aggregated over the last window
+  float PFgWin;                       // Power factor of the solar generated power over the last window
+  float PFcWin;                       // Power factor of the consumed power over the last window
   float TimeConst = TIME_CONSTANT_US; // Time constant (microseconds) for filtering the powers
   float PgFilt;                       // Filtered solar generated power
   float PcFilt;                       // Filtered consumed power
   float PnFilt;                       // Filtered net power
   float MaxConsumpt;                  // Maximum allowed consumed power, if exceeded can trip grid protections
+  float PnVolat = 0.0;                // Volatility of the filtered excedent: RMS of its rate of change (W/s), over VOLATILITY_TIME_CONSTANT_S
   float Margin;                       // Difference between the maximum allowed consumed power, and the actual consumed power
-  unsigned long interval;             // Time between the previous grid cycle mesurement and the current measurement (0 if there is no previous
+  int nPhases = 1;                    // Number of phases measured
+  bool meteringPerPhase = false;      // Metering rule of the excedent: false vector sum of the phases, true each phase on its own
+  float VxEffPh[PHASES_MAX];          // Computed RMS voltage of each phase
+  float IgEffPh[PHASES_MAX];          // Computed RMS intensity of the solar generation of each phase (0 if not measured)
+  float IcEffPh[PHASES_MAX];          // Computed RMS intensity of the consumption of each phase
+  float PgPh[PHASES_MAX];             // Computed solar generated power of each phase
+  float PcPh[PHASES_MAX];             // Computed consumed power of each phase
+  float PgFiltPh[PHASES_MAX];         // Filtered solar generated power of each phase
+  float PcFiltPh[PHASES_MAX];         // Filtered consumed power of each phase
+  float PnFiltPh[PHASES_MAX];         // Filtered net power of each phase
+  float PhaseMax[PHASES_MAX];         // Maximum allowed consumed power of each phase
+  float MarginPh[PHASES_MAX];         // Difference between the maximum allowed consumed power of each phase, and its actual consumed power
+  float ShedMarginPh[PHASES_MAX];     // Margin of each phase for the shedding (thermal headroom of its breaker, or MarginPh)
+  int nNodes = 0;                     // Number of sub-circuits measured
+  uint8_t NodeParent[SUBCIRCUITS_MAX];// Parent of each sub-circuit (0 the main supply)
+  uint8_t NodePhase[SUBCIRCUITS_MAX]; // Phase of each sub-circuit, from 0
+  float NodeLimitA[SUBCIRCUITS_MAX];  // Maximum allowed RMS current of each sub-circuit
+  float NodeNomA[SUBCIRCUITS_MAX];    // Nominal RMS current of the transformer of each sub-circuit
+  float IsEff[SUBCIRCUITS_MAX];       // Computed RMS current of each sub-circuit
+  float IsFilt[SUBCIRCUITS_MAX];      // Filtered RMS current of each sub-circuit
+  float MarginNd[SUBCIRCUITS_MAX];    // Difference between the maximum allowed and the actual consumed power of each sub-circuit
+  float ShedMarginNd[SUBCIRCUITS_MAX];// Margin of each sub-circuit for the shedding (thermal headroom of its breaker, or MarginNd)
+  unsigned long interval;             // Time between the start of the previous window and the start of the current one (0 if there is no previous)
   unsigned long startUs;              // When the computation started
   unsigned long endUs;                // When the computation finished
   unsigned long samplingTimeAvg_us;   // Average sampling time of the 4 analog inputs
+  unsigned long settleStartUs = 0UL;  // When the settle window started
+  unsigned long settleUs = 0UL;       // Duration of the settle window
+  private:
+  float sumVx2, sumIg2, sumIc2;       // Sums of the squared RMS values of the cycles of the current window
+  float sumPg[PHASES_MAX], sumPc[PHASES_MAX];   // Sums of the powers of every phase of the cycles of the current window
+  float sumIs2[SUBCIRCUITS_MAX];      // Sums of the squared RMS currents of every sub-circuit of the cycles of the current window
+  float rms(int *, long, int);        // RMS value of samples, in counts
+  float meanProduct(int *, int *, long, int);   // average of the product of two arrays of samples, in counts
+  float rms64(long *, int);           // RMS value of wide samples (external ADC, centred on 0), in wide counts
+  float meanProduct64(long *, long *, int);     // average of the product of two arrays of wide samples, in wide counts
+  unsigned long windowStartUs = 0UL;  // When the first cycle of the current window started
+  unsigned long prevWindowStartUs = 0UL;  // When the first cycle of the previous window started
 };
 
-void Values::begin(float VxNomVeff, float IgNomAeff, float IcNomAeff, float MaxConsumpt_arg )
+void Values::begin(float VxNomVeff, float IgNomAeff, float IcNomAeff, float MaxConsumpt_arg, int windowCycles_arg, int nPhases_arg, const float *PhaseMax_arg, bool meteringPerPhase_arg )
 {
   VxRatio = VxNomVeff * 1.4142 / MaxAmplV;
   IgRatio = IgNomAeff * 1.4142 / MaxAmplV;
   IcRatio = IcNomAeff * 1.4142 / MaxAmplV;
   MaxConsumpt = MaxConsumpt_arg;
+  windowCycles = max( 1, windowCycles_arg );
+  Margin = MaxConsumpt;               // until the first window is complete
+  nPhases = constrain( nPhases_arg, 1, PHASES_MAX );
+  meteringPerPhase = meteringPerPhase_arg;
+
+  for( int p = 0; p < nPhases; p++ )
+  {
+    PhaseMax[p] = ( nPhases == 1 ) ? MaxConsumpt : PhaseMax_arg[p];   // a single phase is limited by the contracted power
+    MarginPh[p] = ShedMarginPh[p] = PhaseMax[p];
+  }
+}
+
+void Values::beginNodes(int nNodes_arg, const Config::NodeData *pNodes)
+{
+  nNodes = constrain( nNodes_arg, 0, SUBCIRCUITS_MAX );
+
+  for( int k = 0; k < nNodes; k++ )
+  {
+    NodeParent[k] = ( pNodes[k].parent <= nNodes ) ? pNodes[k].parent : 0;   // a parent which is not measured is replaced by the main supply
+    NodePhase[k] = constrain( pNodes[k].phase - 1, 0, nPhases - 1 );
+    NodeLimitA[k] = pNodes[k].limitA;
+    NodeNomA[k] = pNodes[k].nomAeff;
+    MarginNd[k] = NodeLimitA[k] * VxRatio * MaxAmplV / 1.4142;              // until the first window is complete, at the nominal voltage
+    ShedMarginNd[k] = MarginNd[k];
+  }
+}
+
+float Values::margin(int phase)
+{
+  return( min( Margin, MarginPh[phase] ) );
+}
+
+float Values::margin(int phase, int node)
+{
+  float m = margin(phase);
+
+  for( int n = ( node <= nNodes ) ? node : 0; n > 0; n = NodeParent[n-1] )   // up the tree to the main supply
+    m = min( m, MarginNd[n-1] );
+  return( m );
+}
+
+float Values::shedMargin(int phase, int node)
+{
+  float m = min( Margin, ShedMarginPh[phase] );
 
+  for( int n = ( node <= nNodes ) ? node : 0; n > 0; n = NodeParent[n-1] )
+    m = min( m, ShedMarginNd[n-1] );
+  return( m );
 }
 
+bool Values::branchOverloaded(int node)
+{
+  for( int n = ( node <= nNodes ) ? node : 0; n > 0; n = NodeParent[n-1] )
+    if( ShedMarginNd[n-1] <= 0.0 ) return( true );
+  return( false );
+}
 
+void Values::settle(unsigned long ms)
+{
+  unsigned long now = micros();
+  unsigned long left = settling() ? settleUs - ( now - settleStartUs ) : 0UL;   // time left of the current window
+  settleStartUs = now;
+  settleUs = max( left, ms * 1000UL );
+}
 
-void Values::compute(Simul *pSM, Measure *pCM)  // computes RMS voltage and currents, powers and power factors, takes 2ms approx.
+bool Values::settling(void)
 {
-  int i;
-  long offset, value, sum;
+  return( micros() - settleStartUs < settleUs );
+}
+
+float Values::excedent(int phase)
+{
+  return( meteringPerPhase ? PnFiltPh[phase] : PnFilt );
+}
+
+float Values::rms(int *x, long offset, int n)
+{
+  long value, sum = 0L;
+
+  for( int i = 0; i < n; i++ )
+  {
+    value = ((long) x[i]) - offset;   // substracts offset
+    sum += value * value;
+  }
+  return( sqrt(((float)sum) / ((float) n)) );
+}
+
+float Values::meanProduct(int *x, int *y, long offset, int n)
+{
+  long sum = 0L;
+
+  for( int i = 0; i < n; i++ )
+    sum += (((long) x[i]) - offset) * (((long) y[i]) - offset);   // substracts offset
+  return( ((float)sum) / ((float) n) );
+}
+
+float Values::rms64(long *x, int n)   // the squares of 24 bits samples need 64 bits sums
+{
+  int64_t sum = 0;
+
+  for( int i = 0; i < n; i++ )
+    sum += (int64_t) x[i] * x[i];
+  return( sqrt( (float) sum / (float) n ) );
+}
+
+float Values::meanProduct64(long *x, long *y, int n)
+{
+  int64_t sum = 0;
+
+  for( int i = 0; i < n; i++ )
+    sum += (int64_t) x[i] * y[i];
+  return( (float) sum / (float) n );
+}
+
+void Values::compute(Simul *pSM, Measure *pCM)  // computes RMS voltage and currents, powers and power factors, takes 2ms approx. per phase
+{
+  int i, p;
+  long offset, sum;
+  int n = pCM->numSamples;
 
   startUs = micros();
 
   // average sampling time
-  for( i=0, sum=0; i<pCM->numSamples; i++ )
+  for( i=0, sum=0; i<n; i++ )
     sum += pCM->samplingUs[i];
-  samplingTimeAvg_us = sum / pCM->numSamples;
+  samplingTimeAvg_us = sum / n;
 
   // offset value and conversion scaling factor
   sum = 0L; 
-  for(i=0; i<pCM->numSamples; i++)
+  for(i=0; i<n; i++)
     sum += (long) pCM->V0[i];
-  offset = sum / ((long) pCM->numSamples);  // averages offset
+  offset = sum / ((long) n);  // averages offset
   V0Avg = (float) offset;
   VoltsPerCount = V0RefV / max(1.0,V0Avg); // conversion scaling factor, avoids division by 0
 
-  // RMS grid voltage
-  sum = 0L; 
-  for(i=0; i<pCM->numSamples; i++)
+  float vxScale = VoltsPerCount * VxRatio;
+  float igScale = VoltsPerCount * IgRatio;
+  float icScale = VoltsPerCount * IcRatio;
+  float sumVI_g = 0.0;                // sums of the apparent powers of the phases, for the power factors
+  float sumVI_c = 0.0;
+  bool wide = ( pCM->pExt != NULL ) && ( pSM->mode != Simul::SIMUL_ANALOG );   // samples of an external ADC, computed from its wide buffers
+  float ws = wide ? pCM->pExt->wideScale : 1.0;
+
+  Pg = Pc = 0.0;
+  for( p = 0; p < nPhases; p++ )
   {
-    value = ((long) pCM->Vx[i]) - offset;  // substracts offset
-    sum += (value * value);
+    int *Vx = pCM->samples[ pCM->vxCh[p] ];
+    int *Ic = pCM->samples[ pCM->icCh[p] ];
+
+    // RMS grid voltage
+    VxEffPh[p] = wide ? rms64(pCM->wide[ pCM->vxCh[p] ], n) * ws * vxScale : rms(Vx, offset, n) * vxScale;
+
+    // solar generated RMS intensity and power, if there is an inverter on this phase
+    if( pCM->igCh[p] != -1 )
+    {
+      int *Ig = pCM->samples[ pCM->igCh[p] ];
+      if( wide )
+      {
+        IgEffPh[p] = rms64(pCM->wide[ pCM->igCh[p] ], n) * ws * igScale;
+        PgPh[p] = abs( meanProduct64(pCM->wide[ pCM->igCh[p] ], pCM->wide[ pCM->vxCh[p] ], n) * ws * ws * igScale * vxScale );
+      }
+      else
+      {
+        IgEffPh[p] = rms(Ig, offset, n) * igScale;
+        PgPh[p] = abs( meanProduct(Ig, Vx, offset, n) * igScale * vxScale );   // solar generated power is always positive (don't care wiring polarity)
+      }
+    }
+    else
+    {
+      IgEffPh[p] = 0.0;
+      PgPh[p] = 0.0;
+    }
+
+    // consumed RMS intensity and power
+    if( wide )
+    {
+      IcEffPh[p] = rms64(pCM->wide[ pCM->icCh[p] ], n) * ws * icScale;
+      PcPh[p] = - abs( meanProduct64(pCM->wide[ pCM->icCh[p] ], pCM->wide[ pCM->vxCh[p] ], n) * ws * ws * icScale * vxScale );
+    }
+    else
+    {
+      IcEffPh[p] = rms(Ic, offset, n) * icScale;
+      PcPh[p] = - abs( meanProduct(Ic, Vx, offset, n) * icScale * vxScale );     // consumed power is always negative (don't care wiring polarity)
+    }
+
+    if(pSM->mode == Simul::SIMUL_POWER)   // if simulating powers, they are applied to the first phase
+    {
+      PgPh[p] = ( p == 0 ) ? (float) pSM->Pg : 0.0;
+      PcPh[p] = ( p == 0 ) ? - (float) pSM->Pc : 0.0;
+    }
+
+    // clipping extreme values (when failing analog inputs), to avoid overflow when converting to int
+    VxEffPh[p] = constrain( VxEffPh[p],  0.0,  999.0 );
+    IgEffPh[p] = constrain( IgEffPh[p],  0.0,   99.0 );
+    IcEffPh[p] = constrain( IcEffPh[p],  0.0,   99.0 );
+    PgPh[p] =    constrain( PgPh[p],     0.0, 9999.0 );
+    PcPh[p] =    constrain( PcPh[p], -9999.0,    0.0 );
+
+    Pg += PgPh[p];
+    Pc += PcPh[p];
+    sumVI_g += VxEffPh[p] * IgEffPh[p];
+    sumVI_c += VxEffPh[p] * IcEffPh[p];
   }
-  VxEff = sqrt(((float)sum) / ((float) pCM->numSamples)) * (VoltsPerCount * VxRatio); 
 
-  // solar generated RMS intensity
-  sum = 0L; 
-  for(i=0; i<pCM->numSamples; i++)
+  // values of the first phase, and power factors and net power of all the phases
+  VxEff = VxEffPh[0];
+  IgEff = IgEffPh[0];
+  IcEff = IcEffPh[0];
+  PFg = constrain( Pg / max( 1.0, sumVI_g ), 0.0, 0.99 );    // power factor, avoid division by 0
+  PFc = constrain( - Pc / max( 1.0, sumVI_c ), 0.0, 0.99 );
+  Pn = Pg + Pc;               // net power (exported if >0, imported if <0)
+
+  // RMS currents of the sub-circuits
+  for( p = 0; p < nNodes; p++ )
+    IsEff[p] = constrain( rms( pCM->samples[ pCM->isCh[p] ], offset, n ) * VoltsPerCount * NodeNomA[p] * 1.4142 / MaxAmplV, 0.0, 99.0 );
+
+  // Aggregation over the window of cycles
+
+  if( windowCount == 0 )
   {
-    value = ((long) pCM->Ig[i]) - offset;  // substracts offset
-    sum += (value * value);
+    sumVx2 = sumIg2 = sumIc2 = 0.0;
+    for( p = 0; p < nPhases; p++ )
+      sumPg[p] = sumPc[p] = 0.0;
+    for( p = 0; p < nNodes; p++ )
+      sumIs2[p] = 0.0;
+    windowStartUs = pCM->cycleStartUs;
   }
-  IgEff = sqrt(((float)sum) / ((float) pCM->numSamples)) * (VoltsPerCount * IgRatio);
-  
-  // solar generated power and its power factor
-  sum = 0L; 
-  for(i=0; i<pCM->numSamples; i++)
-  {
-    value = (((long) pCM->Ig[i]) - offset) * (((long) pCM->Vx[i]) - offset); // substracts offset
-    sum += value;  
-  }  
-  Pg = (((float)sum) / ((float) pCM->numSamples)) * (VoltsPerCount * IgRatio) * (VoltsPerCount * VxRatio);
-  Pg = abs(Pg); // solar generated power is always positive (don't care wiring polarity)
-  PFg = Pg / max( 1.0, VxEff * IgEff); // power factor, avoid division by 0
-  
-  // consumed RMS intensity
-  sum = 0L; 
-  for(i=0; i<pCM->numSamples; i++)
+  sumVx2 += VxEff * VxEff;
+  sumIg2 += IgEff * IgEff;
+  sumIc2 += IcEff * IcEff;
+  for( p = 0; p < nPhases; p++ )
   {
-    value = ((long) pCM->Ic[i]) - offset;  // substracts offset
-    sum += value * value;
+    sumPg[p] += PgPh[p];
+    sumPc[p] += PcPh[p];
   }
-  IcEff = sqrt(((float)sum) / ((float) pCM->numSamples)) * (VoltsPerCount * IcRatio);
-  
-  // consumed power and its power factor
-  sum = 0L; 
-  for(i=0; i<pCM->numSamples; i++)
+  for( p = 0; p < nNodes; p++ )
+    sumIs2[p] += IsEff[p] * IsEff[p];
+  windowReady = ( ++windowCount >= windowCycles );
+  if( !windowReady )
   {
-    value = (((long) pCM->Ic[i]) - offset) * (((long) pCM->Vx[i]) - offset); // substracts offset
-    sum += value;
+    endUs = micros();
+    return;                           // the filtered powers are updated only when the window is complete
   }
-  Pc = (((float)sum) / ((float) pCM->numSamples)) * (VoltsPerCount * IcRatio) * (VoltsPerCount * VxRatio);
-  Pc = - abs(Pc); // consumed power is always negative (don't care wiring polarity)
-  PFc = - Pc / max( 1.0, VxEff * IcEff); // power factor, avoid division by 0
 
-  if(pSM->mode == Simul::SIMUL_POWER)   // if simulating powers
+  windowCount = 0;
+  VxEffWin = sqrt( sumVx2 / windowCycles );
+  IgEffWin = sqrt( sumIg2 / windowCycles );
+  IcEffWin = sqrt( sumIc2 / windowCycles );
+  PgWin = PcWin = 0.0;
+  for( p = 0; p < nPhases; p++ )
   {
-    Pg = (float) pSM->Pg;
-    Pc = - (float) pSM->Pc;
+    PgWin += sumPg[p] / windowCycles;
+    PcWin += sumPc[p] / windowCycles;
   }
+  PnWin = PgWin + PcWin;
+  PFgWin = constrain( sumPg[0] / windowCycles / max( 1.0, VxEffWin * IgEffWin ), 0.0, 0.99 );     // of the first phase, as the windowed RMS values
+  PFcWin = constrain( - sumPc[0] / windowCycles / max( 1.0, VxEffWin * IcEffWin ), 0.0, 0.99 );
 
-  // net power (exported if >0, imported if <0)
-  Pn = Pg + Pc;
-
-  // clipping extreme values (when failing analog inputs), to avoid overflow when converting to int
-
-  VxEff = constrain( VxEff,  0.0,  999.0 );
-  IgEff = constrain( IgEff,  0.0,   99.0 );
-  IcEff = constrain( IcEff,  0.0,   99.0 );              
-  Pg =    constrain( Pg,     0.0, 9999.0 );            
-  Pc =    constrain( Pc, -9999.0,    0.0 );                   
-  Pn =    constrain( Pn, -9999.0, 9999.0 );      
-  PFg =   constrain( PFg,    0.0,   0.99 ); 
-  PFc =   constrain( PFc,    0.0,   0.99 ); 
+  // Time between the start of the previous window and the start of the current one
+  if( prevWindowStartUs == 0UL )
+    interval = 0L;
+  else
+    interval = windowStartUs - prevWindowStartUs;
+  prevWindowStartUs = windowStartUs;
 
-  // Filtering (smoothing) of the powers, to avoid instability of the activation of the loads
+  // Filtering (smoothing) of the powers of every phase, to avoid instability of the activation of the loads
 
-  float alpha;  // weight in the filter formula of the most recent grid cycle measure
+  float alpha;  // weight in the filter formula of the most recent window
 
   if(interval ==0L)  // no filtering if ther are no previous measurements
+    alpha = 1.0;
+  else
+    alpha = min(1.0, ((float) interval) /TimeConst); // the weight of the new window computed as the time between successive windows divided by the time constant
+  if( settling() ) alpha *= SETTLE_WEIGHT;            // de-weights the inrush of a load just switched On
+
+  PgFilt = PcFilt = 0.0;
+  for( p = 0; p < nPhases; p++ )
   {
-    PgFilt = Pg;
-    PcFilt = Pc;
-    PnFilt = Pn;    
+    PgFiltPh[p] = PgFiltPh[p] + alpha * (sumPg[p] / windowCycles - PgFiltPh[p]);
+    PcFiltPh[p] = PcFiltPh[p] + alpha * (sumPc[p] / windowCycles - PcFiltPh[p]);
+    PnFiltPh[p] = PgFiltPh[p] + PcFiltPh[p];
+    MarginPh[p] = ShedMarginPh[p] = PhaseMax[p] - (-PcFiltPh[p]);   // remaining power margin of the phase until its maximum allowed consumption
+    PgFilt += PgFiltPh[p];
+    PcFilt += PcFiltPh[p];
   }
-  else
+  if( interval != 0L )                // volatility, from the change of the filtered excedent since the previous window
   {
-    alpha = min(1.0, ((float) interval) /TimeConst); // the weight of the new cycle measure computed as the time between successive grid cycle measures divided by the time constant
-    PgFilt = PgFilt + alpha * (Pg - PgFilt);
-    PcFilt = PcFilt + alpha * (Pc - PcFilt);
-    PnFilt = PgFilt + PcFilt;
- }
+    float rate = ( PgFilt + PcFilt - PnFilt ) * 1.0e6 / interval;
+    float beta = min( 1.0, interval / ( VOLATILITY_TIME_CONSTANT_S * 1.0e6 ) );
+    PnVolat = sqrt( sq(PnVolat) + beta * ( sq(rate) - sq(PnVolat) ) );
+  }
+  PnFilt = PgFilt + PcFilt;
 
- Margin = MaxConsumpt - (-PcFilt);  // remaining power margin until the maximum allowed consumption (Pc is negative)
+  Margin = MaxConsumpt - (-PcFilt);  // remaining power margin until the maximum allowed consumption (Pc is negative)
 
-  // Time between the previous grid cycle measure and the current one
-  if(pCM->prevCycleStartUs==0L)
-    interval = 0L;
-  else
-    interval = pCM->cycleStartUs-pCM->prevCycleStartUs;
+  for( p = 0; p < nNodes; p++ )       // remaining power margin of every sub-circuit, from its current
+  {
+    IsFilt[p] = IsFilt[p] + alpha * (sqrt( sumIs2[p] / windowCycles ) - IsFilt[p]);
+    MarginNd[p] = ShedMarginNd[p] = ( NodeLimitA[p] - IsFilt[p] ) * VxEffPh[ NodePhase[p] ];
+  }
  
   endUs = micros();
 }
-  
-
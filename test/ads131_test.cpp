@@ -0,0 +1,142 @@
+/*
+=====================================================================
+ads131_test.cpp
+Host test of the external ADC backend (ads131.h): a stand-in of the
+ADS131M04 on the SPI bus raises DRDY 2000 times per second and
+serves synthetic waveforms, measured with EXTERNAL_ADC set to 1
+=====================================================================
+*/
+
+#include "sketch_ads131.cpp"
+
+const unsigned long DRDY_PERIOD_US = 500UL;     // 2000 samples per second, 40 per cycle at 50Hz
+const int FRAME_BYTES = 18;                     // 6 words of 24 bits
+const double VX_FRACTION = 0.9;                 // amplitudes, as fractions of the nominal one (ADS_NOM_AMPL_V)
+const double IG_FRACTION = 0.5;
+const double IC_FRACTION = 0.25;
+const double IC_LAG_RAD = PI / 3.0;             // the consumed current lags the voltage by 60 degrees (power factor 0.5)
+
+static int failures = 0;
+
+#define CHECK(cond) do { if( !( cond ) ) { printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); failures++; } } while( 0 )
+#define CHECK_NEAR(value, expected, tolerance) CHECK( fabs( (value) - (expected) ) <= fabs( (expected) * (tolerance) ) )
+
+struct Ads131StandIn                            // the ADS131M04, as seen on its SPI bus and DRDY pin
+{
+  unsigned long nextDrdyUs = DRDY_PERIOD_US;
+  unsigned long drdys = 0;                      // DRDY raised
+  unsigned long frames = 0;                     // frames read
+  unsigned long csErrors = 0;                   // bytes exchanged with CS high, or transactions started with CS low
+  long latched[4];                              // channels of the last conversion
+  uint8_t out[FRAME_BYTES];                     // frame being sent
+  uint8_t in[FRAME_BYTES];                      // frame being received
+  int index = 0;
+  bool inIsr = false;
+  bool reset = false;                           // a RESET command was received
+  uint16_t clockReg = 0;                        // value written to the CLOCK register
+} ads;
+
+static long counts(double fraction, double angle)
+{
+  return( lround( fraction * ( ADS_NOM_AMPL_V / ADS_VREF_V ) * ADS_FULL_SCALE * sin(angle) ) );
+}
+
+static void adsConvert(void)                    // a new sample of the synthetic waveforms, at the time of DRDY
+{
+  double w = 2.0 * PI * MAINS_FREQ_HZ * ads.nextDrdyUs * 1.0e-6;
+  ads.latched[0] = counts(VX_FRACTION, w);
+  ads.latched[1] = counts(IG_FRACTION, w);
+  ads.latched[2] = counts(IC_FRACTION, w - IC_LAG_RAD);
+  ads.latched[3] = 0L;
+}
+
+static void adsBegin(void)                      // a frame starts: status, the 4 channels and a CRC, 24 bits each
+{
+  if( !( halPort & 1 ) ) ads.csErrors++;
+  memset(ads.out, 0, sizeof(ads.out));
+  ads.out[0] = 0x05;                            // status: data ready
+  for( int c = 0; c < 4; c++ )
+  {
+    long v = ads.latched[c] & 0xFFFFFFL;
+    ads.out[3 + 3*c] = v >> 16;
+    ads.out[4 + 3*c] = v >> 8;
+    ads.out[5 + 3*c] = v;
+  }
+  ads.index = 0;
+}
+
+static uint8_t adsTransfer(uint8_t b)
+{
+  if( halPort & 1 ) ads.csErrors++;
+  if( ads.index >= FRAME_BYTES ) return( 0 );
+  ads.in[ads.index] = b;
+  uint8_t r = ads.out[ads.index++];
+  if( ads.index == FRAME_BYTES )                // frame complete: executes its command
+  {
+    uint16_t command = ( ads.in[0] << 8 ) | ads.in[1];
+    uint16_t data = ( ads.in[3] << 8 ) | ads.in[4];
+    if( command == ADS_CMD_RESET ) ads.reset = true;
+    if( command == ( ADS_CMD_WREG | ( ADS_REG_CLOCK << 7 ) ) ) ads.clockReg = data;
+    ads.frames++;
+  }
+  return( r );
+}
+
+static void adsTick(void)                       // DRDY falls every DRDY_PERIOD_US, once the ADC is set up
+{
+  if( ads.inIsr || ( halIsr == NULL ) ) return;
+  while( (long) ( hal.us - ads.nextDrdyUs ) >= 0 )
+  {
+    adsConvert();
+    ads.nextDrdyUs += DRDY_PERIOD_US;
+    ads.drdys++;
+    ads.inIsr = true;
+    halIsr();
+    ads.inIsr = false;
+  }
+}
+
+static void runFor(unsigned long ms)
+{
+  unsigned long end = millis() + ms;
+  while( millis() < end ) loop();
+}
+
+int main(void)
+{
+  halPort = 1;                                  // CS high
+  hal.spi = adsTransfer;
+  hal.spiBegin = adsBegin;
+  hal.tick = adsTick;
+  setup();
+
+  CHECK( ads.reset );                           // set up: reset, then the data rate
+  CHECK( ads.clockReg == ADS_CLOCK_OSR2048 );
+  CHECK( hal.spiInterrupt == digitalPinToInterrupt(ADS_DRDY_PIN) );
+  CHECK( CM.pExt == &AD );
+
+  unsigned long frames = ads.frames;
+  runFor(5000);
+
+  CHECK( ads.drdys > 9000 );
+  CHECK( ads.frames - frames == ads.drdys );   // every frame is read, capturing or not
+  CHECK( ads.csErrors == 0 );
+  CHECK( halPort & 1 );
+  CHECK( AD.nFrames > 0 && AD.nFrames < ads.drdys );   // only the frames of the captures are counted
+  CHECK( !HM.faulty );
+
+  double vx = VX_FRACTION * CF.data.vxNomVeff * CF.data.vxCal;
+  double ig = IG_FRACTION * CF.data.igNomAeff * CF.data.igCal;
+  double ic = IC_FRACTION * CF.data.icNomAeff * CF.data.icCal;
+  CHECK_NEAR( CV.VxEff, vx, 0.005 );
+  CHECK_NEAR( CV.IgEff, ig, 0.005 );
+  CHECK_NEAR( CV.IcEff, ic, 0.005 );
+  CHECK_NEAR( CV.Pg, vx * ig, 0.01 );
+  CHECK_NEAR( CV.Pc, - vx * ic * cos(IC_LAG_RAD), 0.01 );
+  for( int i = 0; i < CM.numSamples; i++ )      // samples copied as 12 bits counts, V0 in the middle
+    CHECK( ( CM.samples[0][i] >= 0 ) && ( CM.samples[0][i] < 4096 ) );
+
+  printf("ads131_test: %lu DRDY, %lu frames, %lu captured, VxEff %.1f V, IgEff %.2f A, IcEff %.2f A, Pc %.0f W, %d failures\n",
+         ads.drdys, ads.frames, AD.nFrames, CV.VxEff, CV.IgEff, CV.IcEff, CV.Pc, failures);
+  return( failures ? 1 : 0 );
+}
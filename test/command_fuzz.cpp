@@ -0,0 +1,157 @@
+/*
+=====================================================================
+command_fuzz.cpp
+Host fuzz test of the serial command interpreter (command.h): the
+number parsers against a reference, then random lines through the
+registry of commands.ino, under the address and UB sanitizers
+=====================================================================
+*/
+
+#include "sketch.cpp"
+
+const int FUZZ_PARSES = 200000;         // random numbers given to the parsers
+const int FUZZ_LINES = 20000;           // random lines given to the interpreter
+
+static int failures = 0;
+
+#define CHECK(cond) do { if( !( cond ) ) { printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); failures++; } } while( 0 )
+
+static std::string randomNumber(void)   // mostly well formed numbers, with signs, decimals, overflows and stray characters
+{
+  static const char chars[] = "0123456789.+-e x";
+  std::string s;
+  int n = 1 + rand() % 14;
+
+  if( rand() % 3 == 0 ) s += ( rand() % 2 ) ? '-' : '+';
+  for( int i = 0; i < n; i++ )
+    s += ( rand() % 8 ) ? (char) ( '0' + rand() % 10 ) : chars[rand() % ( sizeof(chars) - 1 )];
+  return( s );
+}
+
+static bool wellFormed(const std::string &s, bool fix, int *pDecimals)   // syntax of an integer, or of a fixed-point number with up to 3 decimals
+{
+  size_t i = ( s[0] == '-' || s[0] == '+' ) ? 1 : 0;
+  int digits = 0, decimals = -1;
+
+  for( ; i < s.size(); i++ )
+  {
+    if( isdigit(s[i]) ) { digits++; if( decimals >= 0 ) decimals++; }
+    else if( fix && s[i] == '.' && decimals < 0 ) decimals = 0;
+    else return( false );
+  }
+  *pDecimals = max(decimals, 0);
+  return( digits > 0 && *pDecimals <= CMD_FIX_DECIMALS );
+}
+
+static void fuzzParsers(void)
+{
+  for( int it = 0; it < FUZZ_PARSES; it++ )
+  {
+    std::string s = randomNumber();
+    long v = 12345L;
+    int decimals;
+
+    bool ok = Command::parseInt(s.c_str(), &v);                          // integers: as strtoll, within 32 bits
+    if( wellFormed(s, false, &decimals) )
+    {
+      long long ref = strtoll(s.c_str(), NULL, 10);
+      bool fits = ( ref >= -2147483647LL ) && ( ref <= 2147483647LL );
+      CHECK( ok == fits );
+      if( ok ) CHECK( v == ref );
+    }
+    else CHECK( !ok );
+
+    v = 12345L;
+    ok = Command::parseFix(s.c_str(), &v);                               // fixed-point: exact thousandths, up to 9 significant digits
+    if( wellFormed(s, true, &decimals) )
+    {
+      long double ref = strtold(s.c_str(), NULL) * 1000.0L;
+      if( ok ) CHECK( (long double) v == roundl(ref) );
+      if( fabsl(ref) < 1.0e8L ) CHECK( ok );
+    }
+    else CHECK( !ok );
+    if( !ok ) CHECK( v == 12345L );                                      // the value is not touched when rejected
+  }
+}
+
+static std::string randomLine(void)     // tokens of the registry and random ones, separators, and sometimes raw bytes
+{
+  static const char *tokens[] = { "?", "A", "P", "X", "0", "1", "3", "9", "J", "S", "B", "W", "WT", "C", "CSET", "CLOAD", "CNODE", "CNAME", "CCHECK", "CUNDO",
+                                  "decide", "window", "maxcons", "vxcal", "phmax2", "nloads", "power", "group", "parent", "settle", "limit",
+                                  "0", "1", "-1", "7", "1.5", "-3.", ".5", "10.5", "99999999999", "2147483647", "-2147483648", "214748.3647", ".", "+", "-", "x" };
+  static const char *separators[] = { " ", "  ", "\t", ",", ", " };
+  std::string s;
+  int n = rand() % 9;
+
+  for( int i = 0; i < n; i++ )
+  {
+    if( rand() % 10 == 0 )
+      for( int j = rand() % 70; j > 0; j-- )
+      {
+        char c = 1 + rand() % 255;
+        s += ( c == '\n' || c == '\r' ) ? '~' : c;           // a single line
+      }
+    else
+      s += tokens[rand() % ( sizeof(tokens) / sizeof(*tokens) )];
+    s += separators[rand() % ( sizeof(separators) / sizeof(*separators) )];
+  }
+  return( s );
+}
+
+static std::string reply(const char *line)   // executes a line, returns what was printed
+{
+  Serial.tx.clear();
+  Serial.input(line);
+  Serial.input("\n");
+  CMD.receive();
+  return( Serial.tx );
+}
+
+static bool isError(const std::string &r)
+{
+  return( r.find("ERR") != std::string::npos );
+}
+
+int main(void)
+{
+  setup();
+  srand(1234);
+
+  fuzzParsers();
+
+  for( int it = 0; it < FUZZ_LINES; it++ )
+  {
+    std::string line = randomLine();
+    long lines = CMD.nLines;
+    std::string first = line.substr(0, line.find_first_of(" \t,"));
+    if( !strcasecmp(first.c_str(), "CSAVE") || !strcasecmp(first.c_str(), "CERASE") ) continue;   // they restart the board
+
+    std::string r = reply(line.c_str());
+    CHECK( CMD.nLines == lines + ( line.empty() ? 0 : 1 ) );
+    if( line.size() > (size_t) CMD_LINE_MAX ) CHECK( isError(r) );       // too long, discarded as a whole
+    if( Serial.rx.size() > 100000 ) { Serial.rx.clear(); Serial.rxIndex = 0; }
+  }
+
+  // the interpreter is still in a clean state, and the arguments are checked
+
+  CHECK( !isError( reply("?") ) );
+  CHECK( isError( reply("NOPE") ) );
+  CHECK( isError( reply("P 1 2 3") ) );
+  CHECK( isError( reply("CSET decide") ) );
+  CHECK( isError( reply("CSET decide x") ) );
+  CHECK( isError( reply("CSET decide 10.5") ) );                         // an integer setting does not take decimals
+  CHECK( !isError( reply("CSET decide 10") ) );
+  CHECK( !isError( reply("CSET vxcal 1.025") ) );
+  CHECK( isError( reply("CSET vxcal 1.0251") ) );
+  CHECK( isError( reply("CNODE 1 parent 0.5") ) );
+  CHECK( isError( reply("CLOAD 0 power 1.5") ) );
+  CHECK( isError( reply("CLOAD 0 channel -1") ) );                        // not stored as 255
+  CHECK( !isError( reply("CLOAD 0 channel 4") ) );
+  CHECK( reply("CCHECK").find("radio channel out of range") != std::string::npos );   // no cloned code for it
+  reply("CUNDO");
+  reply("X");
+  CHECK( reply("N").find("V0:0.00/0.00 (n/a)") != std::string::npos );    // no noise on the constant inputs of the host: no ratio
+
+  printf("command_fuzz: %ld lines, %ld rejected, %d failures\n", CMD.nLines, CMD.nErrors, failures);
+  return( failures ? 1 : 0 );
+}
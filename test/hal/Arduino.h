@@ -0,0 +1,205 @@
+/*
+=====================================================================
+Arduino.h (host)
+Minimal stand-in of the Arduino core for the Mega, so that the sketch
+can be compiled and run on the host by the tests of this folder
+=====================================================================
+*/
+
+/*
+NOTES:
+
+Only what the sketch uses is provided. The time is virtual: every call to micros() advances it by HAL_MICROS_STEP_US,
+delay() by the delay, and a conversion of the ADC by HAL_ADC_US, so that loop() runs as on the board without waiting.
+The analog inputs read hal.analog(pin) (512, the middle of the range, when not set).
+The serial ports read their characters from rx and write them to tx, Serial (port 0) also to the standard output if hal.echo is true.
+*/
+
+#pragma once
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdarg.h>
+#include <ctype.h>
+#include <math.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+const unsigned long HAL_MICROS_STEP_US = 2UL;   // time taken by a call to micros()
+const unsigned long HAL_ADC_US = 26UL;          // time of a conversion of the ADC
+
+struct Hal
+{
+  unsigned long us = 0UL;                       // virtual time since reset
+  int (*analog)(int) = NULL;                    // value of an analog input, from its pin (A0 to A15)
+  void (*tick)(void) = NULL;                    // called as the time advances, for the devices which raise interrupts
+  bool echo = false;                            // true to write Serial to the standard output
+  uint8_t (*spi)(uint8_t) = NULL;               // SPI device: byte received for every byte sent (0 if none)
+  void (*spiBegin)(void) = NULL;                // SPI device: start of a transaction
+  int spiInterrupt = -1;                        // interrupt given to SPI.usingInterrupt()
+};
+extern Hal hal;
+
+// program memory is the data memory on the host; %S (string in program memory) is %s
+
+#define PROGMEM
+#define PSTR(s) (s)
+class __FlashStringHelper;
+#define F(s) ((const __FlashStringHelper *)(s))
+void halFormat(char *out, const char *format);
+inline int snprintf_P(char *b, size_t n, const char *f, ...) { char ff[512]; halFormat(ff, f); va_list ap; va_start(ap, f); int r = vsnprintf(b, n, ff, ap); va_end(ap); return r; }
+inline int sprintf_P(char *b, const char *f, ...) { char ff[512]; halFormat(ff, f); va_list ap; va_start(ap, f); int r = vsprintf(b, ff, ap); va_end(ap); return r; }
+#define strlen_P strlen
+#define strcpy_P strcpy
+#define strncpy_P strncpy
+#define strcmp_P strcmp
+#define strcasecmp_P strcasecmp
+#define strncasecmp_P strncasecmp
+#define memcpy_P memcpy
+#define pgm_read_byte(p) (*(const uint8_t *)(p))
+#define pgm_read_word(p) (*(const uint16_t *)(p))
+#define pgm_read_dword(p) (*(const uint32_t *)(p))
+#define pgm_read_float(p) (*(const float *)(p))
+#define pgm_read_ptr(p) (*(void * const *)(p))
+
+#define min(a,b) ((a)<(b)?(a):(b))
+#define max(a,b) ((a)>(b)?(a):(b))
+#define abs(x) ((x)>0?(x):-(x))
+#define constrain(amt,low,high) ((amt)<(low)?(low):((amt)>(high)?(high):(amt)))
+#define round(x) ((x)>=0?(long)((x)+0.5):(long)((x)-0.5))
+#define sq(x) ((x)*(x))
+#define bit(b) (1UL << (b))
+#define bitRead(value, bit) (((value) >> (bit)) & 0x01)
+#define bitSet(value, bit) ((value) |= (1UL << (bit)))
+#define bitClear(value, bit) ((value) &= ~(1UL << (bit)))
+#define lowByte(w) ((uint8_t) ((w) & 0xff))
+#define highByte(w) ((uint8_t) ((w) >> 8))
+#define PI 3.1415926535897932384626433832795
+
+// digital and analog pins
+
+#define HIGH 1
+#define LOW 0
+#define INPUT 0
+#define OUTPUT 1
+#define INPUT_PULLUP 2
+#define FALLING 2
+#define RISING 3
+enum { A0 = 54, A1, A2, A3, A4, A5, A6, A7, A8, A9, A10, A11, A12, A13, A14, A15 };
+unsigned long micros(void);
+unsigned long millis(void);
+void delay(unsigned long);
+void delayMicroseconds(unsigned int);
+int analogRead(int);
+int digitalRead(int);
+void digitalWrite(int, int);
+void pinMode(int, int);
+long random(long, long);
+long random(long);
+void randomSeed(unsigned long);
+int digitalPinToInterrupt(int);
+void attachInterrupt(int, void (*)(void), int);
+void detachInterrupt(int);
+extern void (*halIsr)(void);                    // attached interrupt of an external pin, raised by the devices from hal.tick
+extern volatile uint8_t halPort;                // a single port register, for the pins driven directly
+#define digitalPinToPort(p) (0)
+#define digitalPinToBitMask(p) ((uint8_t) 1)
+#define portOutputRegister(port) (&halPort)
+
+// registers of the ADC, reset flags and status; setting ADSC converts at once the channel of ADMUX
+
+struct AdcsraReg
+{
+  volatile uint8_t v = 0;
+  operator uint8_t() const { return v; }
+  AdcsraReg &operator|=(unsigned long b);
+  AdcsraReg &operator&=(unsigned long b) { v &= b; return *this; }
+  AdcsraReg &operator=(unsigned long b) { v = b; return *this; }
+};
+extern AdcsraReg ADCSRA;
+extern volatile uint8_t ADCSRB, ADMUX, MCUSR, SREG;
+extern volatile uint16_t ADC;
+#define ADPS0 0
+#define ADPS1 1
+#define ADPS2 2
+#define ADIE 3
+#define ADIF 4
+#define ADATE 5
+#define ADSC 6
+#define ADEN 7
+#define MUX5 3
+#define REFS0 6
+#define REFS1 7
+#define PORF 0
+#define EXTRF 1
+#define BORF 2
+#define WDRF 3
+#define ISR(v) extern "C" void v(void)
+#define EMPTY_INTERRUPT(v) extern "C" void v(void) {}
+#define ADC_vect halAdcVect
+#define cli()
+#define sei()
+#define noInterrupts()
+#define interrupts()
+
+// memory layout, for the report of memory.h: a static block from __heap_start stands for the free RAM of the Mega
+
+const int HAL_RAM_BYTES = 8192;
+#define SP ((uintptr_t) (&__heap_start + HAL_RAM_BYTES - 1024))
+#define RAMEND ((uintptr_t) (&__heap_start + HAL_RAM_BYTES - 1))
+
+// serial ports
+
+#define SERIAL_8N1 0x06
+#define DEC 10
+#define HEX 16
+
+class Print
+{
+  public:
+    virtual size_t write(uint8_t) = 0;
+    size_t write(const uint8_t *b, size_t n) { for( size_t i = 0; i < n; i++ ) write(b[i]); return n; }
+    size_t write(const char *s) { return write((const uint8_t *) s, strlen(s)); }
+    size_t write(const char *s, size_t n) { return write((const uint8_t *) s, n); }
+    size_t print(const char *s) { return write(s); }
+    size_t print(char c) { return write((uint8_t) c); }
+    size_t print(const __FlashStringHelper *f) { return write((const char *) f); }
+    size_t print(int v, int b = DEC) { return number(v, b); }
+    size_t print(unsigned int v, int b = DEC) { return number(v, b); }
+    size_t print(long v, int b = DEC) { return number(v, b); }
+    size_t print(unsigned long v, int b = DEC) { return number(v, b); }
+    size_t print(unsigned char v, int b = DEC) { return number(v, b); }
+    size_t print(double v, int d = 2) { char t[40]; snprintf(t, 40, "%.*f", d, v); return write(t); }
+    size_t println(void) { return write("\r\n"); }
+    template<class T> size_t println(T v) { size_t n = print(v); return n + println(); }
+    template<class T> size_t println(T v, int b) { size_t n = print(v, b); return n + println(); }
+  private:
+    size_t number(long long v, int b) { char t[40]; snprintf(t, 40, ( b == HEX ) ? "%llX" : "%lld", v); return write(t); }
+};
+
+class HardwareSerial : public Print
+{
+  public:
+    HardwareSerial(int port_arg) : port(port_arg) {};
+    void begin(unsigned long, uint8_t = SERIAL_8N1) {}
+    int available(void) { return rx.size() - rxIndex; }
+    int read(void) { return ( available() > 0 ) ? (uint8_t) rx[rxIndex++] : -1; }
+    int peek(void) { return ( available() > 0 ) ? (uint8_t) rx[rxIndex] : -1; }
+    int availableForWrite(void) { return 63; }
+    void flush(void) {}
+    size_t write(uint8_t c);
+    using Print::write;
+    operator bool() { return true; }
+    void input(const char *s, size_t n) { rx.append(s, n); }   // characters received, for the tests
+    void input(const char *s) { input(s, strlen(s)); }
+    std::string rx;                     // characters received
+    size_t rxIndex = 0;                 // next character to read
+    std::string tx;                     // characters written
+    int port;
+};
+extern HardwareSerial Serial, Serial1, Serial2, Serial3;
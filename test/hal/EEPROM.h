@@ -0,0 +1,16 @@
+// EEPROM.h (host): 4 KB of EEPROM, erased (0xFF) at start
+#pragma once
+const int HAL_EEPROM_BYTES = 4096;
+class EEPROMClass
+{
+  public:
+    EEPROMClass(void) { memset(d, 0xFF, sizeof(d)); }
+    uint8_t read(int a) { return d[a]; }
+    void write(int a, uint8_t v) { d[a] = v; }
+    void update(int a, uint8_t v) { d[a] = v; }
+    template<class T> T &get(int a, T &t) { memcpy(&t, d + a, sizeof(T)); return t; }
+    template<class T> const T &put(int a, const T &t) { memcpy(d + a, &t, sizeof(T)); return t; }
+    uint16_t length(void) { return HAL_EEPROM_BYTES; }
+    uint8_t d[HAL_EEPROM_BYTES];
+};
+extern EEPROMClass EEPROM;
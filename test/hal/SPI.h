@@ -0,0 +1,20 @@
+// SPI.h (host): the bytes are exchanged with the device of hal.spi (0 without a device)
+#pragma once
+#define MSBFIRST 1
+#define SPI_MODE0 0
+#define SPI_MODE1 1
+struct SPISettings
+{
+  SPISettings(long, int, int) {}
+  SPISettings(void) {}
+};
+class SPIClass
+{
+  public:
+    void begin(void) {}
+    void usingInterrupt(uint8_t);
+    void beginTransaction(SPISettings);
+    void endTransaction(void);
+    uint8_t transfer(uint8_t);
+};
+extern SPIClass SPI;
@@ -0,0 +1,8 @@
+// Wire.h (host): no I2C device
+#pragma once
+class TwoWire
+{
+  public:
+    void begin(void) {}
+};
+extern TwoWire Wire;
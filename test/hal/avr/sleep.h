@@ -0,0 +1,9 @@
+// avr/sleep.h (host): sleep_cpu() converts the channel of ADMUX, as the noise reduction mode of the ADC
+#pragma once
+#define SLEEP_MODE_IDLE 0
+#define SLEEP_MODE_ADC 1
+inline void set_sleep_mode(int) {}
+inline void sleep_enable(void) {}
+inline void sleep_disable(void) {}
+inline void sleep_mode(void) {}
+void sleep_cpu(void);
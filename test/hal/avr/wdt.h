@@ -0,0 +1,8 @@
+// avr/wdt.h (host): the watchdog never resets the host
+#pragma once
+#define WDTO_15MS 0
+#define WDTO_2S 7
+#define WDTO_8S 9
+inline void wdt_enable(int) {}
+inline void wdt_disable(void) {}
+inline void wdt_reset(void) {}
@@ -0,0 +1,100 @@
+/*
+=====================================================================
+hal.cpp (host)
+Virtual time, ports and devices of the host stand-in of the Arduino
+core (see Arduino.h)
+=====================================================================
+*/
+
+#include "Arduino.h"
+#include "EEPROM.h"
+#include "SPI.h"
+#include "Wire.h"
+
+Hal hal;
+AdcsraReg ADCSRA;
+volatile uint8_t ADCSRB, ADMUX, MCUSR, SREG;
+volatile uint16_t ADC;
+volatile uint8_t halPort;
+char __heap_start[HAL_RAM_BYTES];               // RAM between the static data and the stack
+char *__brkval = NULL;
+HardwareSerial Serial(0), Serial1(1), Serial2(2), Serial3(3);
+TwoWire Wire;
+EEPROMClass EEPROM;
+SPIClass SPI;
+
+void halFormat(char *out, const char *f)      // format of the host printf: %S (string in program memory) is %s
+{
+  while( *f )
+  {
+    *out++ = *f;
+    if( *f++ != '%' ) continue;
+    while( *f && strchr("-+ #0123456789.l", *f) ) *out++ = *f++;
+    if( *f == 'S' ) { *out++ = 's'; f++; }
+  }
+  *out = 0;
+}
+
+static void advance(unsigned long dt)
+{
+  hal.us += dt;
+  if( hal.tick != NULL ) hal.tick();
+}
+
+unsigned long micros(void) { advance(HAL_MICROS_STEP_US); return( hal.us ); }
+unsigned long millis(void) { return( hal.us / 1000UL ); }
+void delay(unsigned long ms) { advance(ms * 1000UL); }
+void delayMicroseconds(unsigned int us) { advance(us); }
+
+static int convert(void)                       // conversion of the channel selected by ADMUX and MUX5
+{
+  int channel = ( ADMUX & 7 ) | ( ( ADCSRB & bit(MUX5) ) ? 8 : 0 );
+  return( hal.analog != NULL ? hal.analog(A0 + channel) : 512 );
+}
+
+int analogRead(int pin) { advance(4 * HAL_ADC_US); return( hal.analog != NULL ? hal.analog(pin) : 512 ); }
+
+AdcsraReg &AdcsraReg::operator|=(unsigned long b)
+{
+  if( b & bit(ADSC) )                          // the conversion is done at once
+  {
+    advance(HAL_ADC_US);
+    ADC = convert();
+    b &= ~bit(ADSC);
+  }
+  v |= b;
+  return( *this );
+}
+
+void sleep_cpu(void)                           // the conversion happens while the CPU sleeps, the time is counted by the timer only
+{
+  ADC = convert();
+}
+
+int digitalRead(int) { return( HIGH ); }
+void digitalWrite(int, int) {}
+void pinMode(int, int) {}
+long random(long a, long b) { return( a + rand() % ( b - a ) ); }
+long random(long b) { return( rand() % b ); }
+void randomSeed(unsigned long s) { srand(s); }
+
+size_t HardwareSerial::write(uint8_t c)
+{
+  tx += (char) c;
+  if( ( port == 0 ) && hal.echo ) putchar(c);
+  return( 1 );
+}
+
+// interrupts of the external pins, raised by the devices from hal.tick
+
+void (*halIsr)(void) = NULL;
+int digitalPinToInterrupt(int pin) { return( pin ); }
+void attachInterrupt(int, void (*isr)(void), int) { halIsr = isr; }
+void detachInterrupt(int) { halIsr = NULL; }
+
+// SPI bus, to the device of hal.spi if any
+
+void SPIClass::usingInterrupt(uint8_t n) { hal.spiInterrupt = n; }
+void SPIClass::beginTransaction(SPISettings) { if( hal.spiBegin != NULL ) hal.spiBegin(); }
+void SPIClass::endTransaction(void) {}
+uint8_t SPIClass::transfer(uint8_t out) { return( hal.spi != NULL ? hal.spi(out) : 0 ); }
@@ -0,0 +1,9 @@
+// util/crc16.h (host): CRC-16 (polynomial 0xA001 reflected), as used by Modbus
+#pragma once
+inline uint16_t _crc16_update(uint16_t crc, uint8_t a)
+{
+  crc ^= a;
+  for( int i = 0; i < 8; i++ )
+    crc = ( crc & 1 ) ? ( crc >> 1 ) ^ 0xA001 : ( crc >> 1 );
+  return crc;
+}
@@ -0,0 +1,183 @@
+/*
+=====================================================================
+modbus_test.cpp
+Host test of the Modbus RTU slave (modbus.h): a local master sends
+requests to Serial1 and checks the answers against the register map
+=====================================================================
+*/
+
+#include <vector>
+#include <algorithm>
+#include "sketch.cpp"
+
+static int failures = 0;
+
+#define CHECK(cond) do { if( !( cond ) ) { printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); failures++; } } while( 0 )
+
+typedef std::vector<uint8_t> Frame;
+
+static uint16_t crcOf(const uint8_t *b, size_t n)
+{
+  uint16_t c = 0xFFFF;
+  for( size_t i = 0; i < n; i++ ) c = _crc16_update(c, b[i]);
+  return( c );
+}
+
+static void runFor(unsigned long ms)      // runs loop() for a time of the virtual clock
+{
+  unsigned long end = millis() + ms;
+  while( millis() < end ) loop();
+}
+
+static Frame sealed(Frame f)              // a frame with its CRC
+{
+  uint16_t c = crcOf(f.data(), f.size());
+  f.push_back(lowByte(c));
+  f.push_back(highByte(c));
+  return( f );
+}
+
+static Frame request(Frame pdu, bool withCrc = true)   // sends a request (address and PDU) to the slave, returns its answer (empty if none)
+{
+  if( withCrc ) pdu = sealed(pdu);
+  Serial1.tx.clear();
+  Serial1.input((const char *) pdu.data(), pdu.size());
+  loop();
+  Frame answer(Serial1.tx.begin(), Serial1.tx.end());
+  if( answer.size() >= 4 )
+    CHECK( crcOf(answer.data(), answer.size() - 2) == ( answer[answer.size()-2] | ( answer[answer.size()-1] << 8 ) ) );
+  return( answer );
+}
+
+static int reg(const Frame &a, int i)     // register i of a read answer
+{
+  return( (int16_t) ( ( a[3 + 2*i] << 8 ) | a[4 + 2*i] ) );
+}
+
+static void checkException(Frame pdu, uint8_t code)
+{
+  Frame a = request(pdu);
+  CHECK( a.size() == 5 );
+  if( a.size() != 5 ) return;
+  CHECK( a[1] == ( pdu[1] | 0x80 ) );
+  CHECK( a[2] == code );
+}
+
+int main(void)
+{
+  setup();
+  Serial.input("P 3000 1000\n");          // simulated powers: 3000 W generated, 1000 W consumed
+  runFor(10000);
+
+  // input registers 0 to 19, against the values they map
+
+  Frame a = request({ 1, 4, 0, 0, 0, 20 });
+  CHECK( a.size() == 3 + 40 + 2 );
+  CHECK( a[0] == 1 && a[1] == 4 && a[2] == 40 );
+  CHECK( reg(a, 3) == round( CV.Pg ) );
+  CHECK( abs( reg(a, 3) - 3000 ) <= 30 );
+  CHECK( abs( reg(a, 4) + 1000 ) <= 10 );
+  CHECK( reg(a, 10) == round( CV.PnFilt ) );
+  CHECK( reg(a, 11) == round( CV.Margin ) );
+  CHECK( reg(a, 12) == round( CV.MaxConsumpt ) );
+  CHECK( reg(a, 13) == CT.hours && reg(a, 14) == CT.minutes );
+  CHECK( reg(a, 16) == Simul::SIMUL_POWER );
+  CHECK( reg(a, 17) == LD.nLoads );
+  CHECK( reg(a, 18) == 0 );
+
+  // holding registers give the same values
+
+  Frame h = request({ 1, 3, 0, 12, 0, 1 });
+  CHECK( h.size() == 7 && h[1] == 3 && reg(h, 0) == round( CV.MaxConsumpt ) );
+
+  // registers of the loads, and of the phases
+
+  a = request({ 1, 4, 0, 20, 0, 16 });
+  CHECK( a.size() == 3 + 32 + 2 );
+  for( int n = 0; n < 2 && n < LD.nLoads; n++ )
+  {
+    CHECK( reg(a, 8*n + 0) == LD.on[n] );
+    CHECK( reg(a, 8*n + 1) == LD.solarMode[n] );
+    CHECK( reg(a, 8*n + 3) == round( LD.powerW[n] ) );
+    CHECK( reg(a, 8*n + 4) == 0 );
+    CHECK( reg(a, 8*n + 5) == LD.phase[n] + 1 );
+    CHECK( reg(a, 8*n + 6) == LD.node[n] );
+  }
+  a = request({ 1, 4, 0, MODBUS_PHASE_REGS, 0, 6 });
+  CHECK( a.size() == 3 + 12 + 2 );
+  CHECK( reg(a, 2) == round( CV.PgFiltPh[0] ) );
+  CHECK( reg(a, 4) == round( CV.PnFiltPh[0] ) );
+
+  // coils: override load 0 to Off, then command loads 0 and 1 On
+
+  Frame echo = { 1, 5, 0, 0, 0xFF, 0x00 };
+  a = request(echo);
+  CHECK( a.size() == 8 && std::equal(echo.begin(), echo.end(), a.begin()) );
+  CHECK( LD.forced[0] && !LD.forcedOn[0] );
+  a = request({ 1, 15, 0, 16, 0, 2, 1, 0x03 });
+  CHECK( a.size() == 8 && a[1] == 15 && a[5] == 2 );
+  CHECK( LD.forcedOn[0] && LD.forcedOn[1] );
+  a = request({ 1, 1, 0, 0, 0, 18 });
+  CHECK( a.size() == 3 + 3 + 2 && a[2] == 3 );
+  CHECK( a[3] == 0x01 && a[4] == 0x00 && a[5] == 0x03 );
+  a = request({ 1, 2, 0, 0, 0, 2 });        // discrete inputs: status On of the loads
+  CHECK( a.size() == 6 && ( a[3] & 1 ) == LD.on[0] );
+  request({ 1, 5, 0, 0, 0x00, 0x00 });     // override released
+  CHECK( !LD.forced[0] );
+
+  // exceptions
+
+  checkException({ 1, 8, 0, 0, 0, 0 }, 1);                          // illegal function
+  checkException({ 1, 4, 0, MODBUS_REGS - 1, 0, 2 }, 2);           // beyond the last register
+  checkException({ 1, 4, 0xFF, 0xFF, 0, 1 }, 2);
+  checkException({ 1, 4, 0, 0, 0, 0 }, 3);                          // no register
+  checkException({ 1, 4, 0, 0, 0, 31 }, 3);                         // answer larger than a frame
+  checkException({ 1, 5, 0, 0, 0x12, 0x34 }, 3);                    // coil value neither On nor Off
+  checkException({ 1, 5, 0, 15, 0xFF, 0x00 }, 2);                   // coil of a load which does not exist
+  checkException({ 1, 15, 0, 0, 0, 9, 1, 0xFF }, 3);                // byte count not matching the quantity
+
+  // frames which are not answered
+
+  CHECK( request({ 2, 4, 0, 0, 0, 1 }).empty() );                   // another slave
+  CHECK( request({ 0, 4, 0, 0, 0, 1 }).empty() );                   // broadcast read
+  CHECK( request({ 0, 5, 0, 1, 0xFF, 0x00 }).empty() );             // broadcast write, executed
+  CHECK( LD.forced[1] );
+  request({ 1, 5, 0, 1, 0x00, 0x00 });
+  unsigned long errors = MB.nErrors;
+  CHECK( request({ 1, 4, 0, 0, 0, 1, 0x00, 0x00 }, false).empty() ); // wrong CRC
+  CHECK( MB.nErrors == errors + 1 );
+
+  // a request split over several loops is answered, an incomplete one is discarded after the timeout
+
+  Serial1.tx.clear();
+  Serial1.input("\x01\x04\x00", 3);
+  loop();
+  CHECK( Serial1.tx.empty() );
+  a = request({ 0x00, 0x00, 0x01, 0x31, 0xCA }, false);             // rest of 01 04 00 00 00 01 and its CRC
+  CHECK( a.size() == 7 && a[1] == 4 );
+  Serial1.input("\x01\x04", 2);
+  runFor(2 * MODBUS_TIMEOUT_MS);
+  a = request({ 1, 4, 0, 17, 0, 1 });
+  CHECK( a.size() == 7 && reg(a, 0) == LD.nLoads );
+
+  // on a shared bus: the frames of the other slaves (requests of the master and their replies) are skipped,
+  // and the request which follows at once is answered, as after a noise byte
+
+  const Frame others[] = { sealed({ 2, 3, 6, 0, 1, 0, 2, 0, 3 }),                 // reply of another slave to a read of 3 registers
+                           sealed({ 2, 16, 0, 0, 0, 2, 4, 0, 1, 0, 2 }),          // write of 2 registers to another slave
+                           sealed({ 2, 0x83, 2 }),                                // exception of another slave
+                           { 0x55 } };                                            // noise
+  for( const Frame &f : others )
+  {
+    Serial1.input((const char *) f.data(), f.size());
+    a = request({ 1, 4, 0, 17, 0, 1 });
+    CHECK( a.size() == 7 && reg(a, 0) == LD.nLoads );
+  }
+  Serial1.input((const char *) others[0].data(), others[0].size());   // all of them in a single poll
+  Serial1.input((const char *) others[1].data(), others[1].size());
+  a = request({ 1, 4, 0, 13, 0, 1 });
+  CHECK( a.size() == 7 && reg(a, 0) == CT.hours );
+
+  printf("modbus_test: %lu requests answered, %d failures\n", MB.nRequests, failures);
+  return( failures ? 1 : 0 );
+}
@@ -0,0 +1,40 @@
+#!/bin/sh
+# Builds the sketch for the host with the stand-in of the Arduino core (hal/), and runs the host tests.
+# Usage: test/run.sh [test ...]   (all the tests by default)
+
+set -e
+cd "$(dirname "$0")"
+SRC=../source
+OUT=build
+CXX=${CXX:-g++}
+# -fpermissive only for the older code which the IDE accepts (radio.h, simul.h, measure.h), its warnings are printed
+CXXFLAGS="-std=gnu++11 -fpermissive -g -fsanitize=address,undefined -fno-sanitize=return -Ihal -I$SRC -I$OUT"
+TESTS=${*:-"modbus_test command_fuzz ads131_test"}
+mkdir -p $OUT
+
+# as the Arduino IDE: the other .ino files are appended to the main one, and their functions are declared before setup()
+
+{
+  for f in $SRC/*.ino; do
+    grep -hE '^(void|int|bool|long|float|char|uint8_t|uint16_t) [A-Za-z_0-9]+\(.*\)' $f | grep -v ';' | sed 's/).*/);/'
+  done | grep -v -E '^void (setup|loop)\('
+} > $OUT/prototypes.h
+
+{
+  echo '#include "Arduino.h"'
+  echo '#line 1 "solarDiverterPlusV03.ino"'
+  sed -e '/^void setup()/i #include "prototypes.h"' $SRC/solarDiverterPlusV03.ino
+  for f in $SRC/*.ino; do
+    [ "$f" = "$SRC/solarDiverterPlusV03.ino" ] && continue
+    echo "#line 1 \"$(basename $f)\""
+    cat $f
+  done
+} > $OUT/sketch.cpp
+sed 's/^#define EXTERNAL_ADC 0 /#define EXTERNAL_ADC 1 /' $OUT/sketch.cpp > $OUT/sketch_ads131.cpp   # with the external ADC
+
+failed=0
+for t in $TESTS; do
+  $CXX $CXXFLAGS $t.cpp hal/hal.cpp -o $OUT/$t
+  if ./$OUT/$t; then echo "PASS $t"; else echo "FAIL $t"; failed=1; fi
+done
+exit $failed